@@ -4,57 +4,55 @@
 #include <cstring>
 #include <cstdio>
 #include <utility>
-#include <list>
+#include <atomic>
+#include <thread>
 
 #include "stringset.h"
 #include "lyutils.h"
 #include "symtable.h"
 #include "ast.h"
+#include "irpass.h"
+#include "oilgen.h"
 
 using namespace std;
 
 extern SymbolTable global_scope;
-SymbolTable* current_scope = &global_scope;
+thread_local SymbolTable* current_scope = &global_scope;
 vector<structdef*> global_structdefs;
 vector<vardecl*> global_vardecls;
 vector<func*> global_funcs;
+static int worker_threads = 0; // 0 uses every core
 
 /*********************** superclass ***********************/
-ast::ast(const char* lex) : symbol(NT), filenr(0), linenr(0), offset(0), 
-         lexinfo(intern_stringset(lex)), children() {}
+ast::ast(const char* lex) : symbol(NT), loc(NO_SRCLOC),
+         lexinfo(intern_stringset(lex)), nested_scopes(0), children() {}
          
-ast::ast(int sym, const char* lex) : symbol(sym), filenr(0), linenr(0), 
-         offset(0), lexinfo(intern_stringset(lex)), children() {}
-
-ast::ast(int sym, size_t fnum, size_t lnum, size_t offset, const char* lex) :
-         symbol(sym), filenr(fnum), linenr(lnum), offset(offset),
-         lexinfo(intern_stringset(lex)), children() {}
-
-ast::~ast() {
-  delete lexinfo;
-  while(!children.empty()) {
-    delete children.back();
-    children.back() = NULL;
-    children.pop_back();
-  }
-}
+ast::ast(int sym, const char* lex) : symbol(sym), loc(NO_SRCLOC),
+         lexinfo(intern_stringset(lex)), nested_scopes(0), children() {}
+
+ast::ast(int sym, srcloc loc, stringid lex) : symbol(sym), loc(loc),
+         lexinfo(lex), nested_scopes(0), children() {}
+
+// the tree is released all at once by astarena_release
+ast::~ast() {}
 
 /**** add methods ****/
 ast* ast::add(ast* a) {
   children.push_back(a);
+  nested_scopes += a->scope_count();
   return this;
 }
 
 ast* ast::add(ast* a, ast* b) {
-  children.push_back(a);
-  children.push_back(b);
+  add(a);
+  add(b);
   return this;
 }
 
 ast* ast::add(ast* a, ast* b, ast* c) {
-  children.push_back(a);
-  children.push_back(b);
-  children.push_back(c);
+  add(a);
+  add(b);
+  add(c);
   return this;
 }
 
@@ -62,7 +60,7 @@ ast* ast::add(int n_args, ...) {
    va_list ap;
    va_start(ap, n_args);
    for (int j = 0; j < n_args; j++)
-      children.push_back(va_arg(ap, ast*));
+      add(va_arg(ap, ast*));
    va_end(ap);
    return this;
 }
@@ -70,23 +68,18 @@ ast* ast::add(int n_args, ...) {
 /**** get methods ****/
 // return lexinfo
 string ast::getLex() {
-  return string(*lexinfo);
+  return string(stringset_view(lexinfo));
 }
 
-// return position string "(filenr.linenr.offset)"
-string ast::getPos() {
-  char* data;
-  asprintf(&data, "(%s.%s.%s)", itos(filenr).c_str(), itos(linenr).c_str(), 
-           itos(offset).c_str());
-  return string(data);
+// return interned lexinfo, valid for the life of the compiler
+const char* ast::getLexstr() {
+  return stringset_cstr(lexinfo);
 }
 
-// return file position "filename:linenr:offset:"
-const char* ast::getfp() {
-  char* data;
-  asprintf(&data, "%s:%s:%s:", scanner_filename(filenr)->c_str(), 
-           itos(linenr).c_str(), itos(offset).c_str());
-  return string(data).c_str();
+// return file position "filename:linenr:offset:", decoded only when
+// a diagnostic asks for it
+string ast::getfp() {
+  return ::getfp(loc);
 }
 
 /**** print methods ****/
@@ -101,41 +94,40 @@ void ast::rec_dump(FILE* pipe, int depth) {
 
 void ast::dump_node(FILE* pipe) {
   if (symbol == NT || symbol == ROOT)
-    fprintf(pipe, "%s", lexinfo->c_str());
+    fprintf(pipe, "%s", getLexstr());
   else
-    fprintf(pipe, "%s (%s)", get_yytname (symbol), lexinfo->c_str());
-}
-
-void ast::dump_tok(FILE* pipe) {
-  fprintf(pipe, "%4lu %3lu.%.3lu  %3d  %-16s  (%s)\n", filenr, linenr,
-          offset, symbol, get_yytname(symbol), lexinfo->c_str());
+    fprintf(pipe, "%s (%s)", get_yytname (symbol), getLexstr());
 }
 
 // recusively descend tree to build symbol tables and typecheck
 void ast::rec_typecheck() {
-  std::vector<ast*>::iterator it;
+  ast_children::iterator it;
   for (it = children.begin(); it != children.end(); ++it) {
     (*it)->rec_typecheck();
   }
 }
 
-// inherit filenr, linenr and offset from node
+// inherit the source location of node
 void ast::absorb(ast* node) {
-  filenr = node->filenr;
-  linenr = node->linenr;
-  offset = node->offset;
+  loc = node->loc;
+}
+
+// children are complete before their parent is built, so the count is
+// kept up to date by add()
+int ast::scope_count() {
+  return nested_scopes;
 }
 
-void ast::dump_code(FILE* pipe) { 
-  DEBUGSTMT('c', fprintf(pipe, "/* DEBUG ~ ast dumpcode */\n"); ); 
+void ast::build_ir(ir_builder&) { 
+  DEBUGSTMT('c', eprintf("ast build_ir\n"); ); 
 
-  errprintf("ast::dump_code\n");
+  errprintf("ast::build_ir\n");
 }
 
-// recusively descend tree to generate intermediate code
-const char* ast::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* DEBUG ~ ast codegen */\n"); ); 
-  return "[TODO]";
+// recursively descend tree to build the ir of an expression
+ir_operand ast::rec_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("ast rec_ir\n"); ); 
+  return IR_NO_OPERAND;
 }
 
 /***********************  nonterminal superclasses  ***********************/
@@ -145,7 +137,7 @@ type_ast::type_ast(const char* lex) : ast(lex), oil_name(""), oil_type(""),
 
 
 int control_ast::COUNT = 0;
-control_ast::control_ast(const char* lex) : ast(lex), start("undef"), end("undef") {
+control_ast::control_ast(const char* lex) : ast(lex) {
   number = COUNT++;
 }
 
@@ -153,36 +145,286 @@ control_ast::control_ast(const char* lex) : ast(lex), start("undef"), end("undef
 /***********************  AST root  ***********************/
 root::root() : type_ast("program") { yyparse_ast = this; }
 
-void root::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* root */\n"); );
+// messages written by one thread, kept until they can be written out
+// in the order of the program
+struct output_buffer {
+  char* data;
+  size_t size;
+  FILE* file;
+
+  void open() {
+    data = NULL;
+    size = 0;
+    file = open_memstream(&data, &size);
+  }
+  size_t mark() {
+    fflush(file);
+    return size;
+  }
+  void close() {
+    fclose(file);
+  }
+};
+
+// the part of a buffer written for one statement or function body
+struct output_span {
+  const char* const* data;
+  size_t begin;
+  size_t end;
+
+  void write(FILE* out) {
+    fwrite(*data + begin, 1, end - begin, out);
+  }
+  void write(oil_buffer& out) {
+    out.put(*data + begin, end - begin);
+  }
+};
+
+// typechecks, builds or generates the code of body i, f, into out
+typedef void (*body_task)(size_t i, func* f, oil_buffer& out);
+
+// a thread working through function bodies, and what they wrote
+struct body_worker {
+  vector<func*>* funcs;
+  body_task task;
+  atomic<size_t>* next;
+  vector<output_span>* code;
+  vector<output_span>* messages;
+  oil_buffer code_buffer;
+  output_buffer message_buffer;
+  const char* code_data;
+};
+
+// run the task on the next body until none are left
+static void work_on_bodies(body_worker* worker) {
+  worker->message_buffer.open();
+  set_messagefile(worker->message_buffer.file);
+  vector<func*>& funcs = *worker->funcs;
+  for (size_t i = (*worker->next)++; i < funcs.size();
+       i = (*worker->next)++) {
+    size_t code = worker->code_buffer.size();
+    size_t messages = worker->message_buffer.mark();
+    worker->task(i, funcs[i], worker->code_buffer);
+    output_span code_span = {&worker->code_data, code,
+                             worker->code_buffer.size()};
+    output_span message_span = {&worker->message_buffer.data, messages,
+                                worker->message_buffer.mark()};
+    (*worker->code)[i] = code_span;
+    (*worker->messages)[i] = message_span;
+  }
+  set_messagefile(NULL);
+  worker->message_buffer.close();
+  // the code buffer no longer moves once the worker is done
+  worker->code_data = worker->code_buffer.data();
+}
+
+// Run task on every function body, each on whichever of the worker
+// threads is free.  What body i writes ends up in code[i] and
+// messages[i]; the buffers stay with the workers until they are freed.
+static void run_bodies(vector<func*>& funcs, body_task task,
+                       vector<body_worker>& workers,
+                       vector<output_span>& code,
+                       vector<output_span>& messages) {
+  size_t threads = worker_threads > 0 ? worker_threads
+                                      : thread::hardware_concurrency();
+  if (threads > funcs.size()) threads = funcs.size();
+  if (threads < 1) threads = 1;
+  atomic<size_t> next(0);
+  code.resize(funcs.size());
+  messages.resize(funcs.size());
+  workers.resize(threads);
+  for (size_t t = 0; t < threads; ++t) {
+    workers[t].funcs = &funcs;
+    workers[t].task = task;
+    workers[t].next = &next;
+    workers[t].code = &code;
+    workers[t].messages = &messages;
+  }
+  vector<thread> running;
+  for (size_t t = 1; t < threads; ++t) {
+    running.push_back(thread(work_on_bodies, &workers[t]));
+  }
+  work_on_bodies(&workers[0]);
+  for (size_t t = 0; t < running.size(); ++t) running[t].join();
+}
+
+static void free_workers(vector<body_worker>& workers) {
+  for (size_t t = 0; t < workers.size(); ++t) {
+    free(workers[t].message_buffer.data);
+  }
+}
+
+static void check_body(size_t, func* f, oil_buffer&) {
+  f->check_resumed();
+}
+
+// the blocks numbered once the globals and function headers are
+// checked, the bodies having theirs set aside
+static int blocks_numbered = 0;
+
+// Typechecks in two passes.  The global statements, structs and
+// function headers are checked first, in order.  The function bodies
+// depend only on what was declared before them, so they are then
+// checked on as many threads as there are cores.  Messages are held
+// back and printed in the order a single pass would print them.
+void root::rec_typecheck() {
+  output_buffer global_messages;
+  vector<output_span> global_spans;
+  vector<func*> bodies;
+  vector<int> body_of(children.size(), -1);
+  global_messages.open();
+  set_messagefile(global_messages.file);
+  for (size_t i = 0; i < children.size(); ++i) {
+    size_t begin = global_messages.mark();
+    func* f = dynamic_cast<func*>(children[i]);
+    if (f != NULL) {
+      f->declare();
+      body_of[i] = bodies.size();
+      bodies.push_back(f);
+    }else {
+      children[i]->rec_typecheck();
+    }
+    output_span span = {&global_messages.data, begin,
+                        global_messages.mark()};
+    global_spans.push_back(span);
+  }
+  set_messagefile(NULL);
+  global_messages.close();
+  blocks_numbered = SymbolTable::N;
+
+  vector<body_worker> workers;
+  vector<output_span> code, messages;
+  run_bodies(bodies, check_body, workers, code, messages);
+
+  FILE* out = get_messagefile();
+  for (size_t i = 0; i < children.size(); ++i) {
+    global_spans[i].write(out);
+    if (body_of[i] >= 0) messages[body_of[i]].write(out);
+  }
+  fflush(out);
+  free(global_messages.data);
+  free_workers(workers);
+}
+
+// the ir of each function, by its place in global_funcs
+static vector<ir_function> function_ir;
+
+// build the ir of a function and run the passes needing only it
+static void build_body(size_t i, func* f, oil_buffer&) {
+  if (!f->hasBody()) return; // do not emit function prototypes
+  f->build_function(function_ir[i]);
+  irpass_run_local(function_ir[i]);
+}
 
+// which functions __ocmain may call, and the order they are written in
+static vector<char> reached;
+static vector<uint32_t> written;
+
+// run the rest of the passes on a function that may be called
+static void optimize_body(size_t i, func*, oil_buffer&) {
+  if (reached[i]) irpass_run(function_ir[i]);
+}
+
+// lower the function written i-th to oil
+static void generate_body(size_t i, func*, oil_buffer& out) {
+  oilgen_function(out, function_ir[written[i]]);
+}
+
+// write what each body wrote to the message file in order
+static void write_messages(vector<output_span>& messages) {
+  FILE* messagefile = get_messagefile();
+  for (size_t i = 0; i < messages.size(); ++i) {
+    messages[i].write(messagefile);
+  }
+}
 
-  fprintf(pipe, "#define __OCLIB_C__\n#include \"oclib.oh\"\n\n");
+// Functions are built on the worker threads, __ocmain on this one.
+// Once all are built, what every pass may assume of the globals is
+// worked out and calls are inlined here, then the functions __ocmain
+// still calls are optimized on the workers.  Those it calls after
+// that are generated on the workers too and spliced back callees
+// first, with prototypes for any called earlier.
+void root::dump_code(oil_buffer& out) {
+  DEBUGSTMT('c', eprintf("root\n"); );
+
+
+  out.put("#define __OCLIB_C__\n#include \"oclib.oh\"\n\n");
   // dump structs into global scope
   std::vector<structdef*>::iterator it;
   for (it = global_structdefs.begin(); it != global_structdefs.end(); ++it) {
-    (*it)->dump_globalcode(pipe);
+    (*it)->dump_globalcode(out);
   }
   // dump global variables into global scope
   std::vector<vardecl*>::iterator it1;
   for (it1 = global_vardecls.begin(); it1 != global_vardecls.end(); ++it1) {
-    (*it1)->dump_globalcode(pipe);
+    (*it1)->dump_globalcode(out);
   }
-  // dump function definitions
-  std::vector<func*>::iterator it2;
-  for (it2 = global_funcs.begin(); it2 != global_funcs.end(); ++it2) {
-    (*it2)->dump_globalcode(pipe);
-  }
-  
-  // dump everything else into __ocmain
-  emit(pipe, "\nvoid __ocmain ()\n{\n");
-  setIndent(true);
-  std::vector<ast*>::iterator it3;
+  loadOilTypes();
+  function_ir.clear();
+  function_ir.resize(global_funcs.size());
+  vector<body_worker> workers;
+  vector<output_span> code, messages;
+  run_bodies(global_funcs, build_body, workers, code, messages);
+  write_messages(messages);
+  free_workers(workers);
+
+  // everything else goes into __ocmain
+  ir_function ocmain;
+  ocmain.name = intern_stringset("__ocmain");
+  ocmain.result = TYPE_VOID;
+  ocmain.main = true;
+  ir_builder ir(ocmain);
+  ast_children::iterator it3;
   for (it3 = children.begin(); it3 != children.end(); ++it3) {
-    (*it3)->dump_code(pipe);
+    (*it3)->build_ir(ir);
+  }
+  ir.finish();
+  irpass_run_local(ocmain);
+
+  ir_program program;
+  ir_analyze_program(program, function_ir, ocmain);
+
+  // calls are inlined, callees first, and only the functions
+  // __ocmain can still reach are optimized
+  ir_call_graph graph;
+  ir_build_call_graph(graph, function_ir, ocmain);
+  ir_inline_calls(function_ir, ocmain, graph, blocks_numbered);
+  ir_build_call_graph(graph, function_ir, ocmain);
+  reached.assign(function_ir.size(), 0);
+  for (size_t i = 0; i < graph.order.size(); ++i) reached[graph.order[i]] = 1;
+  vector<body_worker> optimizers;
+  run_bodies(global_funcs, optimize_body, optimizers, code, messages);
+  write_messages(messages);
+  free_workers(optimizers);
+  irpass_run(ocmain);
+
+  // and only those it still reaches are written, each after the
+  // functions it calls
+  ir_build_call_graph(graph, function_ir, ocmain);
+  if (is_debugflag('o')) {
+    size_t defined = 0;
+    for (size_t i = 0; i < function_ir.size(); ++i) {
+      if (!function_ir[i].blocks.empty()) ++defined;
+    }
+    eprintf("callgraph: %zu of %zu functions written\n", graph.order.size(),
+            defined);
+  }
+  for (size_t i = 0; i < graph.forward.size(); ++i) {
+    oilgen_prototype(out, function_ir[graph.forward[i]]);
   }
-  fprintf(pipe, "}\n");
-  setIndent(false);
+  written = graph.order;
+  vector<func*> bodies;
+  for (size_t i = 0; i < written.size(); ++i) {
+    bodies.push_back(global_funcs[written[i]]);
+  }
+  vector<body_worker> generators;
+  run_bodies(bodies, generate_body, generators, code, messages);
+  for (size_t i = 0; i < bodies.size(); ++i) {
+    code[i].write(out);
+  }
+  free_workers(generators);
+  oilgen_function(out, ocmain);
+  function_ir.clear();
 }
 
 
@@ -199,45 +441,44 @@ void vardecl::rec_typecheck() {
     global_vardecls.push_back(this); // add this ptr to global variables
 
   block_ptr = current_scope;
-  string vartype = getType();
-  string valtype = static_cast<expr*>(children[3])->getType();
+  typeref vartype = getType();
+  typeref valtype = static_cast<expr*>(children[3])->getType();
   DEBUGSTMT('z', eprintf("vardecl\n"); );
-  if (getType().compare("void") == 0)
+  if (vartype == TYPE_VOID)
     errprintf("%s error: variables of type void are not allowed.\n", 
-              getfp());
+              getfp().c_str());
   else if (!typecheck(vartype, valtype)) {
-    errprintf("%s error: declared type (%s)", getfp(), vartype.c_str());
-    errprintf(" is incompatible with assigned type (%s).\n", valtype.c_str());
+    errprintf("%s error: declared type (%s)", getfp().c_str(),
+              type_name(vartype).c_str());
+    errprintf(" is incompatible with assigned type (%s).\n",
+              type_name(valtype).c_str());
   }
-  current_scope->addSymbol(getIdent(), getType(), getPos());
+  current_scope->addSymbol(children[1]->lexinfo, getType(), loc);
 }
 
-void vardecl::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* vardecl */\n"); ); 
+void vardecl::build_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("vardecl\n"); ); 
   
-  size_t blocknr = block_ptr->getNumber();
-  type_ast *val = static_cast<type_ast*>(children[3]);
-  if (blocknr != 0) { // emit "local scope" code
-    oil_type = getOilType(getType());
-    oil_name = mangle(blocknr, getIdent());
-    emit(pipe, "%s %s = %s;\n", oil_type, oil_name, val->rec_codegen(pipe));
-  }else { // variable declared globally, just assign the value
-    emit(pipe, "%s = %s;\n", oil_name.c_str(), val->rec_codegen(pipe));
-  }
+  int blocknr = block_ptr->getNumber();
+  ir_operand val = children[3]->rec_ir(ir);
+  string name = mangle(blocknr, children[1]->getLexstr());
+  ir_operand var = ir.var(intern_stringset(name.data(), name.size()),
+                          getType(), blocknr == 0 ? IR_GLOBAL : IR_LOCAL);
+  // locals are declared where they are assigned, globals up front
+  ir.move(var, val, blocknr != 0);
 }
 
-void vardecl::dump_globalcode(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* ast::dump_globalcode */\n"); ); 
+void vardecl::dump_globalcode(oil_buffer& out) {
+  DEBUGSTMT('c', eprintf("vardecl::dump_globalcode\n"); ); 
   
-  oil_type = getOilType(getType());
-  oil_name = mangle(0, getIdent());
-  emit(pipe, "%s %s;\n", oil_type.c_str(), oil_name.c_str());
+  emit(out, "%s %s;\n", getOilType(getType()),
+       mangle(0, children[1]->getLexstr()));
 }
 
-string vardecl::getType() {
+typeref vardecl::getType() {
   if (!children.empty())
     return static_cast<type*>(children[0])->getType();
-  else return string("undef");
+  else return TYPE_UNDEF;
 }
 
 string vardecl::getIdent() { return children[1]->getLex(); }
@@ -255,10 +496,10 @@ type::type(ast* btype, ast* array) : type_ast("type") {
   absorb(btype);
 }
 
-string type::getType() {
-  string temp = static_cast<basetype*>(children[0])->getType();
+typeref type::getType() {
+  typeref temp = static_cast<basetype*>(children[0])->getType();
   if (children.size() == 2) 
-    temp.append("[]");
+    temp = type_array(temp);
   return temp;
 }
 
@@ -267,9 +508,9 @@ void type::rec_typecheck() {
   block_ptr = current_scope;
   DEBUGSTMT('z', eprintf("type\n"); );
   
-  if (getType().compare("void[]") == 0)
-    errprintf("%s error: undefined type (%s).\n", getfp(), 
-              getType().c_str());
+  if (getType() == type_array(TYPE_VOID))
+    errprintf("%s error: undefined type (%s).\n", getfp().c_str(), 
+              type_name(getType()).c_str());
 }
 
 
@@ -280,8 +521,8 @@ basetype::basetype(ast* id) : type_ast("basetype") {
   absorb(id);
 }
 
-string basetype::getType() {
-  return children[0]->getLex();
+typeref basetype::getType() {
+  return type_named(children[0]->lexinfo);
 }
 
 void basetype::rec_typecheck() {
@@ -290,9 +531,9 @@ void basetype::rec_typecheck() {
   DEBUGSTMT('z', eprintf("basetype\n"); );
 
   ast* token = children[0];
-  if (token->symbol==IDENT && !current_scope->lookup_usertype(token->getLex())) {
+  if (token->symbol == IDENT && struct_lookup(getType()) == NO_STRUCT) {
     errprintf("%s error: undefined usertype \"%s\".\n",
-              token->getfp(), token->getLex().c_str());
+              token->getfp().c_str(), token->getLex().c_str());
   }
 }
 
@@ -304,7 +545,7 @@ decl::decl(ast* type, ast* id) : type_ast("decl") {
   absorb(id);
 }
 
-string decl::getType() {
+typeref decl::getType() {
   return static_cast<type*>(children[0])->getType();
 }
 
@@ -323,33 +564,30 @@ void structdef::rec_typecheck() {
   DEBUGSTMT('z', eprintf("structdef\n"); );
   
   global_structdefs.push_back(this);
-  string name = getIdent();
   ast* f = children[1]; // field node ptr
-  if (!global_scope.lookup_usertype(name)) {
-    vector<pair<string,string>>* fields = new vector<pair<string,string>>();
-    std::vector<ast*>::iterator it; // field iterator
-    for (it = f->children.begin(); it != f->children.end(); ++it) {
-      fields->push_back(pair<string,string>(static_cast<decl*>(*it)->getIdent(),
-                        static_cast<decl*>(*it)->getType()));
-    }
-    global_scope.define_usertype(name, fields);
-
-  }else 
+  vector<stringid> names;
+  vector<typeref> types;
+  ast_children::iterator it; // field iterator
+  for (it = f->children.begin(); it != f->children.end(); ++it) {
+    names.push_back((*it)->children[1]->lexinfo);
+    types.push_back(static_cast<decl*>(*it)->getType());
+  }
+  if (struct_define(type_named(children[0]->lexinfo), names, types)
+      == NO_STRUCT)
     errprintf("%s error: duplicate struct definition \"%s\".", 
-              getfp(), getIdent().c_str());
+              getfp().c_str(), getIdent().c_str());
 }
 
-void structdef::dump_code(FILE* pipe) {
-    DEBUGSTMT('c', fprintf(pipe, "/* structdef */\n"); );
+void structdef::build_ir(ir_builder&) {
+    DEBUGSTMT('c', eprintf("structdef\n"); );
 }
 
-void structdef::dump_globalcode(FILE* pipe) {
-  oil_name = children[0]->getLex();
-  emit(pipe, "struct %s {\n", oil_name);
-  setIndent(true);
-  children[1]->dump_code(pipe);
-  setIndent(false);
-  fprintf(pipe, "};\n\n");
+void structdef::dump_globalcode(oil_buffer& out) {
+  emit(out, "struct %s {\n", children[0]->getLexstr());
+  out.set_indent(true);
+  static_cast<field*>(children[1])->dump_globalcode(out);
+  out.set_indent(false);
+  out.put("};\n\n");
 }
 
 string structdef::getIdent() { return children[0]->getLex(); }
@@ -359,12 +597,12 @@ string structdef::getIdent() { return children[0]->getLex(); }
 /***********************  field  ***********************/
 field::field() : type_ast("field") {}
 
-void field::dump_code(FILE* pipe) {
-  std::vector<ast*>::iterator it;
+void field::dump_globalcode(oil_buffer& out) {
+  ast_children::iterator it;
   for (it = children.begin(); it < children.end(); ++it) {
     type* t = static_cast<type*>((*it)->children[0]);
     ast* id = (*it)->children[1];
-    emit(pipe, "%s %s;\n", getOilType(t->getType()), id->getLex());
+    emit(out, "%s %s;\n", getOilType(t->getType()), id->getLexstr());
   }
 }
 
@@ -383,18 +621,18 @@ void block::rec_typecheck() {
   }
 }
 
-void block::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* block */\n"); );
+void block::build_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("block\n"); );
     
-  std::vector<ast*>::iterator it;
+  ast_children::iterator it;
   for (it = children.begin(); it != children.end(); ++it) {
-    (*it)->dump_code(pipe);
+    (*it)->build_ir(ir);
   }
 }
 
-const char* block::rec_codegen(FILE* pipe) {
-  dump_code(pipe);
-  return "[block: error: use dump_code]";
+// a block makes a symbol table only if it has statements
+int block::scope_count() {
+  return nested_scopes + (children.size() > 0 ? 1 : 0);
 }
 
 SymbolTable* block::getBlk () { return block_ptr; }
@@ -402,7 +640,7 @@ SymbolTable* block::getBlk () { return block_ptr; }
 
 
 /***********************  function declaration  ***********************/
-func* func_ptr = NULL;
+thread_local func* func_ptr = NULL;
 
 func::func(ast* type, ast* id, ast* p, ast* blk) : type_ast("function"), block_ptr(NULL) {
   add(4, type, id, p, blk);
@@ -410,18 +648,43 @@ func::func(ast* type, ast* id, ast* p, ast* blk) : type_ast("function"), block_p
 }
 
 void func::rec_typecheck() {
-  global_funcs.push_back(this);
+  check_header();
+  // set current_scope to this function's block
+  current_scope = current_scope->enterFunction(children[1]->lexinfo, getSig(),
+                                               loc);
+  check_body();
+}
+
+// check the function and declare it, leaving its body for later
+void func::declare() {
+  check_header();
+  block_ptr = current_scope->declareFunction(children[1]->lexinfo, getSig(),
+                                             loc, nested_scopes);
+}
+
+// check the body of a function made by declare() on this thread
+void func::check_resumed() {
+  current_scope = block_ptr->resume();
+  check_body();
+}
+
+void func::check_header() {
+  if (current_scope == &global_scope)
+    global_funcs.push_back(this);
   children[0]->rec_typecheck();
   // check function defined in global scope
   if (current_scope != &global_scope)
-    errprintf("%s error: functions must be defined in global scope.\n",getfp());
+    errprintf("%s error: functions must be defined in global scope.\n",
+              getfp().c_str());
   // check if function name is previously defined
-  if (global_scope.lookup(getIdent()).compare("undef") != 0) {
+  if (global_scope.lookup(children[1]->lexinfo) != TYPE_UNDEF) {
     errprintf("%s warning: duplicate function definition \"%s\".\n", 
-              getfp(), getIdent().c_str());
+              getfp().c_str(), getIdent().c_str());
   }
-  // set current_scope to this function's block
-  current_scope = current_scope->enterFunction(getIdent(), getSig(), getPos());
+}
+
+// check the parameters and block of the function, once it is entered
+void func::check_body() {
   block_ptr = current_scope;
   func_ptr = this; // function pointer enables return statement typechecking
   children[2]->rec_typecheck(); // enter parameter list into the new block
@@ -430,54 +693,51 @@ void func::rec_typecheck() {
   func_ptr = NULL; // leaving function def, set function ptr to NULL
 }
 
-void func::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* func */\n"); );
+void func::build_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("func\n"); );
+}
+
+// functions without a body are prototypes and have no code
+bool func::hasBody() {
+  return children[3]->children.size() != 0;
 }
 
-// all functions should be defined globally
-void func::dump_globalcode(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* func */\n"); );
+// all functions are defined globally, each is built into its own fn
+void func::build_function(ir_function& fn) {
+  DEBUGSTMT('c', eprintf("func\n"); );
 
-  // do not emit function prototypes
-  if(children[3]->children.size() == 0)
-    return;
-    
-  oil_type = getOilType(getType());
-  oil_name = mangle(0, getIdent());
-  emit(pipe, "%s\n%s(\n", oil_type, oil_name);
-  setIndent(true);
+  string name = mangle(0, children[1]->getLexstr());
+  fn.name = intern_stringset(name.data(), name.size());
+  fn.result = getType();
+  fn.sym = global_scope.resolve(children[1]->lexinfo);
+  ir_builder ir(fn);
   ast* params = children[2];
-  std::vector<ast*>::iterator it;
+  ast_children::iterator it;
   for (it = params->children.begin(); it != params->children.end(); ++it) {
     type* t = static_cast<type*>((*it)->children[0]);
-    string idname = (*it)->children[1]->getLex();
-    
-    string argtype = getOilType(t->getType());
-    string argid = mangle(block_ptr->getNumber(), idname);
-    emit(pipe, "%s %s", argtype, argid); 
-    if (it + 1 != params->children.end())
-      fprintf(pipe, ",\n");
+    string param = mangle(block_ptr->getNumber(),
+                          (*it)->children[1]->getLexstr());
+    ir_operand var = ir.var(intern_stringset(param.data(), param.size()),
+                            t->getType(), IR_PARAM);
+    fn.params.push_back(var.id);
   }
-  fprintf(pipe, ")\n{\n");
-  children[3]->dump_code(pipe); // dump the block
-  fprintf(pipe, "}\n\n");
-  setIndent(false);
+  children[3]->build_ir(ir); // build the block
+  ir.finish();
 }
 
-string func::getType() {
+typeref func::getType() {
   return static_cast<type*>(children[0])->getType();
 }
 
-string func::getSig() {
-  string temp = static_cast<type*>(children[0])->getType();
-  temp.append("(");
-  temp.append(static_cast<params*>(children[2])->getSig());
-  temp.append(")");
-  return temp;
+typeref func::getSig() {
+  return type_function(getType(),
+                       static_cast<params*>(children[2])->getSig());
 }
 
 string func::getIdent() { return children[1]->getLex(); }
 
+int func::scope_count() { return nested_scopes + 1; }
+
 SymbolTable* func::getBlk () { return block_ptr; }
 
 
@@ -492,30 +752,31 @@ void funcreturn::rec_typecheck() {
   if (children.size() > 0) { // non-void return
     if (func_ptr == NULL) { // global return
       errprintf("%s error: global non-void return is not allowed.\n",
-                 getfp());
+                 getfp().c_str());
     }else {
       expr* e = static_cast<expr*>(children[0]);
-      string func_type = func_ptr->getType();
-      if (func_type.compare(e->getType()) != 0)
+      typeref func_type = func_ptr->getType();
+      if (func_type != e->getType())
         errprintf("%s error: return type (%s) must match function type (%s).\n",
-                  getfp(), e->getType().c_str(), func_type.c_str());
+                  getfp().c_str(), type_name(e->getType()).c_str(),
+                  type_name(func_type).c_str());
     }
   }else { // void return
     if (func_ptr != NULL) { // global return
-      string func_type = func_ptr->getType();
-      if (func_type.compare("void") != 0)
+      typeref func_type = func_ptr->getType();
+      if (func_type != TYPE_VOID)
         errprintf("%s error: void return in non-void function block (%s).\n",
-                  getfp(), func_type.c_str());
+                  getfp().c_str(), type_name(func_type).c_str());
     } 
     // else void global return
   }
 }
 
-void funcreturn::dump_code(FILE* pipe) {
+void funcreturn::build_ir(ir_builder& ir) {
   if (children.size() == 0) {
-    emit(pipe, "return;\n");
+    ir.ret(IR_NO_OPERAND);
   }else {
-    emit(pipe, "return %s;\n", children[0]->rec_codegen(pipe));
+    ir.ret(children[0]->rec_ir(ir));
   }
 }
 
@@ -530,23 +791,22 @@ void loop::rec_typecheck() {
   DEBUGSTMT('z', eprintf("loop\n"); );
   
   expr* e = static_cast<expr*>(children[0]);
-  if (!e->getType().compare("bool") == 0) {
+  if (e->getType() != TYPE_BOOL) {
     errprintf("%s error: loop expression must evaluate to type bool (%s).\n", 
-              e->getfp(), e->getType().c_str());
+              e->getfp().c_str(), type_name(e->getType()).c_str());
   }
 }
 
-void loop::dump_code(FILE* pipe) {
-  start = cmangle("while");
-  end = cmangle("break");
-  fprintf(pipe, "%s:;\n", start.c_str());
+void loop::build_ir(ir_builder& ir) {
+  uint32_t start = ir.label("while");
+  uint32_t end = ir.label("break");
+  ir.place(start);
   expr* e = static_cast<expr*>(children[0]);
   ast* stmt = children[1];
-  string ename = e->rec_codegen(pipe);
-  emit(pipe, "if (!%s) goto %s;\n", ename, end); 
-  stmt->dump_code(pipe);
-  emit(pipe, "goto %s;\n", start);
-  fprintf(pipe, "%s:;\n", end.c_str());
+  ir.branch_unless(e->rec_ir(ir), end);
+  stmt->build_ir(ir);
+  ir.jump(start);
+  ir.place(end);
 }
 
 
@@ -554,11 +814,10 @@ void loop::dump_code(FILE* pipe) {
 /***********************  parameter list  ***********************/
 params::params() : type_ast("params") {}
 
-string params::getSig() {
-  string temp;
+vector<typeref> params::getSig() {
+  vector<typeref> temp;
   for (size_t i = 0; i < children.size(); i++) {
-    if (i > 0) temp.append(",");
-      temp.append(static_cast<decl*>(children[i])->getType());
+    temp.push_back(static_cast<decl*>(children[i])->getType());
   }
   return temp;
 }
@@ -568,10 +827,10 @@ void params::rec_typecheck() {
   DEBUGSTMT('z', eprintf("params\n"); );
 
   for (size_t i = 0; i < children.size(); i++) {
-    string type_str = static_cast<decl*>(children[i])->getType();
-    string ident_str = static_cast<decl*>(children[i])->getIdent();
-    string pos_str = static_cast<decl*>(children[i])->getPos();
-    current_scope->addSymbol(ident_str, type_str, pos_str);
+    typeref type_str = static_cast<decl*>(children[i])->getType();
+    stringid ident = children[i]->children[1]->lexinfo;
+    srcloc pos = static_cast<decl*>(children[i])->loc;
+    current_scope->addSymbol(ident, type_str, pos);
   }
 }
 
@@ -596,50 +855,51 @@ void ifelse::rec_typecheck() {
   DEBUGSTMT('z', eprintf("ifelse\n"); );
 
   expr* e = static_cast<expr*>(children[0]);
-  if (!e->getType().compare("bool") == 0) {
+  if (e->getType() != TYPE_BOOL) {
     errprintf("%s error: branch expression evaluate to type bool (%s).\n", 
-              e->getfp(), e->getType().c_str());
+              e->getfp().c_str(), type_name(e->getType()).c_str());
   }
 }
 
-void ifelse::dump_code(FILE* pipe) {
+void ifelse::build_ir(ir_builder& ir) {
   DEBUGSTMT('c', eprintf("ifelse\n"); );
 
-  string end = cmangle("fi");
+  uint32_t end = ir.label("fi");
   expr* e = static_cast<expr*>(children[0]);
-  string ename = e->rec_codegen(pipe);
+  ir_operand cond = e->rec_ir(ir);
   
   ast* stmt1 = children[1];
   if (children.size() == 2) { // no else
-    emit(pipe, "if (!%s) goto %s;\n", ename, end);
-    stmt1->dump_code(pipe);
+    ir.branch_unless(cond, end);
+    stmt1->build_ir(ir);
   }else { // is else
-    string elselabel = cmangle("else");
+    uint32_t elselabel = ir.label("else");
     ast* stmt2 = children[2];
-    emit(pipe, "if (!%s) goto %s;\n", ename, elselabel);
-    stmt1->dump_code(pipe);
-    emit(pipe, "goto %s;\n", end);
-    fprintf(pipe, "%s:;\n", elselabel.c_str());
-    stmt2->dump_code(pipe);
+    ir.branch_unless(cond, elselabel);
+    stmt1->build_ir(ir);
+    ir.jump(end);
+    ir.place(elselabel);
+    stmt2->build_ir(ir);
   }
-  fprintf(pipe, "%s:;\n", end.c_str());
+  ir.place(end);
 }
 
 
 
 /***********************  expression types  ***********************/
 // expressions have special type properties i.e. "associated types"
-expr::expr(const char* lex) : type_ast(lex), assoc_type("undef") {}
+expr::expr(const char* lex) : type_ast(lex), assoc_type(TYPE_UNDEF) {}
 
-string expr::getType() { return assoc_type; }
+typeref expr::getType() { return assoc_type; }
 
 void expr::dump_node(FILE* pipe) {
   if (symbol == NT || symbol == ROOT) {
-    fprintf(pipe, "%s", lexinfo->c_str());
-    DEBUGX('z', fprintf (pipe, " - assoctype=%s", assoc_type.c_str()); );
+    fprintf(pipe, "%s", getLexstr());
+    DEBUGX('z', fprintf (pipe, " - assoctype=%s",
+                         type_name(assoc_type).c_str()); );
   }
   else
-    fprintf(pipe, "%s (%s)", get_yytname (symbol), lexinfo->c_str());
+    fprintf(pipe, "%s (%s)", get_yytname (symbol), getLexstr());
 }
 
 
@@ -657,52 +917,52 @@ void binop::rec_typecheck() {
   DEBUGSTMT('z', eprintf("binop\n"); );
 
   bool binop_error = false;
-  string l = static_cast<expr*>(children[0])->getType(); // left expr
-  string r = static_cast<expr*>(children[2])->getType(); // right expr
+  typeref l = static_cast<expr*>(children[0])->getType(); // left expr
+  typeref r = static_cast<expr*>(children[2])->getType(); // right expr
   ast* op = children[1];
 
   /* need to check array types */
   switch (op->symbol) {
-    case '+': assoc_type = "int"; 
-              binop_error = !expectedcheck(l, r, "int");
+    case '+': assoc_type = TYPE_INT; 
+              binop_error = !expectedcheck(l, r, TYPE_INT);
       break;
-    case '-': assoc_type = "int"; 
-              binop_error = !expectedcheck(l, r, "int");
+    case '-': assoc_type = TYPE_INT; 
+              binop_error = !expectedcheck(l, r, TYPE_INT);
       break;
-    case '*': assoc_type = "int"; 
-              binop_error = !expectedcheck(l, r, "int");
+    case '*': assoc_type = TYPE_INT; 
+              binop_error = !expectedcheck(l, r, TYPE_INT);
       break;
-    case '/': assoc_type = "int"; 
-              binop_error = !expectedcheck(l, r, "int");
+    case '/': assoc_type = TYPE_INT; 
+              binop_error = !expectedcheck(l, r, TYPE_INT);
       break;
-    case '%': assoc_type = "int"; 
-              binop_error = !expectedcheck(l, r, "int");
+    case '%': assoc_type = TYPE_INT; 
+              binop_error = !expectedcheck(l, r, TYPE_INT);
       break;
     case '=': assoc_type = l; 
-              if (!typecheck(l,r) || l.compare("null") == 0)
+              if (!typecheck(l,r) || l == TYPE_NULL)
                 binop_error = true;
       break;
-    case EQ: assoc_type = "bool"; 
+    case EQ: assoc_type = TYPE_BOOL; 
              if (!typecheck(l, r))
                binop_error = true;
       break; 
-    case NE: assoc_type = "bool"; 
+    case NE: assoc_type = TYPE_BOOL; 
              if (!typecheck(l,r))
                binop_error = true;
       break;
-    case LT: assoc_type = "bool"; 
+    case LT: assoc_type = TYPE_BOOL; 
              if (!typecheck(l,r) || !isPrimitive(l) || !isPrimitive(r))
                binop_error = true;
       break;
-    case LE: assoc_type = "bool"; 
+    case LE: assoc_type = TYPE_BOOL; 
              if (!typecheck(l,r) || !isPrimitive(l) || !isPrimitive(r))
                binop_error = true;
       break;
-    case GT: assoc_type = "bool"; 
+    case GT: assoc_type = TYPE_BOOL; 
              if (!typecheck(l,r) || !isPrimitive(l) || !isPrimitive(r))
                binop_error = true;
       break;
-    case GE: assoc_type = "bool"; 
+    case GE: assoc_type = TYPE_BOOL; 
              if (!typecheck(l,r) || !isPrimitive(l) || !isPrimitive(r))
                binop_error = true;
       break;
@@ -710,34 +970,41 @@ void binop::rec_typecheck() {
 
   if (binop_error)
     errprintf("%s error: binary operator undefined for types \"%s %s %s\".\n",
-              getfp(), l.c_str(), op->getLex().c_str(), r.c_str());
+              getfp().c_str(), type_name(l).c_str(), op->getLexstr(),
+              type_name(r).c_str());
 }
 
-void binop::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* binop */\n"); ); 
+// operands are built right to left, as the oil has always had them
+void binop::build_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("binop\n"); ); 
 
-  expr* e1 = static_cast<expr*>(children[0]);
-  expr* e2 = static_cast<expr*>(children[2]);
-  ast* op = children[1];
-
-  emit(pipe, "%s %s %s;\n", e1->rec_codegen(pipe), op->getLex(),
-       e2->rec_codegen(pipe));
+  ir_operand e2 = children[2]->rec_ir(ir);
+  ir_operand e1 = children[0]->rec_ir(ir);
+  int op = children[1]->symbol;
+  ir.loc = loc;
+  if (op == '=')
+    ir.move(e1, e2);
+  else
+    ir.binary(IR_NO_OPERAND, op, e1, e2);
 }
 
 
-const char* binop::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* binop */\n"); );
+ir_operand binop::rec_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("binop\n"); );
   
   // assume temp variable must be declared
-  oil_type = getOilType(assoc_type);
-  expr* e1 = static_cast<expr*>(children[0]);
-  expr* e2 = static_cast<expr*>(children[2]);
-  ast* op = children[1];
-  oil_name = getTypechar(oil_type);
-  emit(pipe, "%s %s = %s %s %s;\n", oil_type, oil_name, e1->rec_codegen(pipe), 
-       op->getLex(), e2->rec_codegen(pipe));
-
-  return oil_name.c_str();
+  ir_operand temp = ir.temp(assoc_type);
+  ir_operand e2 = children[2]->rec_ir(ir);
+  ir_operand e1 = children[0]->rec_ir(ir);
+  int op = children[1]->symbol;
+  ir.loc = loc;
+  if (op == '=') { // the value of an assignment is what was assigned
+    ir.move(e1, e2);
+    ir.move(temp, ir.fn.clone(e1));
+  }else {
+    ir.binary(temp, op, e1, e2);
+  }
+  return temp;
 }
 
 
@@ -756,67 +1023,49 @@ void unop::rec_typecheck() {
 
   int op = children[0]->symbol;
   expr* e = static_cast<expr*>(children[1]);
-  string etype = e->getType();
+  typeref etype = e->getType();
+  const char* ename = type_name(etype).c_str();
   switch(op) {
-    case '!': if (!stringcmp(etype, "bool"))
+    case '!': if (etype != TYPE_BOOL)
                 errprintf("%s error: operator ! is undefined for type (%s).\n",
-                          getfp(), etype.c_str());
-              assoc_type = "bool"; 
+                          getfp().c_str(), ename);
+              assoc_type = TYPE_BOOL; 
       break;
-    case '+': if (!stringcmp(etype, "int"))
+    case '+': if (etype != TYPE_INT)
                 errprintf("%s error: unary operator + is undefined for type %s.\n",
-                          getfp(), etype.c_str());
-              assoc_type = "int"; 
+                          getfp().c_str(), ename);
+              assoc_type = TYPE_INT; 
       break;
-    case '-': if (!stringcmp(etype, "int"))
+    case '-': if (etype != TYPE_INT)
                 errprintf("%s error: unary operator - is undefined for type %s.\n",
-                          getfp(), etype.c_str());
-              assoc_type = "int"; 
+                          getfp().c_str(), ename);
+              assoc_type = TYPE_INT; 
       break;
-    case ORD: if (!stringcmp(etype, "char"))
+    case ORD: if (etype != TYPE_CHAR)
                 errprintf("%s error: operator ord is undefined for type %s.\n",
-                          getfp(), etype.c_str());
-              assoc_type = "int";
+                          getfp().c_str(), ename);
+              assoc_type = TYPE_INT;
       break;
-    case CHR: if (!stringcmp(etype, "int"))
+    case CHR: if (etype != TYPE_INT)
                 errprintf("%s error: operator chr is undefined for type %s.\n",
-                          getfp(), etype.c_str());
-              assoc_type = "char";
+                          getfp().c_str(), ename);
+              assoc_type = TYPE_CHAR;
       break;
   }
 }
 
-void unop::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* unop */\n"); ); 
+void unop::build_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("unop\n"); ); 
 
-  eprintf("%s warning: statement has no effect.\n", getfp());
+  eprintf("%s warning: statement has no effect.\n", getfp().c_str());
 }
 
-const char* unop::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* unop */\n"); ); 
+ir_operand unop::rec_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("unop\n"); ); 
   
-  oil_type = getOilType(assoc_type);
-  oil_name = getTypechar(oil_type);
-  int op = children[0]->symbol;
-  expr* e = static_cast<expr*>(children[1]);
-  switch(op) {
-    case '!': emit(pipe, "%s %s = !%s;\n", oil_type, oil_name,
-                  e->rec_codegen(pipe));
-      break;
-    case '+': emit(pipe, "%s %s = +%s;\n", oil_type, oil_name,
-                  e->rec_codegen(pipe));
-      break;
-    case '-': emit(pipe, "%s %s = -%s;\n", oil_type, oil_name,
-                  e->rec_codegen(pipe));
-      break;
-    case ORD: emit(pipe, "%s %s = (int) %s;\n", oil_type, oil_name, 
-                   e->rec_codegen(pipe));
-      break;
-    case CHR: emit(pipe, "%s %s = (int) %s;\n", oil_type, oil_name,
-                   e->rec_codegen(pipe));
-      break;
-  }  
-  return oil_name.c_str();
+  ir_operand temp = ir.temp(assoc_type);
+  ir.unary(temp, children[0]->symbol, children[1]->rec_ir(ir));
+  return temp;
 }
 
 
@@ -847,13 +1096,13 @@ void alloc::rec_typecheck() {
       assoc_type = e->getType();
     }else if (op == '[') { // NEW basetype[expr]
       if (!isBasetype(base->getType()))
-        errprintf("%s error: invalid allocation type (%s).\n", getfp(),
-                  base->getType().c_str());
-      assoc_type = base->getType();
-      assoc_type.append("[]");
-      if (e->getType().compare("int") != 0) {
-        errprintf("%s error: array size specifier ", getfp());
-        errprintf("(%s) must be of type int.\n", e->getType().c_str());
+        errprintf("%s error: invalid allocation type (%s).\n", getfp().c_str(),
+                  type_name(base->getType()).c_str());
+      assoc_type = type_array(base->getType());
+      if (e->getType() != TYPE_INT) {
+        errprintf("%s error: array size specifier ", getfp().c_str());
+        errprintf("(%s) must be of type int.\n",
+                  type_name(e->getType()).c_str());
       }
     }
   }else {
@@ -862,61 +1111,30 @@ void alloc::rec_typecheck() {
 }
 
 
-void alloc::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* alloc */\n"); );
+void alloc::build_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("alloc\n"); );
 
-  eprintf("%s warning: statement has no effect.\n", getfp()); 
-  eprintf("%s warning: memory leak.\n", getfp());
+  eprintf("%s warning: statement has no effect.\n", getfp().c_str()); 
+  eprintf("%s warning: memory leak.\n", getfp().c_str());
 }
 
-const char* alloc::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* alloc */\n"); ); 
-  
+ir_operand alloc::rec_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("alloc\n"); ); 
   
-  oil_type = getOilType(assoc_type);
-  oil_name = getTypechar(oil_type);
+  ir_operand temp = ir.temp(assoc_type);
   if (children.size() == 1) {
-    if (isUsertype(assoc_type)) { // struct
-      emit(pipe, "struct %s %s = xcalloc (1, sizeof (struct %s));\n", oil_type,
-           oil_name, oil_type);
-    }else { // basic type
-      emit(pipe, "%s %s = xcalloc (1, sizeof (%s));\n", oil_type, oil_name,
-           oil_type);
-    }
-  }else {
+    ir.alloc(temp, 0, assoc_type, IR_NO_OPERAND);
+  }else { // NEW basetype(expr) or NEW basetype[expr]
     int op = children[1]->symbol;
-    expr* e = static_cast<expr*>(children[2]);
-    if (op == '(') {  // NEW basetype(expr)
-      emit(pipe, "ubyte* %s = xcalloc (%s, sizeof (ubyte));\n", oil_name,
-           e->rec_codegen(pipe));
-    }else { // NEW basetype[expr]
-      if (stringcmp(oil_type, "ubyte")) {  // char bool
-        emit(pipe, "ubyte %s = xcalloc (%s, sizeof (ubyte));\n", oil_name,
-             e->rec_codegen(pipe));
-      }else if (stringcmp(oil_type, "int")) { // int
-        emit(pipe, "int %s = xcalloc (%s, sizeof (int));\n", oil_name,
-             e->rec_codegen(pipe));
-      }else if (stringcmp(assoc_type, "string[]")) { // string
-        emit(pipe, "ubyte** %s = xcalloc (%s, sizeof (ubyte*));\n", oil_name,
-             e->rec_codegen(pipe));
-      }else if (isArray(assoc_type)) {
-        emit(pipe, "%s %s = xcalloc (%s, sizeof (%s));\n", oil_type, 
-             oil_name, e->rec_codegen(pipe), oil_type);
-      }else if (isUsertype(assoc_type)) { // usertype
-        emit(pipe, "struct %s %s = xcalloc (%s, sizeof (struct %s*));\n",
-             oil_type, oil_name, e->rec_codegen(pipe), oil_type);
-      }else
-        errprintf("codegen error: alloc oil_type: %s assoc_type: %s\n",
-                  oil_type.c_str(), assoc_type.c_str()); 
-    }
+    ir.alloc(temp, op, assoc_type, children[2]->rec_ir(ir));
   }
-  return oil_name.c_str();
+  return temp;
 }
 
 
 /***********************  call  ***********************/
 // form IDENT([expr[,expr]...])
-call::call(ast* id, ast* args) : expr("call") {
+call::call(ast* id, ast* args) : expr("call"), sym(NULL) {
   add(id, args);
   absorb(id);
 }
@@ -927,101 +1145,70 @@ void call::rec_typecheck() {
 
   // must check call signature matches function signature
   string id(children[0]->getLex());
-  string sig = current_scope->lookup(id);
-  vector<string> funcsig = global_scope.parseSig(sig);
-  if (funcsig.size() > 0) {
+  sym = current_scope->resolve(children[0]->lexinfo);
+  typeref sig = sym == NULL ? TYPE_UNDEF : sym->type;
+  if (type_getkind(sig) == TYPE_KIND_FUNCTION) {
+    const vector<typeref>& funcsig = type_params(sig);
     // make a list of arguments from the arguments to compare
-    vector<string> callsig;
+    vector<typeref> callsig;
     ast* args = children[1];
-    std::vector<ast*>::iterator it;
+    ast_children::iterator it;
     for (it = args->children.begin(); it != args->children.end(); ++it) {
       callsig.push_back(static_cast<expr*>(*it)->getType());
     }
     // match arguments
-    if (callsig.size() == funcsig.size() - 1) {
-      bool args_matched = true;
-      for (size_t i = 0; i < callsig.size(); i++) {
-        if (callsig[i].compare(funcsig[i + 1]) != 0) {
-          args_matched = false;
-          break;
-        }
-      }
-      if (args_matched) {
-        assoc_type = funcsig[0];
-      }else {
-        errprintf("%s error: call to \"%s(%s)\" ", getfp(), 
-                  id.c_str(), getArgList(callsig).c_str());
-        errprintf("doesn't match function signature \"%s\".\n", sig.c_str());
-      }
+    if (callsig == funcsig) {
+      assoc_type = type_result(sig);
     }else {
-      errprintf("%s error: call to \"%s(%s)\" ", getfp(), 
+      errprintf("%s error: call to \"%s(%s)\" ", getfp().c_str(), 
                 id.c_str(), getArgList(callsig).c_str());
-      errprintf("doesn't match function signature \"%s\".\n", sig.c_str());
+      errprintf("doesn't match function signature \"%s\".\n",
+                type_name(sig).c_str());
     } 
   }else {
-    errprintf("%s error: unknown function call to \"%s\".\n", getfp(),
+    errprintf("%s error: unknown function call to \"%s\".\n", getfp().c_str(),
               id.c_str());
   }
 }
 
-void call::dump_code(FILE* pipe) { // call as a statement
-  DEBUGSTMT('c', fprintf(pipe, "/* call */\n"); ); 
-
-  list<const char*> arglist;
-  ast* args = children[1];
-  std::vector<ast*>::iterator it;
+// build the arguments in order and return where they start
+static size_t build_args(ast* args, ir_builder& ir) {
+  size_t first = ir.first_arg();
+  ast_children::iterator it;
   for (it = args->children.begin(); it != args->children.end(); ++it) {
-    arglist.push_back((*it)->rec_codegen(pipe));
-  }
-  emit(pipe, "%s(", mangle(0, children[0]->getLex()));
-  std::list<const char*>::iterator iter;
-  for (iter = arglist.begin(); iter != arglist.end(); ) {
-    fprintf(pipe, "%s", (*iter));
-    if (++iter != arglist.end())
-      fprintf(pipe, ", ");
+    ir.push_arg((*it)->rec_ir(ir));
   }
-  fprintf(pipe, ");\n");
+  return first;
 }
 
-const char* call::rec_codegen(FILE* pipe) { // call part of another statement
-  DEBUGSTMT('c', fprintf(pipe, "/* call */\n"); ); 
+void call::build_ir(ir_builder& ir) { // call as a statement
+  DEBUGSTMT('c', eprintf("call\n"); ); 
 
-  list<const char*> arglist;
-  ast* id = children[0];
-  ast* args = children[1];
-  std::vector<ast*>::iterator it;
-  for (it = args->children.begin(); it != args->children.end(); ++it) {
-    arglist.push_back((*it)->rec_codegen(pipe));
-  }
-  string functype = global_scope.parseSig(global_scope.lookup(id->getLex()))[0];
-  string funcname = id->getLex();
-  oil_type = getOilType(functype);
-  oil_name = getTypechar(oil_type);
-  string oil_call = mangle(0, funcname);
-  oil_call.append("(");
-  std::list<const char*>::iterator iter;
-  for (iter = arglist.begin(); iter != arglist.end(); ) {
-    oil_call.append(*iter);
-    if (++iter != arglist.end()) {
-      oil_call.append(", ");
-    }
-  }
-  oil_call.append(")");
-  emit(pipe, "%s %s = %s;\n", oil_type, oil_name, oil_call);
-  return oil_name.c_str();
+  size_t first = build_args(children[1], ir);
+  ir.call(IR_NO_OPERAND, sym, first);
+}
+
+ir_operand call::rec_ir(ir_builder& ir) { // call part of another statement
+  DEBUGSTMT('c', eprintf("call\n"); ); 
+
+  size_t first = build_args(children[1], ir);
+  ir_operand temp = ir.temp(type_result(sym->type));
+  ir.call(temp, sym, first);
+  return temp;
 }
 
 
 
 /***********************  variable  ***********************/
 // form IDENT
-variable::variable(ast* id) : expr("variable") {
+variable::variable(ast* id) : expr("variable"), sym(NULL) {
   add(id);
   absorb(id);
 }
 
 // form expr[expr] or expr.IDENT
-variable::variable(ast* e1, ast* op, ast* e2) : expr("variable") {
+variable::variable(ast* e1, ast* op, ast* e2)
+  : expr("variable"), sym(NULL) {
   add(e1, op, e2);
   absorb(op);
 }
@@ -1033,80 +1220,76 @@ void variable::rec_typecheck() {
 
   if (children.size() == 1) { // form IDENT
     // lookup type
-    assoc_type = current_scope->lookup(children[0]->getLex());
-    if (assoc_type.compare("undef") == 0)
-      errprintf("%s error: unknown identifier \"%s\".\n", getfp(),
+    sym = current_scope->resolve(children[0]->lexinfo);
+    assoc_type = sym == NULL ? TYPE_UNDEF : sym->type;
+    if (assoc_type == TYPE_UNDEF)
+      errprintf("%s error: unknown identifier \"%s\".\n", getfp().c_str(),
              children[0]->getLex().c_str()); 
   }else {
     int op = children[1]->symbol;
     expr* e1 = static_cast<expr*>(children[0]);
-    string etype = e1->getType();
+    typeref etype = e1->getType();
     if (op == '[') { // expr[expr]
 
       // expression must be an array type or a string
       if (isArray(etype) || isString(etype)) {
         // check that array address type is int
-        string aa_type = static_cast<expr*>(children[2])->getType();
+        typeref aa_type = static_cast<expr*>(children[2])->getType();
 
-        if (aa_type.compare("int") != 0) {
+        if (aa_type != TYPE_INT) {
           errprintf("%s error: array address (%s) must be of type int.\n",
-                    getfp(),  aa_type.c_str());
+                    getfp().c_str(),  type_name(aa_type).c_str());
         }
-        assoc_type = (isString(etype) ? "char" : parse_arraytype(etype));
+        assoc_type = (isString(etype) ? TYPE_CHAR : parse_arraytype(etype));
       } else {
          errprintf("%s error: array access is undefined for non array type",
-                   getfp());
-         errprintf(" \"%s\".\n", etype.c_str());
+                   getfp().c_str());
+         errprintf(" \"%s\".\n", type_name(etype).c_str());
          //assoc_type = etype;
       }
 
     } else if (op == '.') { // expr.IDENT
       string ident = children[2]->getLex();
-      assoc_type = global_scope.lookup_fieldtype(etype, ident);
-      if (assoc_type.compare("undef") == 0)
-        errprintf("%s error: undefined field \"%s.%s\".\n", getfp(), 
-                  etype.c_str(), ident.c_str());
+      structref s = struct_lookup(etype);
+      int f = s == NO_STRUCT ? -1 : struct_field(s, children[2]->lexinfo);
+      if (f >= 0)
+        assoc_type = struct_get(s).fields[f].type;
+      else
+        errprintf("%s error: undefined field \"%s.%s\".\n", getfp().c_str(), 
+                  type_name(etype).c_str(), ident.c_str());
     }
   }
 }
 
-void variable::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* variable */\n"); ); 
+void variable::build_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("variable\n"); ); 
   
-  eprintf("%s warning: statement has no effect.\n", getfp());
+  eprintf("%s warning: statement has no effect.\n", getfp().c_str());
 }
 
-const char* variable::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* variable */\n"); ); 
+ir_operand variable::rec_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("variable\n"); ); 
   
-  oil_type = getOilType(assoc_type);
   if (children.size() == 1) { // IDENT
-    string idname = children[0]->getLex();
-    oil_name = mangle(block_ptr->lookup_number(idname), idname);
-  }else {
-    expr* e1 = static_cast<expr*>(children[0]);
-    if (children[1]->symbol == '[') { // expr[expr]
-      expr* e2 = static_cast<expr*>(children[2]);
-      char* data;
-      asprintf(&data, "%s[%s]", e1->rec_codegen(pipe), e2->rec_codegen(pipe));
-      oil_name = data;
-      /*oil_name = getTypechar(oil_type);
-      emit(pipe, "%s %s = %s;\n", oil_type, oil_name, data); */
-    }else if (children[1]->symbol == '.') { // expr.IDENT
-      ast* id = children[2];
-      char* data;
-      asprintf(&data, "%s->%s", e1->rec_codegen(pipe), id->getLex().c_str());
-      oil_name = string(data);
-    }
+    stringid name = intern_stringset(sym->oil_name.data(),
+                                     sym->oil_name.size());
+    return ir.var(name, assoc_type, sym->number == 0 ? IR_GLOBAL : IR_LOCAL);
   }
-  return oil_name.c_str();
+  if (children[1]->symbol == '[') { // expr[expr]
+    ir_operand index = children[2]->rec_ir(ir);
+    ir_operand base = children[0]->rec_ir(ir);
+    return ir.index(base, index, assoc_type);
+  }
+  // expr.IDENT
+  ir_operand base = children[0]->rec_ir(ir);
+  return ir.field(base, children[2]->lexinfo, assoc_type);
 }
 
 
 
 /***********************  constant literal  ***********************/
 // form ident
-constant::constant(ast* id) : expr("constant") {
+constant::constant(ast* id, int val) : expr("constant"), value(val) {
   add(id);
   absorb(id);
 }
@@ -1116,34 +1299,34 @@ void constant::rec_typecheck() {
   DEBUGSTMT('z', eprintf("constant\n"); );
 
   switch(children[0]->symbol) {
-    case INTCON: assoc_type = "int";        break;
-    case CHARCON: assoc_type = "char";      break;
-    case STRINGCON: assoc_type = "string";  break;
-    case TOK_FALSE: assoc_type = "bool";    break;
-    case TOK_TRUE: assoc_type = "bool";     break;
-    case TOK_NULL: assoc_type = "null";     break;
+    case INTCON: assoc_type = TYPE_INT;        break;
+    case CHARCON: assoc_type = TYPE_CHAR;      break;
+    case STRINGCON: assoc_type = TYPE_STRING;  break;
+    case TOK_FALSE: assoc_type = TYPE_BOOL;    break;
+    case TOK_TRUE: assoc_type = TYPE_BOOL;     break;
+    case TOK_NULL: assoc_type = TYPE_NULL;     break;
   }
 }
 
-void constant::dump_code(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* constant */\n"); ); 
+void constant::build_ir(ir_builder&) {
+  DEBUGSTMT('c', eprintf("constant\n"); ); 
   
-  eprintf("%s warning: statement has no effect.\n", getfp());
+  eprintf("%s warning: statement has no effect.\n", getfp().c_str());
 }
 
-const char* constant::rec_codegen(FILE* pipe) {
-  DEBUGSTMT('c', fprintf(pipe, "/* constant */\n"); ); 
+ir_operand constant::rec_ir(ir_builder& ir) {
+  DEBUGSTMT('c', eprintf("constant\n"); );
   
-  string c = children[0]->getLex();
-  if (stringcmp(c, "true")) {
-    return "1";
-  } else if (stringcmp(c, "false")) {
-    return "0";
-  } else if (stringcmp(c, "null")) {
-    return "0";
+  switch(children[0]->symbol) {
+    case TOK_TRUE: return ir.constant(TYPE_BOOL, 1, IR_NO_TEXT);
+    case TOK_FALSE: return ir.constant(TYPE_BOOL, 0, IR_NO_TEXT);
+    case TOK_NULL: return ir.constant(TYPE_NULL, 0, IR_NO_TEXT);
   }
-  return c.c_str();
+  return ir.constant(assoc_type, value, children[0]->lexinfo);
 }
 
 // misc functions
 SymbolTable* getCurrentScope () { return current_scope; }
+
+// threads to check and generate function bodies on, 0 for every core
+void set_worker_threads (int threads) { worker_threads = threads; }
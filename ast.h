@@ -11,6 +11,11 @@
 #include "auxlib.h"
 #include "ralib.h"
 #include "astutils.h"
+#include "stringset.h"
+#include "astarena.h"
+#include "typetable.h"
+#include "ir.h"
+#include "tokbuf.h"
 
 /*********************** terminal superclass ***********************/
 class ast {
@@ -18,9 +23,13 @@ public:
   ast();
   ast(const char* lex);
   ast(int sym, const char* lex);
-  ast(int sym, size_t fnum, size_t lnum, size_t offset, const char* lex);
+  ast(int sym, srcloc loc, stringid lex);
   virtual ~ast();
 
+/**** nodes live in the ast arena ****/
+  static void* operator new(size_t size) { return astarena_alloc(size); }
+  static void operator delete(void*) {}
+
 /**** add methods ****/
   ast* add(ast* a);
   ast* add(ast* a, ast* b);
@@ -29,30 +38,29 @@ public:
 
 /**** get methods ****/
   std::string getLex(); // return token lexinfo
-  std::string getPos(); // return position string "(filenr.linenr.offset)"
-  const char* getfp();  // return File Position "filename:linenr:offset:"
+  const char* getLexstr(); // return interned lexinfo, never freed
+  std::string getfp();  // return File Position "filename:linenr:offset:"
 
 /**** print methods ****/
   void rec_dump(FILE* pipe, int depth); // dump subtree rooted at this
   virtual void dump_node(FILE* pipe);   // dump .ast data from this node
-  void dump_tok(FILE* pipe);            // dump .tok data
 
 /**** synthesize attributes ****/
   virtual void rec_typecheck();   // build symbol tables and syn. attributes
-  virtual void absorb(ast* node); // copy filenr, linenr and offset from node
+  virtual void absorb(ast* node); // copy source location from node
+  virtual int scope_count();      // symbol tables rec_typecheck will create
 
 /*** codegen ***/
-  virtual void dump_code(FILE* pipe); // dump i-code at the subtree rooted 
-                                      // at this node
-  virtual const char* rec_codegen(FILE* pipe); // generate i-code at each node
+  virtual void build_ir(ir_builder& ir); // build the ir of the statement
+                                        // rooted at this node
+  virtual ir_operand rec_ir(ir_builder& ir); // build the ir of an expression
 
 /**** node data ****/
   int symbol;                 // token symbol
-  size_t filenr;              // index into filename stack
-  size_t linenr;              // line number from source
-  size_t offset;              // offset of token with current line
-  const std::string* lexinfo; // lexical info assoc w/ token
-  std::vector<ast*> children; // children nodes
+  srcloc loc;                 // source location, decoded by tokbuf
+  stringid lexinfo;           // interned lexical info assoc w/ token
+  int nested_scopes;          // symbol tables created under the children
+  ast_children children;      // children nodes
 };
 
 /*********************** nonterminal superclasses ***********************/
@@ -68,8 +76,6 @@ public:
 class control_ast : public ast {
 public:
   control_ast(const char* lex);
-  std::string start;
-  std::string end;
   int number;
   static int COUNT;
 };
@@ -79,23 +85,24 @@ public:
 class root : public type_ast {
 public:
   root();
-  virtual void dump_code(FILE* pipe);
+  virtual void rec_typecheck();
+  void dump_code(oil_buffer& out);
 };
 
 class vardecl : public type_ast {
 public:
   vardecl(ast* type, ast* id, ast* op, ast* val);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  void dump_globalcode(FILE* pipe);
-  std::string getType();
+  virtual void build_ir(ir_builder& ir);
+  void dump_globalcode(oil_buffer& out);
+  typeref getType();
   std::string getIdent();
 };
 
 class decl : public type_ast {
 public:
   decl(ast* type, ast* id);
-  std::string getType();
+  typeref getType();
   std::string getIdent();
 };
 
@@ -103,23 +110,23 @@ class structdef : public type_ast {
 public:
   structdef(ast* id, ast* fld);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual void dump_globalcode(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual void dump_globalcode(oil_buffer& out);
   std::string getIdent();
 };
 
 class field : public type_ast {
 public:
   field();
-  virtual void dump_code(FILE* pipe);
+  void dump_globalcode(oil_buffer& out);
 };
 
 class block : public control_ast {
 public:
   block();
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual int scope_count();
+  virtual void build_ir(ir_builder& ir);
   SymbolTable* block_ptr;
   SymbolTable* getBlk();
 };
@@ -129,13 +136,19 @@ class func : public type_ast {
 public:
   func(ast* type, ast* id, ast* p, ast* blk);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual void dump_globalcode(FILE* pipe);
-  std::string getType();
+  virtual int scope_count();
+  virtual void build_ir(ir_builder& ir);
+  bool hasBody();
+  void build_function(ir_function& fn);
+  typeref getType();
   std::string getIdent();
-  std::string getSig();
+  typeref getSig();
   SymbolTable* getBlk();
+  void declare();
+  void check_resumed();
 private:
+  void check_header();
+  void check_body();
   SymbolTable* block_ptr;
 };
 
@@ -143,14 +156,14 @@ class funcreturn : public type_ast {
 public:
   funcreturn();
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
 };
 
 class params : public type_ast {
 public:
   params();
   virtual void rec_typecheck();
-  std::string getSig();
+  std::vector<typeref> getSig();
 };
 
 class type : public type_ast {
@@ -158,21 +171,21 @@ public:
   type(ast* btype);
   type(ast* btype, ast* array);
   virtual void rec_typecheck();
-  std::string getType();
+  typeref getType();
 };
 
 class basetype : public type_ast {
 public:
   basetype(ast* id);
   virtual void rec_typecheck();
-  std::string getType();
+  typeref getType();
 };
 
 class loop : public control_ast {
 public:
   loop(ast* e, ast* stmt);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
 };
 
 class arguments : public type_ast {
@@ -185,7 +198,7 @@ public:
   ifelse(ast* e, ast* stmt);
   ifelse(ast* e, ast* stmt1, ast* stmt2);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
 };
 
 /*** expressions can have "associated types" ***/
@@ -194,24 +207,24 @@ class expr : public type_ast {
 public:
   expr(const char* lex);
   virtual void dump_node(FILE* pipe); // assoc types printed with debug 'z'
-  std::string getType();
-  std::string assoc_type;
+  typeref getType();
+  typeref assoc_type;
 };
 
 class binop : public expr {
 public:
   binop(ast* e1, ast* op, ast* e2);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
 };
 
 class unop : public expr {
 public:
   unop(ast* op, ast* e);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
 };
 
 class alloc : public expr {
@@ -219,24 +232,26 @@ public:
   alloc(ast* btype);
   alloc(ast* btype, ast* tok, ast* e);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
 };
 
 class call : public expr {
 public:
   call(ast* id, ast* args);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
+  const symbol_record* sym; // declaration the identifier resolved to
 };
 
 class constant : public expr {
 public:
-  constant(ast* id);
+  constant(ast* id, int val = 0);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
+  int value; // INTCON and CHARCON value parsed by the scanner
 };
 
 class variable : public expr {
@@ -244,13 +259,17 @@ public:
   variable(ast* id);
   variable(ast* e1, ast* op, ast* e2);
   virtual void rec_typecheck();
-  virtual void dump_code(FILE* pipe);
-  virtual const char* rec_codegen(FILE* pipe);
+  virtual void build_ir(ir_builder& ir);
+  virtual ir_operand rec_ir(ir_builder& ir);
+  const symbol_record* sym; // declaration the identifier resolved to
 };
 
 //return current_scope pointer
 SymbolTable* getCurrentScope();
 
+//set the number of threads function bodies are checked and generated on
+void set_worker_threads(int threads);
+
 #include "lyutils.h"
 
 
@@ -0,0 +1,79 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Every ast node and every child array that outgrows its node is bump
+// allocated from a chain of large slabs.  Nodes are never freed one at
+// a time; the whole tree goes away in one call that hands the slabs
+// back, keeping the first one for the next tree.
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "astarena.h"
+#include "auxlib.h"
+
+using namespace std;
+
+static const size_t SLAB_SIZE = 256 * 1024;
+static const size_t ALIGN = alignof (max_align_t);
+
+struct slab {
+   char* base;
+   size_t size;
+};
+
+static vector<slab> slabs;           // every slab held, oldest first
+static char* slab_next = NULL;       // free space in the last slab
+static size_t slab_left = 0;
+static size_t slab_bytes = 0;
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+// allocate size bytes from the ast arena, never freed one at a time
+void* astarena_alloc (size_t size) {
+   size = (size + ALIGN - 1) & ~(ALIGN - 1);
+   if (size > slab_left) {
+      size_t bytes = size > SLAB_SIZE ? size : SLAB_SIZE;
+      slab fresh = {static_cast<char*> (malloc (bytes)), bytes};
+      if (fresh.base == NULL) {
+         errprintf ("%: out of memory for the ast arena\n");
+         abort();
+      }
+      slabs.push_back (fresh);
+      slab_next = fresh.base;
+      slab_left = bytes;
+      slab_bytes += bytes;
+   }
+   void* result = slab_next;
+   slab_next += size;
+   slab_left -= size;
+   ++alloc_count;
+   alloc_bytes += size;
+   return result;
+}
+
+// release every node of the tree at once
+void astarena_release (void) {
+   if (slabs.empty()) return;
+   for (size_t i = 1; i < slabs.size(); ++i) free (slabs[i].base);
+   slabs.resize (1);
+   slab_next = slabs[0].base;
+   slab_left = slab_bytes = slabs[0].size;
+   alloc_count = alloc_bytes = 0;
+}
+
+astarena_stats astarena_getstats (void) {
+   astarena_stats stats = {alloc_count, alloc_bytes, slabs.size(), slab_bytes};
+   return stats;
+}
+
+// double the child array, moving it into the arena
+void ast_children::grow() {
+   uint32_t new_capacity = capacity * 2;
+   ast** new_data = static_cast<ast**> (
+         astarena_alloc (new_capacity * sizeof (ast*)));
+   memcpy (new_data, data, count * sizeof (ast*));
+   data = new_data;
+   capacity = new_capacity;
+}
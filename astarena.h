@@ -0,0 +1,62 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* bump allocator for ast nodes and their child arrays */
+
+#ifndef __ASTARENA_H__
+#define __ASTARENA_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+class ast;
+
+// allocate size bytes from the ast arena, never freed one at a time
+void* astarena_alloc (size_t size);
+
+// release every node of the tree at once.  destructors are not run, so
+// any heap memory a node owns is not reclaimed.
+void astarena_release (void);
+
+struct astarena_stats {
+   size_t allocs;       // allocations since the last release
+   size_t bytes;        // bytes handed out since the last release
+   size_t slabs;        // slabs currently held
+   size_t slab_bytes;   // bytes in those slabs
+};
+
+astarena_stats astarena_getstats (void);
+
+// list of child pointers.  the first few live inside the node itself,
+// longer lists move to the ast arena as they grow.
+class ast_children {
+public:
+  typedef ast** iterator;
+
+  ast_children() : data(inline_data), count(0), capacity(INLINE) {}
+  ast_children(const ast_children&) = delete;
+  ast_children& operator=(const ast_children&) = delete;
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  ast*& operator[](size_t i) { return data[i]; }
+  ast*& back() { return data[count - 1]; }
+  iterator begin() { return data; }
+  iterator end() { return data + count; }
+
+  void push_back(ast* a) {
+    if (count == capacity) grow();
+    data[count++] = a;
+  }
+  void pop_back() { --count; }
+
+private:
+  static const uint32_t INLINE = 4;
+  void grow();
+  ast** data;
+  uint32_t count;
+  uint32_t capacity;
+  ast* inline_data[INLINE];
+};
+
+#endif // __ASTARENA_H__
@@ -5,193 +5,138 @@
 
 using namespace std;
 
-int t_count = 1; // temp variable counter
-int c_count = 1; // control label counter
-bool indent_flag = false; // set this to indent emits by 8 whitespace
-
 // return the scope mangled name for a variable
-std::string mangle(int blocknr, std::string id) {
+std::string mangle(int blocknr, const char* id) {
+  string temp;
   if (blocknr == 0) { // global variable
-    string temp("__");
-    temp.append(id.c_str());
-    return temp;
+    temp.append("__");
   }else { // local
-    string temp("_");
-    temp.append(itos(blocknr).c_str());
     temp.append("_");
-    temp.append(id.c_str());
-    return temp;
+    append_int(temp, blocknr);
+    temp.append("_");
   }
+  temp.append(id);
+  return temp;
 }
 
-// return the label mangled name for a variable
-std::string cmangle(string name) { 
-  name.append("_");
-  name.append(itos(c_count++));
-  return name;
-}
-
-// return the temporary variable name for type t
-string getTypechar(string t) {
-  if (stringcmp(t, "ubyte")) {
-    string temp("b");
-    temp.append(itos(t_count++).c_str());
-    return temp;
-  }else if (stringcmp(t, "int")) { 
-    string temp("i");
-    temp.append(itos(t_count++).c_str());
-    return temp;
-  }else if (strrchr (t.c_str(), '*') != NULL){
-    string temp("p");
-    temp.append(itos(t_count++).c_str());
-    return temp;
-  }else
-    return "[error]";
+// return File Position "filename:linenr:offset:" of loc
+string getfp(srcloc loc) {
+  size_t filenr, linenr, offset;
+  tokbuf_decode(loc, &filenr, &linenr, &offset);
+  char data[64];
+  snprintf(data, sizeof data, ":%zu:%zu:", linenr, offset);
+  string fp(*scanner_filename(filenr));
+  fp.append(data);
+  return fp;
 }
 
 // return oil equivalent of t if t is a basetype
-string getBasicOilType(string t) {
-  if (stringcmp(t, "undef")) {
-    return t;
-  }else if (stringcmp(t, "int")) {
+string getBasicOilType(typeref t) {
+  if (t == TYPE_UNDEF) {
+    return type_name(t);
+  }else if (t == TYPE_INT) {
     return "int";
-  }else if (stringcmp(t, "char") || stringcmp(t, "bool")) {
+  }else if (t == TYPE_CHAR || t == TYPE_BOOL) {
     return "ubyte";
-  }else if (stringcmp(t, "string")) {
+  }else if (t == TYPE_STRING) {
     return "ubyte*";
   }else if (isUsertype(t)) {
     string temp("struct ");
-    temp.append(t);
+    temp.append(type_name(t));
     return temp;
   }
   return "[error]";
 }
 
-// return oil equivalent of type t
-string getOilType(string t) {
+// oil types by typeref, computed for every type by loadOilTypes() once
+// typechecking is done.  every usertype is defined by then, so the
+// answer can no longer change, and threads may read them freely.
+static vector<string> oil_types;
+
+// compute the oil equivalent of type t
+static string computeOilType(typeref t) {
+  string oil;
   if (isBasetype(t)) { // return basic oil type (may be *)
-    return getBasicOilType(t);
+    oil = getBasicOilType(t);
   }else if (isArray(t)) { // return basic oil type with * (may be **)
-    string temp = parse_arraytype(t);
-    temp = getBasicOilType(temp);
-    temp.append("*");
-    return temp;
-  }else if (stringcmp(t, "void")) {
-    return t;
+    oil = getBasicOilType(parse_arraytype(t));
+    oil.append("*");
+  }else if (t == TYPE_VOID) {
+    oil = type_name(t);
+  }else {
+    oil = "undef_oil";
   }
-  return "undef_oil";
-}
-
-void setIndent(bool val) {
-  indent_flag = val;
-}
-
-void emit(FILE* pipe, const char* format) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, "%s", format);
-}
-
-void emit(FILE* pipe, const char* format, string s1) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, format, s1.c_str());
-}
-
-void emit(FILE* pipe, const char* format, string s1, string s2) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, format, s1.c_str(), s2.c_str());
-}
-
-void emit(FILE* pipe, const char* format, string s1, string s2, string s3) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, format, s1.c_str(), s2.c_str(), s3.c_str());
+  return oil;
 }
 
-void emit(FILE* pipe, const char* format, string s1, string s2, string s3,
-          string s4) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, format, s1.c_str(), s2.c_str(), s3.c_str(), s4.c_str());
+// compute the oil type of every type made so far
+void loadOilTypes() {
+  for (typeref t = oil_types.size(); t < type_count(); ++t) {
+    oil_types.push_back(computeOilType(t));
+  }
 }
 
-void emit(FILE* pipe, const char* format, string s1, string s2, string s3,
-          string s4, string s5) {
-  if (indent_flag)
-    fprintf(pipe, "%*s", 8, "");
-  fprintf(pipe, format, s1.c_str(), s2.c_str(), s3.c_str(), s4.c_str(), s5.c_str());
+// return oil equivalent of type t
+const string& getOilType(typeref t) {
+  if (t >= oil_types.size()) loadOilTypes();
+  return oil_types[t];
 }
 
 // return true if s is bool int or char
-bool isPrimitive(string s) {
-  if (stringcmp(s, "bool") || stringcmp(s, "int") || stringcmp(s, "char"))
-    return true;
-  return false;
+bool isPrimitive(typeref s) {
+  return s == TYPE_BOOL || s == TYPE_INT || s == TYPE_CHAR;
 }
 
-// return true if s.compare("string") == 0
-bool isString(string s) {
-  if (s.compare("string") == 0)
-    return true;
-  return false;
+// return true if s is string
+bool isString(typeref s) {
+  return s == TYPE_STRING;
 }
 
-// return true if s is a usertype
-bool isUsertype(string s) {
-  if (getCurrentScope()->lookup_usertype(s))
-    return true;
-  return false;
+// return true if s is a defined usertype
+bool isUsertype(typeref s) {
+  return struct_lookup(s) != NO_STRUCT;
 }
 
 // return true if s is bool int char string or usertype
-bool isBasetype(string s) {
+bool isBasetype(typeref s) {
   if (isPrimitive(s) || isString(s) || isUsertype(s))
     return true;
   return false;
 }
 
-// return true if s has suffix "[]"
-bool isArray(string s) {
-  if (s.substr(s.size() - 2).compare("[]") == 0)
-    return true;
-  return false;
+// return true if s is an array type
+bool isArray(typeref s) {
+  return type_getkind(s) == TYPE_KIND_ARRAY;
 }
 
 // return true if type1 and type2 are compatible
-bool typecheck(string type1, string type2) {
-  if (stringcmp(type1, type2))
+bool typecheck(typeref type1, typeref type2) {
+  if (type1 == type2)
     return true;
-  else if (!isPrimitive(type1) && type2.compare("null") == 0)
+  else if (!isPrimitive(type1) && type2 == TYPE_NULL)
     return true;
-  else if (!isPrimitive(type2) && type1.compare("null") == 0)
+  else if (!isPrimitive(type2) && type1 == TYPE_NULL)
     return true;
   return false;
 }
 
 // check that t1, t2 and expected are all the same
-bool expectedcheck(string t1, string t2, const char* expected) {
-  if (stringcmp(t1, t2) && t1.compare(expected) == 0)
-    return true;
-  return false;
+bool expectedcheck(typeref t1, typeref t2, typeref expected) {
+  return t1 == t2 && t1 == expected;
 }
 
-// returns the elements of "args" seperated by a ','
-string getArgList(vector<string> args) {
+// returns the names of "args" seperated by a ','
+string getArgList(const vector<typeref>& args) {
   string list;
-  std::vector<string>::iterator it;
-  for (it = args.begin(); it < args.end(); ++it) {
-    list.append(*it);
-    if (it + 1 != args.end()) list.append(",");
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i > 0) list.append(",");
+    list.append(type_name(args[i]));
   }
   return list;
 }
 
 // return the result of element access on an array type
-string parse_arraytype(string arraytype) {
-  // remove the trailing "[]"
-  string basetype = arraytype.substr(0, arraytype.size() - 2);
-  return basetype;
+typeref parse_arraytype(typeref arraytype) {
+  return type_element(arraytype);
 }
 
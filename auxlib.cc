@@ -1,6 +1,7 @@
 //$Id: auxlib.cc,v 1.3 2013/11/27 15:58:42 ranetsbe Exp ranetsbe $
 // Reid Anetsberger ~ ranetsbe@ucsc.edu
 
+#include <atomic>
 #include <cassert>
 #include <cerrno>
 #include <libgen.h>
@@ -13,7 +14,8 @@
 
 #include "auxlib.h"
 
-static int exitstatus = EXIT_SUCCESS;
+static std::atomic<int> exitstatus (EXIT_SUCCESS);
+static thread_local FILE* messagefile = NULL;
 static const char* execname = NULL;
 static const char* debugflags = "";
 static bool alldebugflags = false;
@@ -30,7 +32,7 @@ const char* get_execname (void) {
 static void eprint_signal (const char* kind, int signal) {
    eprintf (", %s %d", kind, signal);
    const char* sigstr = strsignal (signal);
-   if (sigstr != NULL) fprintf (stderr, " %s", sigstr);
+   if (sigstr != NULL) fprintf (get_messagefile (), " %s", sigstr);
 }
 
 void eprint_status (const char* command, int status) {
@@ -58,16 +60,25 @@ int get_exitstatus (void) {
    return exitstatus;
 }
 
+void set_messagefile (FILE* file) {
+   messagefile = file;
+}
+
+FILE* get_messagefile (void) {
+   return messagefile == NULL ? stderr : messagefile;
+}
+
 void veprintf (const char* format, va_list args) {
    assert (execname != NULL);
    assert (format != NULL);
-   fflush (NULL);
+   FILE* out = get_messagefile ();
+   if (out == stderr) fflush (NULL);
    if (strstr (format, "%:") == format) {
-      fprintf (stderr, "%s: ", get_execname ());
+      fprintf (out, "%s: ", get_execname ());
       format += 2;
    }
-   vfprintf (stderr, format, args);
-   fflush (NULL);
+   vfprintf (out, format, args);
+   if (out == stderr) fflush (NULL);
 }
 
 void eprintf (const char* format, ...) {
@@ -90,14 +101,16 @@ void syserrprintf (const char* object) {
 }
 
 void set_exitstatus (int newexitstatus) {
-   if (exitstatus < newexitstatus) exitstatus = newexitstatus;
-   DEBUGF ('x', "exitstatus = %d\n", exitstatus);
+   int status = exitstatus;
+   while (status < newexitstatus
+          && !exitstatus.compare_exchange_weak (status, newexitstatus));
+   DEBUGF ('x', "exitstatus = %d\n", exitstatus.load ());
 }
 
 // added
 void errprint_usage (void) {
-   errprintf ("%: Usage: \"%s [-ly] [-@ flag] [-D str] program.oc\"\n",
-              execname);
+   errprintf ("%: Usage: \"%s [-ly] [-@ flag] [-D str] [-L flex|fast] "
+              "[-j threads] program.oc\"\n", execname);
 }
 
 void __stubprintf (const char* file, int line, const char* func,
@@ -126,12 +139,13 @@ void __debugprintf (char flag, const char* file, int line,
                     const char* func, const char* format, ...) {
    va_list args;
    if (not is_debugflag (flag)) return;
-   fflush (NULL);
+   FILE* out = get_messagefile ();
+   if (out == stderr) fflush (NULL);
    va_start (args, format);
-   fprintf (stderr, "DEBUGF(%c): %s[%d] %s():\n",
+   fprintf (out, "DEBUGF(%c): %s[%d] %s():\n",
              flag, file, line, func);
-   vfprintf (stderr, format, args);
+   vfprintf (out, format, args);
    va_end (args);
-   fflush (NULL);
+   if (out == stderr) fflush (NULL);
 }
 
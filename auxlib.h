@@ -5,6 +5,7 @@
 #define __AUXLIB_H__
 
 #include <cstdarg>
+#include <cstdio>
 
 //
 // DESCRIPTION
@@ -44,9 +45,20 @@ void set_exitstatus (int);
    // Sets the exit status.  Remebers only the largest value passed in.
    //
 
+void set_messagefile (FILE* file);
+   //
+   // Sends the messages printed by the calling thread to file
+   // instead of stderr.  NULL sends them to stderr again.
+   //
+
+FILE* get_messagefile (void);
+   //
+   // Returns the file messages of the calling thread go to.
+   //
+
 void veprintf (const char* format, va_list args);
    //
-   // Prints a message to stderr using the vector form of 
+   // Prints a message to the message file using the vector form of 
    // argument list.
    //
 
@@ -0,0 +1,347 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Hand-written replacement for the flex scanner, selected with -L fast.
+// Runs of blanks, identifier characters and digits are classified 16
+// bytes at a time with SSE2 when it is available, and keywords are
+// found with a perfect hash computed at compile time.  Matching follows
+// flex's longest-match, first-rule-wins semantics for every rule in
+// scanner.l, so the token stream and diagnostics are identical.
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "fastscan.h"
+#include "lyutils.h"
+
+static char* scan_pos = NULL;     // next character to scan
+static char* scan_end = NULL;     // end of the scanned text
+static char* hold_pos = NULL;     // where yytext was NUL terminated
+static char hold_char = '\0';     // the character overwritten there
+
+/******************* character classes *******************/
+
+static inline bool is_letter (unsigned char c) {
+   return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_digit (unsigned char c) {
+   return c >= '0' && c <= '9';
+}
+
+#ifdef __SSE2__
+// bit i is set if byte i of chunk lies in [lo, hi]
+static inline unsigned range_mask (__m128i chunk, char lo, char hi) {
+   __m128i above = _mm_cmpgt_epi8 (chunk, _mm_set1_epi8 (lo - 1));
+   __m128i below = _mm_cmplt_epi8 (chunk, _mm_set1_epi8 (hi + 1));
+   return _mm_movemask_epi8 (_mm_and_si128 (above, below));
+}
+
+static inline unsigned equal_mask (__m128i chunk, char c) {
+   return _mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, _mm_set1_epi8 (c)));
+}
+
+static inline unsigned blank_mask (__m128i chunk) {
+   return equal_mask (chunk, ' ') | equal_mask (chunk, '\t');
+}
+
+static inline unsigned digit_mask (__m128i chunk) {
+   return range_mask (chunk, '0', '9');
+}
+
+static inline unsigned letter_mask (__m128i chunk) {
+   return range_mask (chunk, 'a', 'z') | range_mask (chunk, 'A', 'Z')
+        | equal_mask (chunk, '_');
+}
+
+static inline unsigned ident_mask (__m128i chunk) {
+   return letter_mask (chunk) | digit_mask (chunk);
+}
+
+// skip 16 bytes at a time while every byte is in the class
+#define SIMD_SPAN(MASK)                                               \
+   for (; pos + 16 <= scan_end; pos += 16) {                          \
+      __m128i chunk = _mm_loadu_si128 ((const __m128i*) pos);         \
+      unsigned mask = MASK (chunk) ^ 0xFFFF;                          \
+      if (mask != 0) return pos + __builtin_ctz (mask);               \
+   }
+#else
+#define SIMD_SPAN(MASK)
+#endif
+
+static char* span_blank (char* pos) {
+   SIMD_SPAN (blank_mask);
+   while (pos < scan_end && (*pos == ' ' || *pos == '\t')) ++pos;
+   return pos;
+}
+
+static char* span_ident (char* pos) {
+   SIMD_SPAN (ident_mask);
+   while (pos < scan_end && (is_letter (*pos) || is_digit (*pos))) ++pos;
+   return pos;
+}
+
+static char* span_digit (char* pos) {
+   SIMD_SPAN (digit_mask);
+   while (pos < scan_end && is_digit (*pos)) ++pos;
+   return pos;
+}
+
+static char* span_letter (char* pos) {
+   SIMD_SPAN (letter_mask);
+   while (pos < scan_end && is_letter (*pos)) ++pos;
+   return pos;
+}
+
+static char* span_line (char* pos) {
+   char* newline = static_cast<char*> (memchr (pos, '\n', scan_end - pos));
+   return newline == NULL ? scan_end : newline;
+}
+
+/******************* keywords *******************/
+
+struct keyword {
+   const char* name;
+   int length;
+   int symbol;
+};
+
+static constexpr keyword keywords[] = {
+   {"void",   4, VOID},      {"bool",   4, BOOL},
+   {"char",   4, CHAR},      {"int",    3, INT},
+   {"string", 6, STRING},    {"struct", 6, STRUCT},
+   {"if",     2, IF},        {"else",   4, ELSE},
+   {"while",  5, WHILE},     {"return", 6, RETURN},
+   {"new",    3, NEW},       {"false",  5, TOK_FALSE},
+   {"true",   4, TOK_TRUE},  {"null",   4, TOK_NULL},
+   {"ord",    3, ORD},       {"chr",    3, CHR},
+};
+static constexpr int KEYWORD_COUNT = sizeof keywords / sizeof keywords[0];
+static constexpr int KEYWORD_SLOTS = 32;
+
+static constexpr unsigned keyword_hash (const char* name, int length) {
+   return ((unsigned char) name[0] * 7 + (unsigned char) name[length - 1] * 8
+           + length) & (KEYWORD_SLOTS - 1);
+}
+
+struct keyword_table {
+   signed char slot[KEYWORD_SLOTS];  // index into keywords or -1
+   bool perfect;                     // no two keywords share a slot
+};
+
+static constexpr keyword_table make_keyword_table () {
+   keyword_table table {};
+   table.perfect = true;
+   for (int i = 0; i < KEYWORD_SLOTS; ++i) table.slot[i] = -1;
+   for (int i = 0; i < KEYWORD_COUNT; ++i) {
+      unsigned h = keyword_hash (keywords[i].name, keywords[i].length);
+      if (table.slot[h] >= 0) table.perfect = false;
+      table.slot[h] = i;
+   }
+   return table;
+}
+
+static constexpr keyword_table keyword_slots = make_keyword_table ();
+static_assert (keyword_slots.perfect, "keyword hash is not perfect");
+
+// return the keyword symbol for text or IDENT
+static inline int keyword_lookup (const char* text, int length) {
+   if (length < 2 || length > 6) return IDENT;
+   int index = keyword_slots.slot[keyword_hash (text, length)];
+   if (index < 0) return IDENT;
+   const keyword& kw = keywords[index];
+   if (kw.length != length || memcmp (kw.name, text, length) != 0)
+      return IDENT;
+   return kw.symbol;
+}
+
+/******************* literals *******************/
+
+// length of the CHAR starting at pos: a character other than \ ' and
+// newline, or a backslash followed by one of \ ' " 0 n t.  0 if none.
+static inline int char_length (const char* pos) {
+   if (pos >= scan_end) return 0;
+   char c = *pos;
+   if (c == '\n' || c == '\'') return 0;
+   if (c != '\\') return 1;
+   if (pos + 1 < scan_end && strchr ("\\'\"0nt", pos[1]) != NULL
+       && pos[1] != '\0') return 2;
+   return 0;
+}
+
+// match CHARCON, NOTCHARCON and UNTERMCHARCON at a quote.  returns the
+// length of the longest match and sets *rule to the first rule matching
+// that length: 0 CHARCON, 1 NOTCHARCON, 2 UNTERMCHARCON.  0 if none.
+static int match_charcon (char* start, int* rule) {
+   char* pos = start + 1;
+   char* last = NULL;            // start of the last CHAR
+   int count = 0;
+   for (int len; (len = char_length (pos)) > 0; pos += len) {
+      last = pos;
+      ++count;
+   }
+   if (count == 0) return 0;
+   if (pos < scan_end && *pos == '\'') {
+      *rule = count == 1 ? 0 : 1;
+      return pos + 1 - start;
+   }
+   *rule = 2;
+   if (pos < scan_end && *pos != '\n') return pos + 1 - start;
+   if (count >= 2) return last + 1 - start;
+   return 0;
+}
+
+// match STRINGCON, NOTSTRCON and UNTERMSTRCON at a double quote.
+// returns the length of the longest match and sets *rule to the first
+// rule matching that length: 0 STRINGCON, 1 NOTSTRCON, 2 UNTERMSTRCON.
+static int match_stringcon (char* start, int* rule) {
+   int best = 0;
+   // STRINGCON: escapes may hide quotes from the other two rules
+   for (char* pos = start + 1; pos < scan_end; ++pos) {
+      if (*pos == '"') {
+         best = pos + 1 - start;
+         *rule = 0;
+         break;
+      }
+      if (*pos == '\n') break;
+      if (*pos == '\\') {
+         if (pos + 1 >= scan_end || strchr ("\\'\"0nt", pos[1]) == NULL
+             || pos[1] == '\0') break;
+         ++pos;
+      }
+   }
+   char* quote = start + 1;
+   while (quote < scan_end && *quote != '"' && *quote != '\n') ++quote;
+   if (quote < scan_end && *quote == '"') {
+      // NOTSTRCON and UNTERMSTRCON both end at the quote
+      int len = quote + 1 - start;
+      if (len > best) {
+         best = len;
+         *rule = 1;
+      }
+   }else if (quote > start + 1) {
+      // UNTERMSTRCON takes the last character before the newline
+      int len = quote - start;
+      if (len > best) {
+         best = len;
+         *rule = 2;
+      }
+   }
+   return best;
+}
+
+/******************* scanner *******************/
+
+// restore the character overwritten by the last NUL terminator
+static inline void release_yytext (void) {
+   if (hold_pos != NULL) {
+      *hold_pos = hold_char;
+      hold_pos = NULL;
+   }
+}
+
+// make [start, end) the current yytext and run the user action
+static inline void match (char* start, char* end) {
+   hold_pos = end;
+   hold_char = *end;
+   *end = '\0';
+   yytext = start;
+   yyleng = end - start;
+   scan_pos = end;
+   scanner_useraction();
+}
+
+// scan buffer[0..length), the buffer must be followed by a NUL byte
+void fastscan_setbuffer (char* buffer, size_t length) {
+   release_yytext();
+   scan_pos = buffer;
+   scan_end = buffer + length;
+}
+
+// return the next token, 0 at end of buffer
+int fastscan_lex (void) {
+   for (;;) {
+      release_yytext();
+      char* start = scan_pos;
+      if (start >= scan_end) return 0;
+      unsigned char c = *start;
+      int rule = 0;
+      int len = 0;
+      switch (c) {
+         case ' ': case '\t':
+            match (start, span_blank (start + 1));
+            continue;
+         case '\n':
+            match (start, start + 1);
+            scanner_newline();
+            continue;
+         case '#':
+            match (start, span_line (start + 1));
+            scanner_include();
+            continue;
+         case '\'':
+            len = match_charcon (start, &rule);
+            if (len == 0) break;
+            match (start, start + len);
+            if (rule == 1)
+               scanner_badtoken ("unrecognized character constant", yytext);
+            else if (rule == 2)
+               scanner_badtoken ("unterminated character constant", yytext);
+            return yylval_token (CHARCON);
+         case '"':
+            len = match_stringcon (start, &rule);
+            if (len == 0) break;
+            match (start, start + len);
+            if (rule == 1)
+               scanner_badtoken ("unrecognized string constant", yytext);
+            else if (rule == 2)
+               scanner_badtoken ("unterminated string constant", yytext);
+            return yylval_token (STRINGCON);
+         case '[':
+            if (start + 1 < scan_end && start[1] == ']') {
+               match (start, start + 2);
+               return yylval_token (ARRAY);
+            }
+            match (start, start + 1);
+            return yylval_token ('[');
+         case '=': case '!': case '<': case '>': {
+            bool equals = start + 1 < scan_end && start[1] == '=';
+            match (start, start + (equals ? 2 : 1));
+            int symbol = c;
+            if (equals) symbol = c == '=' ? EQ : c == '!' ? NE
+                               : c == '<' ? LE : GE;
+            else if (c == '<') symbol = LT;
+            else if (c == '>') symbol = GT;
+            return yylval_token (symbol);
+         }
+         case '(': case ')': case ']': case '{': case '}': case ';':
+         case ',': case '.': case '+': case '-': case '*': case '/':
+         case '%':
+            match (start, start + 1);
+            return yylval_token (c);
+         default:
+            if (is_letter (c)) {
+               char* end = span_ident (start + 1);
+               match (start, end);
+               return yylval_token (keyword_lookup (start, end - start));
+            }
+            if (is_digit (c)) {
+               char* end = span_digit (start + 1);
+               if (end < scan_end && is_letter (*end)) {
+                  match (start, span_letter (end));
+                  scanner_badtoken ("unrecognized numeric", yytext);
+               }else {
+                  match (start, end);
+               }
+               return yylval_token (INTCON);
+            }
+            break;
+      }
+      // no rule but "." matched
+      match (start, start + 1);
+      scanner_badchar (*yytext);
+   }
+}
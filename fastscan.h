@@ -0,0 +1,18 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* hand-written scanner producing the same token stream as scanner.l */
+
+#ifndef __FASTSCAN_H__
+#define __FASTSCAN_H__
+
+#include <cstddef>
+
+// scan buffer[0..length), the buffer must be followed by a NUL byte.
+// the buffer is modified while scanning to NUL terminate yytext.
+void fastscan_setbuffer (char* buffer, size_t length);
+
+// return the next token, 0 at end of buffer
+int fastscan_lex (void);
+
+#endif // __FASTSCAN_H__
@@ -0,0 +1,87 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The pointer tree built by the parser is copied into parallel arrays
+// addressed by 32-bit node numbers.  Passes that only need the kind,
+// lexeme, type and position of each node can sweep these arrays from
+// front to back instead of chasing child pointers through the heap.
+
+#include "flatast.h"
+#include "ast.h"
+
+using namespace std;
+
+size_t flat_ast::bytes() const {
+   return symbol.capacity() * sizeof (int16_t)
+        + lexinfo.capacity() * sizeof (stringid)
+        + type.capacity() * sizeof (typeref)
+        + (end.capacity() + depth.capacity()) * sizeof (uint32_t)
+        + loc.capacity() * sizeof (srcloc);
+}
+
+void flat_ast::clear() {
+   symbol.clear();
+   lexinfo.clear();
+   type.clear();
+   end.clear();
+   depth.clear();
+   loc.clear();
+}
+
+// append node with every column but end filled in
+static void append_node (flat_ast& flat, ast* node, uint32_t depth) {
+   flat.symbol.push_back (node->symbol);
+   flat.lexinfo.push_back (node->lexinfo);
+   expr* e = dynamic_cast<expr*> (node);
+   flat.type.push_back (e == NULL ? NO_TYPE : e->assoc_type);
+   flat.end.push_back (0);
+   flat.depth.push_back (depth);
+   flat.loc.push_back (node->loc);
+}
+
+struct flatten_frame {
+   ast* node;
+   uint32_t index;        // node number of node
+   uint32_t next_child;   // next child of node to visit
+};
+
+// flatten the tree rooted at root into flat, replacing its contents
+void flatast_build (flat_ast& flat, ast* root) {
+   flat.clear();
+   if (root == NULL) return;
+   vector<flatten_frame> stack;
+   append_node (flat, root, 0);
+   flatten_frame first = {root, 0, 0};
+   stack.push_back (first);
+   while (!stack.empty()) {
+      flatten_frame& top = stack.back();
+      if (top.next_child == top.node->children.size()) {
+         flat.end[top.index] = flat.size();
+         stack.pop_back();
+         continue;
+      }
+      ast* child = top.node->children[top.next_child++];
+      flatten_frame frame = {child, uint32_t (flat.size()), 0};
+      append_node (flat, child, stack.size());
+      stack.push_back (frame);
+   }
+}
+
+// write flat in the .ast format, one linear sweep
+void flatast_dump (FILE* pipe, const flat_ast& flat) {
+   for (size_t i = 0; i < flat.size(); ++i) {
+      fprintf (pipe, "%*s", int (flat.depth[i] * 2), "");
+      int symbol = flat.symbol[i];
+      if (symbol == NT || symbol == ROOT) {
+         fprintf (pipe, "%s", stringset_cstr (flat.lexinfo[i]));
+         if (flat.type[i] != NO_TYPE) {
+            DEBUGX ('z', fprintf (pipe, " - assoctype=%s",
+                                  type_name (flat.type[i]).c_str()); );
+         }
+      }else {
+         fprintf (pipe, "%s (%s)", get_yytname (symbol),
+                  stringset_cstr (flat.lexinfo[i]));
+      }
+      fprintf (pipe, "\n");
+   }
+}
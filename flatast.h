@@ -0,0 +1,44 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* flat struct-of-arrays copy of the abstract syntax tree */
+
+#ifndef __FLATAST_H__
+#define __FLATAST_H__
+
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+
+#include "stringset.h"
+#include "typetable.h"
+#include "tokbuf.h"
+
+class ast;
+
+// type column of nodes that are not expressions
+const typeref NO_TYPE = UINT32_MAX;
+
+// Nodes are numbered in preorder, so the subtree of node i is the range
+// [i, end[i]), its first child is i + 1 and the next sibling of a child
+// c is end[c].  Every column is indexed by node number.
+struct flat_ast {
+   std::vector<int16_t> symbol;     // token symbol, NT or ROOT
+   std::vector<stringid> lexinfo;   // lexeme or nonterminal name
+   std::vector<typeref> type;       // assoc type of expressions
+   std::vector<uint32_t> end;       // one past the end of the subtree
+   std::vector<uint32_t> depth;     // distance from the root
+   std::vector<srcloc> loc;         // source location
+
+   size_t size() const { return symbol.size(); }
+   size_t bytes() const;            // storage used by the columns
+   void clear();
+};
+
+// flatten the tree rooted at root into flat, replacing its contents
+void flatast_build (flat_ast& flat, ast* root);
+
+// write flat in the .ast format, one linear sweep
+void flatast_dump (FILE* pipe, const flat_ast& flat);
+
+#endif // __FLATAST_H__
@@ -0,0 +1,566 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The ast is translated into this form one function at a time, the
+// passes work on it and oilgen writes it out.  Blocks are kept in the
+// order the oil text has them, which is also the order they are built.
+
+#include <climits>
+#include <cstring>
+
+#include "ir.h"
+#include "astutils.h"
+
+using namespace std;
+
+ir_function::ir_function() : name(IR_NO_TEXT), result(TYPE_VOID),
+      main(false), sym(NULL), program(NULL), ssa(false) {}
+
+typeref ir_function::type (ir_operand operand) const {
+   switch (operand.kind) {
+      case IR_TEMP:  return temps[operand.id].type;
+      case IR_VAR:   return vars[operand.id].type;
+      case IR_CONST: return consts[operand.id].type;
+      case IR_INDEX:
+      case IR_FIELD: return refs[operand.id].type;
+      default:       return TYPE_VOID;
+   }
+}
+
+// copy operand, with a reference of its own if it is one
+ir_operand ir_function::clone (ir_operand operand) {
+   if (operand.kind != IR_INDEX && operand.kind != IR_FIELD) return operand;
+   ir_ref ref = refs[operand.id];
+   ref.base = clone (ref.base);
+   ref.index = clone (ref.index);
+   operand.id = refs.size();
+   refs.push_back (ref);
+   return operand;
+}
+
+
+/***********************  builder  ***********************/
+
+// a block that nothing has been placed after yet
+static uint32_t make_block (ir_function& fn, const char* label, int number) {
+   ir_block block;
+   block.label = label;
+   block.label_number = number;
+   block.exit = IR_FALL;
+   block.value = IR_NO_OPERAND;
+   block.succ[0] = block.succ[1] = IR_NO_BLOCK;
+   block.independent = false;
+   fn.blocks.push_back (block);
+   return fn.blocks.size() - 1;
+}
+
+ir_builder::ir_builder (ir_function& fn) : fn(fn), loc(NO_SRCLOC), current(0),
+      temp_count(1), label_count(1) {
+   make_block (fn, NULL, 0);
+   placed.push_back (0);
+}
+
+char ir_temp_prefix (typeref type) {
+   const string& oil_type = getOilType (type);
+   if (oil_type == "ubyte") return 'b';
+   if (oil_type == "int") return 'i';
+   if (oil_type.find ('*') != string::npos) return 'p';
+   return 0;
+}
+
+ir_operand ir_builder::temp (typeref type) {
+   ir_temp temp = {type, ir_temp_prefix (type), 0};
+   if (temp.prefix != 0) temp.number = temp_count++;
+   ir_operand operand = {IR_TEMP, uint32_t (fn.temps.size()), 0};
+   fn.temps.push_back (temp);
+   return operand;
+}
+
+ir_operand ir_builder::var (stringid name, typeref type, ir_var_kind kind) {
+   unordered_map<stringid, uint32_t>::iterator found = var_of.find (name);
+   if (found == var_of.end()) {
+      ir_var var = {name, type, kind, kind != IR_GLOBAL, false};
+      found = var_of.insert (make_pair (name, fn.vars.size())).first;
+      fn.vars.push_back (var);
+   }
+   ir_operand operand = {IR_VAR, found->second, 0};
+   return operand;
+}
+
+ir_operand ir_builder::constant (typeref type, int value, stringid text) {
+   ir_const constant = {type, value, text};
+   ir_operand operand = {IR_CONST, uint32_t (fn.consts.size()), 0};
+   fn.consts.push_back (constant);
+   return operand;
+}
+
+ir_operand ir_builder::index (ir_operand base, ir_operand index,
+                              typeref type) {
+   ir_ref ref = {base, index, IR_NO_TEXT, type};
+   ir_operand operand = {IR_INDEX, uint32_t (fn.refs.size()), 0};
+   fn.refs.push_back (ref);
+   return operand;
+}
+
+ir_operand ir_builder::field (ir_operand base, stringid name,
+                              typeref type) {
+   ir_ref ref = {base, IR_NO_OPERAND, name, type};
+   ir_operand operand = {IR_FIELD, uint32_t (fn.refs.size()), 0};
+   fn.refs.push_back (ref);
+   return operand;
+}
+
+// the block code is appended to, starting one after a jump or return
+uint32_t ir_builder::open() {
+   if (current == IR_NO_BLOCK) {
+      current = make_block (fn, NULL, 0);
+      placed.push_back (current);
+   }
+   return current;
+}
+
+ir_instr& ir_builder::append (ir_opcode opcode, ir_operand dst) {
+   ir_instr instr;
+   instr.opcode = opcode;
+   instr.declares = false;
+   instr.op = 0;
+   instr.type = fn.type (dst);
+   instr.dst = dst;
+   instr.a = instr.b = IR_NO_OPERAND;
+   instr.first_arg = instr.arg_count = 0;
+   instr.callee = NULL;
+   instr.loc = loc;
+   vector<ir_instr>& instrs = fn.blocks[open()].instrs;
+   instrs.push_back (instr);
+   return instrs.back();
+}
+
+void ir_builder::move (ir_operand dst, ir_operand a, bool declares) {
+   ir_instr& instr = append (IR_MOVE, dst);
+   instr.a = a;
+   instr.declares = declares;
+}
+
+void ir_builder::binary (ir_operand dst, int op, ir_operand a,
+                         ir_operand b) {
+   ir_instr& instr = append (IR_BINARY, dst);
+   instr.op = op;
+   instr.a = a;
+   instr.b = b;
+}
+
+void ir_builder::unary (ir_operand dst, int op, ir_operand a) {
+   ir_instr& instr = append (IR_UNARY, dst);
+   instr.op = op;
+   instr.a = a;
+}
+
+void ir_builder::alloc (ir_operand dst, int op, typeref type,
+                        ir_operand count) {
+   ir_instr& instr = append (IR_ALLOC, dst);
+   instr.op = op;
+   instr.type = type;
+   instr.a = count;
+}
+
+void ir_builder::call (ir_operand dst, const symbol_record* callee,
+                       size_t first) {
+   ir_instr& instr = append (IR_CALL, dst);
+   instr.type = type_result (callee->type);
+   instr.callee = callee;
+   instr.first_arg = fn.args.size();
+   instr.arg_count = pending.size() - first;
+   fn.args.insert (fn.args.end(), pending.begin() + first, pending.end());
+   pending.resize (first);
+}
+
+uint32_t ir_builder::label (const char* prefix) {
+   return make_block (fn, prefix, label_count++);
+}
+
+void ir_builder::place (uint32_t block) {
+   if (current != IR_NO_BLOCK) fn.blocks[current].succ[0] = block;
+   placed.push_back (block);
+   current = block;
+}
+
+void ir_builder::jump (uint32_t target) {
+   ir_block& block = fn.blocks[open()];
+   block.exit = IR_JUMP;
+   block.succ[0] = target;
+   current = IR_NO_BLOCK;
+}
+
+// if cond is false go to target, else on to a new block
+void ir_builder::branch_unless (ir_operand cond, uint32_t target) {
+   uint32_t from = open();
+   uint32_t next = make_block (fn, NULL, 0);
+   ir_block& block = fn.blocks[from];
+   block.exit = IR_BRANCH;
+   block.value = cond;
+   block.succ[0] = next;
+   block.succ[1] = target;
+   placed.push_back (next);
+   current = next;
+}
+
+void ir_builder::ret (ir_operand value) {
+   ir_block& block = fn.blocks[open()];
+   block.exit = IR_RETURN;
+   block.value = value;
+   current = IR_NO_BLOCK;
+}
+
+void ir_builder::finish() {
+   vector<uint32_t> position (fn.blocks.size(), IR_NO_BLOCK);
+   for (size_t i = 0; i < placed.size(); ++i) position[placed[i]] = i;
+   // a label nothing was placed at still gets a block, at the end
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      if (position[b] == IR_NO_BLOCK) {
+         position[b] = placed.size();
+         placed.push_back (b);
+      }
+   }
+   vector<ir_block> ordered (fn.blocks.size());
+   for (size_t i = 0; i < placed.size(); ++i) {
+      ordered[i].instrs.swap (fn.blocks[placed[i]].instrs);
+      ir_block& block = ordered[i];
+      const ir_block& old = fn.blocks[placed[i]];
+      block.label = old.label;
+      block.label_number = old.label_number;
+      block.exit = old.exit;
+      block.value = old.value;
+      for (int s = 0; s < 2; ++s) {
+         block.succ[s] = old.succ[s] == IR_NO_BLOCK ? IR_NO_BLOCK
+                                                    : position[old.succ[s]];
+      }
+      if (block.exit == IR_FALL) {
+         block.succ[0] = i + 1 < placed.size() ? i + 1 : IR_NO_BLOCK;
+      }
+   }
+   fn.blocks.swap (ordered);
+   ir_compute_cfg (fn);
+}
+
+
+/***********************  control flow  ***********************/
+
+int ir_successors (const ir_function& fn, uint32_t b, uint32_t succ[2]) {
+   const ir_block& block = fn.blocks[b];
+   succ[0] = succ[1] = IR_NO_BLOCK;
+   switch (block.exit) {
+      case IR_FALL:
+      case IR_JUMP:
+         succ[0] = block.succ[0];
+         return succ[0] == IR_NO_BLOCK ? 0 : 1;
+      case IR_BRANCH:
+         succ[0] = block.succ[0];
+         succ[1] = block.succ[1];
+         return 2;
+      default:
+         return 0;
+   }
+}
+
+void ir_compute_cfg (ir_function& fn) {
+   for (size_t b = 0; b < fn.blocks.size(); ++b) fn.blocks[b].preds.clear();
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      uint32_t succ[2];
+      int count = ir_successors (fn, b, succ);
+      for (int s = 0; s < count; ++s) fn.blocks[succ[s]].preds.push_back (b);
+   }
+}
+
+bool ir_remove_unreachable (ir_function& fn) {
+   vector<uint32_t> order;
+   ir_reverse_postorder (fn, order);
+   if (order.size() == fn.blocks.size()) return false;
+   vector<uint32_t> position (fn.blocks.size(), IR_NO_BLOCK);
+   for (size_t i = 0; i < order.size(); ++i) position[order[i]] = 0;
+   // blocks keep their order, so a block falling through to the next
+   // one still does: the next one is reachable through it
+   uint32_t kept = 0;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (position[b] != IR_NO_BLOCK) position[b] = kept++;
+   }
+   kept = 0;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (position[b] == IR_NO_BLOCK) continue;
+      ir_block& block = fn.blocks[b];
+      for (int s = 0; s < 2; ++s) {
+         if (block.succ[s] != IR_NO_BLOCK)
+            block.succ[s] = position[block.succ[s]];
+      }
+      // the blocks jumped over may be gone
+      if (block.exit == IR_JUMP && block.succ[0] == kept + 1)
+         block.exit = IR_FALL;
+      if (kept != b) fn.blocks[kept] = std::move (block);
+      ++kept;
+   }
+   fn.blocks.resize (kept);
+   ir_compute_cfg (fn);
+   return true;
+}
+
+static void verify_error (const ir_function& fn, const char* what,
+                          uint32_t b) {
+   errprintf ("%: ir: %s: %s in B%u\n", stringset_cstr (fn.name), what, b);
+}
+
+// count the times each temp is written and each reference appears
+static void count_refs (const ir_function& fn, ir_operand operand,
+                        vector<int>& ref_uses) {
+   if (operand.kind != IR_INDEX && operand.kind != IR_FIELD) return;
+   ++ref_uses[operand.id];
+   count_refs (fn, fn.refs[operand.id].base, ref_uses);
+   count_refs (fn, fn.refs[operand.id].index, ref_uses);
+}
+
+bool ir_verify (const ir_function& fn) {
+   bool ok = true;
+   vector<int> temp_defs (fn.temps.size(), 0);
+   vector<int> ref_uses (fn.refs.size(), 0);
+   uint32_t count = fn.blocks.size();
+   for (uint32_t b = 0; b < count; ++b) {
+      const ir_block& block = fn.blocks[b];
+      uint32_t succ[2];
+      int nsucc = ir_successors (fn, b, succ);
+      for (int s = 0; s < nsucc; ++s) {
+         if (succ[s] >= count) {
+            verify_error (fn, "successor out of range", b);
+            ok = false;
+         }
+      }
+      if (block.exit == IR_FALL && block.succ[0] != IR_NO_BLOCK
+          && block.succ[0] != b + 1) {
+         verify_error (fn, "falls through to a block not next", b);
+         ok = false;
+      }
+      if (block.exit == IR_BRANCH && block.value.kind == IR_NONE) {
+         verify_error (fn, "branch without a condition", b);
+         ok = false;
+      }
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         if (instr.dst.kind == IR_TEMP) ++temp_defs[instr.dst.id];
+         count_refs (fn, instr.dst, ref_uses);
+         count_refs (fn, instr.a, ref_uses);
+         count_refs (fn, instr.b, ref_uses);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            count_refs (fn, fn.args[instr.first_arg + a], ref_uses);
+      }
+      count_refs (fn, block.value, ref_uses);
+   }
+   for (size_t t = 0; t < temp_defs.size(); ++t) {
+      if (temp_defs[t] > 1) {
+         verify_error (fn, "temp written more than once", 0);
+         ok = false;
+      }
+   }
+   for (size_t r = 0; r < ref_uses.size(); ++r) {
+      if (ref_uses[r] > 1) {
+         verify_error (fn, "reference shared by two operands", 0);
+         ok = false;
+      }
+   }
+   return ok;
+}
+
+
+/***********************  printing  ***********************/
+
+static void put_operand (oil_buffer& out, const ir_function& fn,
+                         ir_operand operand, bool versions) {
+   switch (operand.kind) {
+      case IR_NONE:
+         break;
+      case IR_TEMP: {
+         const ir_temp& temp = fn.temps[operand.id];
+         if (temp.prefix == 0) {
+            out.put ("[error]");
+         }else {
+            out.put (temp.prefix);
+            out.put (temp.number);
+         }
+         break;
+      }
+      case IR_VAR:
+         out.put (stringset_cstr (fn.vars[operand.id].name));
+         if (versions && operand.version != 0) {
+            out.put ('.');
+            out.put (int (operand.version));
+         }
+         break;
+      case IR_CONST: {
+         const ir_const& constant = fn.consts[operand.id];
+         if (constant.text != IR_NO_TEXT) out.put (stringset_cstr (constant.text));
+         // -2147483648 would be a long in c
+         else if (constant.value == INT_MIN) out.put ("(-2147483647 - 1)");
+         else out.put (constant.value);
+         break;
+      }
+      case IR_INDEX: {
+         const ir_ref& ref = fn.refs[operand.id];
+         put_operand (out, fn, ref.base, versions);
+         out.put ('[');
+         put_operand (out, fn, ref.index, versions);
+         out.put (']');
+         break;
+      }
+      case IR_FIELD: {
+         const ir_ref& ref = fn.refs[operand.id];
+         put_operand (out, fn, ref.base, versions);
+         out.put ("->");
+         out.put (stringset_cstr (ref.field));
+         break;
+      }
+   }
+}
+
+void ir_put_operand (oil_buffer& out, const ir_function& fn,
+                     ir_operand operand) {
+   put_operand (out, fn, operand, false);
+}
+
+// spelling of a binary or unary operator token
+const char* ir_opname (int op) {
+   switch (op) {
+      case '+': return "+";
+      case '-': return "-";
+      case '*': return "*";
+      case '/': return "/";
+      case '%': return "%";
+      case '!': return "!";
+      case EQ:  return "==";
+      case NE:  return "!=";
+      case LT:  return "<";
+      case LE:  return "<=";
+      case GT:  return ">";
+      case GE:  return ">=";
+      case ORD: return "ord";
+      case CHR: return "chr";
+      default:  return "?";
+   }
+}
+
+static void put_block_name (oil_buffer& out, uint32_t b) {
+   out.put ('B');
+   out.put (int (b));
+}
+
+static void dump_instr (oil_buffer& out, const ir_function& fn,
+                        const ir_instr& instr) {
+   out.put ("   ");
+   if (instr.dst.kind != IR_NONE) {
+      if (instr.declares || instr.dst.kind == IR_TEMP) {
+         out.put (type_name (fn.type (instr.dst)));
+         out.put (' ');
+      }
+      put_operand (out, fn, instr.dst, true);
+      out.put (" = ");
+   }
+   switch (instr.opcode) {
+      case IR_MOVE:
+         put_operand (out, fn, instr.a, true);
+         break;
+      case IR_BINARY:
+         put_operand (out, fn, instr.a, true);
+         oil_format (out, " %s ", ir_opname (instr.op));
+         put_operand (out, fn, instr.b, true);
+         break;
+      case IR_UNARY:
+         oil_format (out, "%s ", ir_opname (instr.op));
+         put_operand (out, fn, instr.a, true);
+         break;
+      case IR_CALL:
+         oil_format (out, "call %s (", instr.callee->oil_name);
+         for (uint32_t i = 0; i < instr.arg_count; ++i) {
+            if (i > 0) out.put (", ");
+            put_operand (out, fn, fn.args[instr.first_arg + i], true);
+         }
+         out.put (')');
+         break;
+      case IR_ALLOC:
+         oil_format (out, "new %s", type_name (instr.type));
+         if (instr.a.kind != IR_NONE) {
+            out.put (instr.op == '(' ? " (" : " [");
+            put_operand (out, fn, instr.a, true);
+            out.put (instr.op == '(' ? ")" : "]");
+         }
+         break;
+   }
+   out.put ('\n');
+}
+
+void ir_dump (FILE* file, const ir_function& fn) {
+   oil_buffer out;
+   oil_format (out, "function %s : %s (", stringset_cstr (fn.name),
+               type_name (fn.result));
+   for (size_t i = 0; i < fn.params.size(); ++i) {
+      if (i > 0) out.put (", ");
+      ir_operand param = {IR_VAR, fn.params[i], fn.ssa ? 1u : 0u};
+      put_operand (out, fn, param, true);
+   }
+   out.put (")\n");
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      put_block_name (out, b);
+      if (block.label != NULL) oil_format (out, " %s_%d", block.label,
+                                           block.label_number);
+      out.put (" <-");
+      for (size_t p = 0; p < block.preds.size(); ++p) {
+         out.put (' ');
+         put_block_name (out, block.preds[p]);
+      }
+      if (fn.ssa && b > 0 && fn.idom[b] != IR_NO_BLOCK) {
+         out.put ("  idom ");
+         put_block_name (out, fn.idom[b]);
+      }
+      out.put ('\n');
+      for (size_t p = 0; p < block.phis.size(); ++p) {
+         const ir_phi& phi = block.phis[p];
+         oil_format (out, "   %s.%d = phi (",
+                     stringset_cstr (fn.vars[phi.var].name),
+                     int (phi.version));
+         for (size_t a = 0; a < phi.args.size(); ++a) {
+            if (a > 0) out.put (", ");
+            out.put (int (phi.args[a]));
+         }
+         out.put (")\n");
+      }
+      for (size_t i = 0; i < block.instrs.size(); ++i)
+         dump_instr (out, fn, block.instrs[i]);
+      switch (block.exit) {
+         case IR_FALL:
+            if (block.succ[0] == IR_NO_BLOCK) break;
+            out.put ("   fall ");
+            put_block_name (out, block.succ[0]);
+            out.put ('\n');
+            break;
+         case IR_JUMP:
+            out.put ("   jump ");
+            put_block_name (out, block.succ[0]);
+            out.put ('\n');
+            break;
+         case IR_BRANCH:
+            out.put ("   branch ");
+            put_operand (out, fn, block.value, true);
+            out.put (' ');
+            put_block_name (out, block.succ[0]);
+            out.put (' ');
+            put_block_name (out, block.succ[1]);
+            out.put ('\n');
+            break;
+         case IR_RETURN:
+            out.put ("   return");
+            if (block.value.kind != IR_NONE) out.put (' ');
+            put_operand (out, fn, block.value, true);
+            out.put ('\n');
+            break;
+         case IR_HALT:
+            out.put ("   halt\n");
+            break;
+      }
+   }
+   fwrite (out.data(), 1, out.size(), file);
+}
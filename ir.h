@@ -0,0 +1,247 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* three-address intermediate representation of a function */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#include "oilbuf.h"
+#include "stringset.h"
+#include "symtable.h"
+#include "typetable.h"
+
+// A function is a list of basic blocks in the order they are written
+// out.  Each block holds typed three-address instructions and ends in
+// an explicit exit naming its successors.  An operand may also be an
+// element or field reference, read or written by the instruction it
+// appears in, so that a[i] = x is one instruction as it is in oil.
+
+const uint32_t IR_NO_BLOCK = UINT32_MAX;
+const stringid IR_NO_TEXT = UINT32_MAX;
+
+enum ir_operand_kind : uint8_t {
+   IR_NONE,       // no operand
+   IR_TEMP,       // a temporary, defined once
+   IR_VAR,        // a global, parameter or local variable
+   IR_CONST,      // a literal
+   IR_INDEX,      // base[index], a reference in fn.refs
+   IR_FIELD,      // base->field, a reference in fn.refs
+};
+
+struct ir_operand {
+   ir_operand_kind kind;
+   uint32_t id;           // temp, var, constant or reference number
+   uint32_t version;      // ssa version of a variable, 0 if unknown
+};
+
+const ir_operand IR_NO_OPERAND = {IR_NONE, 0, 0};
+
+enum ir_var_kind : uint8_t { IR_GLOBAL, IR_PARAM, IR_LOCAL };
+
+struct ir_var {
+   stringid name;         // mangled oil name
+   typeref type;
+   ir_var_kind kind;
+   bool versioned;        // numbered in ssa form: not a global any call
+                          // may change
+   bool restricted;       // a pointer walking memory nothing else in its
+                          // loop reaches while it is written
+};
+
+struct ir_temp {
+   typeref type;
+   char prefix;           // b, i or p by oil type, 0 if it has none
+   int number;
+};
+
+struct ir_const {
+   typeref type;
+   int value;             // int, char and bool value
+   stringid text;         // spelling in the source, IR_NO_TEXT if none
+};
+
+// Every reference belongs to exactly one operand, so a pass that
+// copies an operand must copy its reference with ir_function::clone.
+struct ir_ref {
+   ir_operand base;
+   ir_operand index;      // IR_INDEX only
+   stringid field;        // IR_FIELD only
+   typeref type;          // type of the element or field
+};
+
+enum ir_opcode : uint8_t {
+   IR_MOVE,       // dst = a
+   IR_BINARY,     // dst = a op b, or a bare "a op b" without dst
+   IR_UNARY,      // dst = op a
+   IR_CALL,       // dst = callee (args), or a call statement without dst
+   IR_ALLOC,      // dst = xcalloc of one type, or a elements of it
+};
+
+struct ir_instr {
+   ir_opcode opcode;
+   bool declares;         // a move declaring the local variable dst
+   int16_t op;            // token of the operator, or of the allocator
+   typeref type;          // type of the result
+   ir_operand dst;
+   ir_operand a;
+   ir_operand b;
+   uint32_t first_arg;    // call arguments are fn.args[first_arg...]
+   uint32_t arg_count;
+   const symbol_record* callee;
+   srcloc loc;            // of the operator, for diagnostics
+};
+
+enum ir_exit : uint8_t {
+   IR_FALL,       // on to succ[0], the next block, if any
+   IR_JUMP,       // goto succ[0]
+   IR_BRANCH,     // succ[0] if value is true, else succ[1]
+   IR_RETURN,     // return value, if any
+   IR_HALT,       // nowhere: the last instruction never returns
+};
+
+// what the passes over one function know of the rest of the program
+struct ir_program {
+   // globals written once, with a literal, before any function can
+   // run, and never again
+   std::unordered_map<stringid, ir_const> constant_globals;
+};
+
+// a variable merged at the head of a block in ssa form
+struct ir_phi {
+   uint32_t var;
+   uint32_t version;
+   std::vector<uint32_t> args;   // version from each predecessor
+};
+
+struct ir_block {
+   const char* label;            // label prefix, NULL if it has no label
+   int label_number;
+   std::vector<ir_instr> instrs;
+   ir_exit exit;
+   ir_operand value;
+   uint32_t succ[2];
+   std::vector<uint32_t> preds;  // filled in by ir_compute_cfg
+   std::vector<ir_phi> phis;     // filled in by ir_build_ssa
+   bool independent;             // heads a loop whose trips write no
+                                 // memory another trip reads or writes
+};
+
+struct ir_function {
+   stringid name;                // mangled oil name
+   typeref result;
+   bool main;                    // the global statements, __ocmain
+   const symbol_record* sym;     // the function symbol, NULL for main
+   const ir_program* program;    // NULL until every function is built
+   std::vector<uint32_t> params; // vars, in order
+   std::vector<ir_block> blocks; // in output order, the entry first
+   std::vector<ir_var> vars;
+   std::vector<ir_temp> temps;
+   std::vector<ir_const> consts;
+   std::vector<ir_ref> refs;
+   std::vector<ir_operand> args;
+   bool ssa;                     // versions and phis are up to date
+   std::vector<uint32_t> idom;   // immediate dominators, while ssa
+
+   ir_function();
+   typeref type (ir_operand operand) const;
+   ir_operand clone (ir_operand operand);
+   void invalidate() { ssa = false; }
+};
+
+// Appends the code of one function in the order the statements run,
+// numbering temps and labels the way the oil has always numbered them.
+class ir_builder {
+public:
+   ir_builder (ir_function& fn);
+   ir_function& fn;
+   srcloc loc;            // given to the instructions appended
+
+   ir_operand temp (typeref type);
+   ir_operand var (stringid name, typeref type, ir_var_kind kind);
+   ir_operand constant (typeref type, int value, stringid text);
+   ir_operand index (ir_operand base, ir_operand index, typeref type);
+   ir_operand field (ir_operand base, stringid name, typeref type);
+
+   void move (ir_operand dst, ir_operand a, bool declares = false);
+   void binary (ir_operand dst, int op, ir_operand a, ir_operand b);
+   void unary (ir_operand dst, int op, ir_operand a);
+   void alloc (ir_operand dst, int op, typeref type, ir_operand count);
+
+   // arguments are pushed in order, then taken by the call
+   size_t first_arg() const { return pending.size(); }
+   void push_arg (ir_operand arg) { pending.push_back (arg); }
+   void call (ir_operand dst, const symbol_record* callee, size_t first);
+
+   // a block that starts with a label, placed later
+   uint32_t label (const char* prefix);
+   void place (uint32_t block);
+   void jump (uint32_t target);
+   void branch_unless (ir_operand cond, uint32_t target);
+   void ret (ir_operand value);
+
+   // put the blocks in the order they were placed
+   void finish();
+
+private:
+   ir_instr& append (ir_opcode opcode, ir_operand dst);
+   uint32_t open();
+   uint32_t current;
+   int temp_count;
+   int label_count;
+   std::vector<uint32_t> placed;
+   std::vector<ir_operand> pending;
+   std::unordered_map<stringid, uint32_t> var_of;
+};
+
+// successors of block b, IR_NO_BLOCK where there is none
+int ir_successors (const ir_function& fn, uint32_t b, uint32_t succ[2]);
+
+// fill in the predecessors of every block
+void ir_compute_cfg (ir_function& fn);
+
+// drop the blocks the entry cannot reach, returning true if there
+// were any.  a jump to the block that is now next becomes a fall, and
+// the predecessors are filled in again.
+bool ir_remove_unreachable (ir_function& fn);
+
+// check that the successors, temps and references of fn are well
+// formed, reporting an error for each that is not
+bool ir_verify (const ir_function& fn);
+
+// the blocks reachable from the entry, each before its successors
+// except along back edges
+void ir_reverse_postorder (const ir_function& fn,
+                           std::vector<uint32_t>& order);
+
+// fill in fn.idom, IR_NO_BLOCK for the entry and unreachable blocks
+void ir_compute_dominators (ir_function& fn);
+
+// true if every path from the entry to b goes through a
+bool ir_dominates (const ir_function& fn, uint32_t a, uint32_t b);
+
+// number every definition of a parameter or local and point each use
+// at the definition reaching it, adding phis where paths merge.  the
+// code is left as it is, so the oil does not change.
+void ir_build_ssa (ir_function& fn);
+
+// the letter naming a temp of type in the oil, 0 if it has none
+char ir_temp_prefix (typeref type);
+
+// spelling of a binary or unary operator token
+const char* ir_opname (int op);
+
+// write operand as it appears in the oil
+void ir_put_operand (oil_buffer& out, const ir_function& fn,
+                     ir_operand operand);
+
+// write the ir of fn in a readable form
+void ir_dump (FILE* file, const ir_function& fn);
+
+#endif // __IR_H__
@@ -0,0 +1,81 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The call graph.  Only the functions __ocmain calls, or that those
+// call in turn, can ever run, and functions have no other way in, so
+// the rest need not be optimized or written.  Walking the calls depth
+// first from __ocmain gives each function after all it calls, but for
+// calls back around a cycle, which then need a prototype.
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "irpass.h"
+
+using namespace std;
+
+typedef unordered_map<const symbol_record*, uint32_t> function_index;
+
+// the functions with bodies fn calls, by index, in the order it first
+// calls each
+static void find_callees (const ir_function& fn,
+                          const function_index& index_of,
+                          vector<uint32_t>& callees) {
+   callees.clear();
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         if (instrs[i].opcode != IR_CALL) continue;
+         function_index::const_iterator found
+               = index_of.find (instrs[i].callee);
+         if (found == index_of.end()) continue;
+         if (find (callees.begin(), callees.end(), found->second)
+             == callees.end())
+            callees.push_back (found->second);
+      }
+   }
+}
+
+void ir_build_call_graph (ir_call_graph& graph,
+                          const vector<ir_function>& functions,
+                          const ir_function& main) {
+   function_index index_of;
+   for (size_t f = 0; f < functions.size(); ++f) {
+      if (!functions[f].blocks.empty())
+         index_of[functions[f].sym] = f;
+   }
+   vector<vector<uint32_t> > callees (functions.size());
+   enum { UNSEEN, OPEN, DONE };
+   vector<char> state (functions.size(), UNSEEN);
+   graph.order.clear();
+   graph.forward.clear();
+
+   vector<uint32_t> roots;
+   find_callees (main, index_of, roots);
+   // each frame is a function and the number of its callees visited
+   vector<pair<uint32_t, size_t> > stack;
+   for (size_t r = 0; r < roots.size(); ++r) {
+      if (state[roots[r]] != UNSEEN) continue;
+      state[roots[r]] = OPEN;
+      find_callees (functions[roots[r]], index_of, callees[roots[r]]);
+      stack.push_back (make_pair (roots[r], size_t (0)));
+      while (!stack.empty()) {
+         uint32_t f = stack.back().first;
+         if (stack.back().second < callees[f].size()) {
+            uint32_t callee = callees[f][stack.back().second++];
+            if (state[callee] == OPEN && callee != f
+                && find (graph.forward.begin(), graph.forward.end(), callee)
+                   == graph.forward.end())
+               graph.forward.push_back (callee);
+            if (state[callee] != UNSEEN) continue;
+            state[callee] = OPEN;
+            find_callees (functions[callee], index_of, callees[callee]);
+            stack.push_back (make_pair (callee, size_t (0)));
+            continue;
+         }
+         state[f] = DONE;
+         graph.order.push_back (f);
+         stack.pop_back();
+      }
+   }
+}
@@ -0,0 +1,332 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Common subexpression elimination by value numbering down the
+// dominator tree.  Operands with the same value get the same number:
+// a version of a variable is one value wherever it is read, and an
+// operator applied to the same numbers gives the same number.  A temp
+// computing a number some temp before it already holds, in a block
+// dominating it, is dropped and its uses read the earlier temp.
+//
+// Memory and the globals are numbered by generation as well.  A store,
+// a call or a write to a global starts a new generation, as does a
+// block that can be come to other than from its dominator, so that a
+// load is only taken from one made, or a store made, with nothing in
+// between.  -@o reports the values and the loads reused.
+
+#include <unordered_map>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+enum value_kind : uint8_t { K_CONST, K_VAR, K_LOAD, K_UNARY, K_BINARY };
+
+struct value_key {
+   value_kind kind;
+   int16_t op;
+   typeref type;
+   uint32_t a;
+   uint32_t b;
+   uint32_t c;
+
+   bool operator== (const value_key& other) const {
+      return kind == other.kind && op == other.op && type == other.type
+          && a == other.a && b == other.b && c == other.c;
+   }
+};
+
+struct value_hash {
+   size_t operator() (const value_key& key) const {
+      uint64_t hash = key.kind * 31u + uint16_t (key.op);
+      hash = hash * 1000003u ^ key.type;
+      hash = hash * 1000003u ^ key.a;
+      hash = hash * 1000003u ^ key.b;
+      hash = hash * 1000003u ^ key.c;
+      return hash ^ (hash >> 29);
+   }
+};
+
+static const uint32_t NO_VALUE = UINT32_MAX;
+
+class numberer {
+public:
+   numberer (ir_function& fn);
+   bool run();
+
+private:
+   uint32_t fresh();
+   uint32_t number (const value_key& key);
+   uint32_t value_of (ir_operand& operand);
+   void set_leader (uint32_t value, ir_operand operand);
+   bool reusable (uint32_t value, uint32_t b) const;
+   value_key load_key (ir_ref& ref);
+   void visit_instr (uint32_t b, ir_instr& instr, bool& dropped);
+   void visit_block (uint32_t b);
+   void replace (ir_operand& operand) const;
+
+   ir_function& fn;
+   unordered_map<value_key, uint32_t, value_hash> numbers;
+   uint32_t values;
+   vector<uint32_t> temp_value;           // by temp, NO_VALUE until set
+   vector<uint32_t> temp_block;           // by temp, where it is written
+   vector<ir_operand> leader;             // by value, IR_NONE if none
+   vector<uint32_t> led;                  // values given leaders, in order
+   vector<ir_operand> replaced;           // by temp, IR_NONE if kept
+   uint32_t current;                      // the block being numbered
+   uint32_t generation;
+   uint32_t generations;
+   vector<uint32_t> end_generation;       // by block
+   unsigned int reused;
+   unsigned int loads;
+};
+
+numberer::numberer (ir_function& fn) : fn(fn), values(0),
+      temp_value(fn.temps.size(), NO_VALUE),
+      temp_block(fn.temps.size(), IR_NO_BLOCK),
+      replaced(fn.temps.size(), IR_NO_OPERAND), current(0), generation(0),
+      generations(0), end_generation(fn.blocks.size(), 0), reused(0),
+      loads(0) {
+}
+
+uint32_t numberer::fresh() {
+   leader.push_back (IR_NO_OPERAND);
+   return values++;
+}
+
+uint32_t numberer::number (const value_key& key) {
+   unordered_map<value_key, uint32_t, value_hash>::iterator found
+         = numbers.find (key);
+   if (found != numbers.end()) return found->second;
+   uint32_t value = fresh();
+   numbers.insert (make_pair (key, value));
+   return value;
+}
+
+// the number of what operand reads, after a load is made to read the
+// temp or literal already holding its value
+uint32_t numberer::value_of (ir_operand& operand) {
+   switch (operand.kind) {
+      case IR_NONE:
+         return NO_VALUE;
+      case IR_TEMP: {
+         uint32_t& value = temp_value[operand.id];
+         if (value == NO_VALUE) value = fresh();
+         return value;
+      }
+      case IR_CONST: {
+         const ir_const& constant = fn.consts[operand.id];
+         value_key key = {K_CONST, 0, constant.type, uint32_t (constant.value),
+                          constant.text, 0};
+         uint32_t value = number (key);
+         // a literal leads its number everywhere, but for a string,
+         // which may not be the same array written twice
+         if (leader[value].kind == IR_NONE && isPrimitive (constant.type))
+            leader[value] = operand;
+         return value;
+      }
+      case IR_VAR: {
+         value_key key = {K_VAR, 0, 0, operand.id, operand.version, 0};
+         if (!fn.vars[operand.id].versioned || operand.version == 0)
+            key.c = generation + 1;
+         return number (key);
+      }
+      case IR_INDEX:
+      case IR_FIELD: {
+         uint32_t value = number (load_key (fn.refs[operand.id]));
+         if (reusable (value, current)) {
+            operand = leader[value];
+            ++loads;
+            return value_of (operand);
+         }
+         return value;
+      }
+   }
+   return NO_VALUE;
+}
+
+value_key numberer::load_key (ir_ref& ref) {
+   value_key key = {K_LOAD, 0, ref.type, value_of (ref.base), 0, generation};
+   if (ref.index.kind != IR_NONE) {
+      key.op = '[';
+      key.b = value_of (ref.index);
+   }else {
+      key.b = ref.field;
+   }
+   return key;
+}
+
+void numberer::set_leader (uint32_t value, ir_operand operand) {
+   leader[value] = operand;
+   led.push_back (value);
+}
+
+// a temp holds value where it can be read in block b: written in a
+// block dominating b, and written before b in the oil
+bool numberer::reusable (uint32_t value, uint32_t b) const {
+   const ir_operand& held = leader[value];
+   if (held.kind == IR_CONST) return true;
+   return held.kind == IR_TEMP && temp_block[held.id] <= b;
+}
+
+void numberer::visit_instr (uint32_t b, ir_instr& instr, bool& dropped) {
+   uint32_t a = value_of (instr.a);
+   uint32_t y = value_of (instr.b);
+   for (uint32_t k = 0; k < instr.arg_count; ++k)
+      value_of (fn.args[instr.first_arg + k]);
+   if (instr.dst.kind == IR_INDEX || instr.dst.kind == IR_FIELD)
+      load_key (fn.refs[instr.dst.id]);
+
+   uint32_t value = NO_VALUE;
+   switch (instr.opcode) {
+      case IR_MOVE:
+         value = a;
+         break;
+      case IR_UNARY: {
+         value_key key = {K_UNARY, instr.op, instr.type, a, 0, 0};
+         value = number (key);
+         break;
+      }
+      case IR_BINARY: {
+         if ((instr.op == '+' || instr.op == '*' || instr.op == EQ
+              || instr.op == NE) && y < a)
+            swap (a, y);
+         value_key key = {K_BINARY, instr.op, instr.type, a, y, 0};
+         value = number (key);
+         break;
+      }
+      case IR_CALL:
+         generation = ++generations;
+         break;
+      case IR_ALLOC:
+         break;
+   }
+
+   switch (instr.dst.kind) {
+      case IR_TEMP:
+         if (value == NO_VALUE) value = fresh();
+         if (reusable (value, b)) {
+            replaced[instr.dst.id] = leader[value];
+            temp_value[instr.dst.id] = value;
+            dropped = true;
+            ++reused;
+            return;
+         }
+         temp_value[instr.dst.id] = value;
+         temp_block[instr.dst.id] = b;
+         set_leader (value, instr.dst);
+         break;
+      case IR_VAR: {
+         const ir_var& var = fn.vars[instr.dst.id];
+         value_key key = {K_VAR, 0, 0, instr.dst.id, instr.dst.version, 0};
+         if (!var.versioned || instr.dst.version == 0) {
+            generation = ++generations;
+            key.c = generation + 1;
+         }
+         if (value != NO_VALUE) numbers[key] = value;
+         break;
+      }
+      case IR_INDEX:
+      case IR_FIELD: {
+         generation = ++generations;
+         if (value == NO_VALUE) break;
+         // what was stored is what a load from there reads
+         numbers[load_key (fn.refs[instr.dst.id])] = value;
+         break;
+      }
+      default:
+         break;
+   }
+}
+
+void numberer::visit_block (uint32_t b) {
+   ir_block& block = fn.blocks[b];
+   current = b;
+   if (b != 0 && block.preds.size() == 1 && block.preds[0] == fn.idom[b])
+      generation = end_generation[fn.idom[b]];
+   else
+      generation = ++generations;
+   size_t kept = 0;
+   for (size_t i = 0; i < block.instrs.size(); ++i) {
+      bool dropped = false;
+      visit_instr (b, block.instrs[i], dropped);
+      if (dropped) continue;
+      if (kept != i) block.instrs[kept] = block.instrs[i];
+      ++kept;
+   }
+   block.instrs.resize (kept);
+   value_of (block.value);
+   end_generation[b] = generation;
+}
+
+void numberer::replace (ir_operand& operand) const {
+   switch (operand.kind) {
+      case IR_TEMP:
+         if (replaced[operand.id].kind != IR_NONE)
+            operand = replaced[operand.id];
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         replace (fn.refs[operand.id].base);
+         replace (fn.refs[operand.id].index);
+         break;
+      default:
+         break;
+   }
+}
+
+bool numberer::run() {
+   if (fn.blocks.empty()) return false;
+   vector<vector<uint32_t> > children (fn.blocks.size());
+   for (uint32_t b = 1; b < fn.blocks.size(); ++b) {
+      if (fn.idom[b] != IR_NO_BLOCK) children[fn.idom[b]].push_back (b);
+   }
+   // down the dominator tree, what leads a value in a block leading it
+   // in the blocks the block dominates
+   vector<size_t> marks (fn.blocks.size(), 0);
+   vector<pair<uint32_t, size_t> > walk;
+   walk.push_back (make_pair (0u, size_t (0)));
+   bool entering = true;
+   while (!walk.empty()) {
+      uint32_t b = walk.back().first;
+      if (entering) {
+         marks[b] = led.size();
+         visit_block (b);
+      }
+      if (walk.back().second < children[b].size()) {
+         uint32_t child = children[b][walk.back().second++];
+         walk.push_back (make_pair (child, size_t (0)));
+         entering = true;
+         continue;
+      }
+      while (led.size() > marks[b]) {
+         leader[led.back()] = IR_NO_OPERAND;
+         led.pop_back();
+      }
+      walk.pop_back();
+      entering = false;
+   }
+   if (reused == 0 && loads == 0) return false;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         ir_instr& instr = block.instrs[i];
+         replace (instr.dst);
+         replace (instr.a);
+         replace (instr.b);
+         for (uint32_t k = 0; k < instr.arg_count; ++k)
+            replace (fn.args[instr.first_arg + k]);
+      }
+      replace (block.value);
+   }
+   if (is_debugflag ('o')) {
+      eprintf ("cse: %s: %u values, %u loads reused\n",
+               stringset_cstr (fn.name), reused, loads);
+   }
+   return true;
+}
+
+bool ir_eliminate_common (ir_function& fn) {
+   return numberer (fn).run();
+}
@@ -0,0 +1,346 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Dead code elimination.  Nothing after a call to __exit runs, so the
+// block ends there.  A jump to a block that does nothing but go on
+// goes straight to where that leads, and a branch whose sides meet
+// becomes a jump, leaving blocks the entry no longer reaches to be
+// dropped.  Then, from the variables live at the end of each block, a
+// store to a variable not read again and a temp never read are dead;
+// an instruction writing only dead values is removed unless it has
+// effects, and a call keeps its effects but not its result.
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+class eliminator {
+public:
+   eliminator (ir_function& fn);
+   bool run();
+
+private:
+   void end_at_exits();
+   uint32_t forward (uint32_t target) const;
+   void thread_jumps();
+   void count (ir_operand operand, int delta);
+   void read (ir_operand operand, uint64_t* live) const;
+   void read_instr (const ir_instr& instr, uint64_t* live) const;
+   void read_exit (uint32_t b, uint64_t* live) const;
+   void compute_liveness();
+   bool removable (const ir_instr& instr) const;
+   bool dead (const ir_instr& instr, const uint64_t* live) const;
+   void remove (ir_instr& instr);
+   bool sweep_block (uint32_t b);
+   bool sweep();
+
+   ir_function& fn;
+   size_t words;                  // in a set of variables
+   vector<uint64_t> globals;      // the set of global variables
+   vector<uint64_t> live_out;     // by block, then variable
+   vector<int> temp_reads;        // by temp
+   vector<int> var_mentions;      // by variable, wherever it appears
+   unsigned int instrs_removed;
+   unsigned int blocks_removed;
+};
+
+static bool test_bit (const uint64_t* set, uint32_t bit) {
+   return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit (uint64_t* set, uint32_t bit) {
+   set[bit / 64] |= uint64_t (1) << (bit % 64);
+}
+
+static void clear_bit (uint64_t* set, uint32_t bit) {
+   set[bit / 64] &= ~(uint64_t (1) << (bit % 64));
+}
+
+eliminator::eliminator (ir_function& fn) : fn(fn),
+      words((fn.vars.size() + 63) / 64), globals(words, 0),
+      instrs_removed(0), blocks_removed(0) {
+   for (uint32_t v = 0; v < fn.vars.size(); ++v) {
+      if (fn.vars[v].kind == IR_GLOBAL) set_bit (globals.data(), v);
+   }
+}
+
+// __exit is oclib's, and the program ends in it
+void eliminator::end_at_exits() {
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         if (instr.opcode != IR_CALL || instr.callee->oil_name != "__exit")
+            continue;
+         instrs_removed += block.instrs.size() - i - 1;
+         block.instrs.resize (i + 1);
+         block.exit = IR_HALT;
+         block.value = IR_NO_OPERAND;
+         block.succ[0] = block.succ[1] = IR_NO_BLOCK;
+         break;
+      }
+   }
+}
+
+// the last labelled block reached from target through blocks that do
+// nothing, so that a goto may name it
+uint32_t eliminator::forward (uint32_t target) const {
+   uint32_t best = target;
+   for (size_t steps = 0; steps < fn.blocks.size(); ++steps) {
+      const ir_block& block = fn.blocks[target];
+      if (!block.instrs.empty() || block.succ[0] == IR_NO_BLOCK
+          || (block.exit != IR_JUMP && block.exit != IR_FALL))
+         break;
+      target = block.succ[0];
+      if (fn.blocks[target].label != NULL) best = target;
+   }
+   return best;
+}
+
+void eliminator::thread_jumps() {
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      ir_block& block = fn.blocks[b];
+      if (block.exit == IR_JUMP) {
+         block.succ[0] = forward (block.succ[0]);
+      }else if (block.exit == IR_BRANCH) {
+         // a side that is the next block needs no label
+         for (int s = 0; s < 2; ++s) {
+            if (block.succ[s] != b + 1)
+               block.succ[s] = forward (block.succ[s]);
+         }
+         if (block.succ[0] == block.succ[1]) {
+            block.exit = IR_JUMP;
+            block.value = IR_NO_OPERAND;
+            block.succ[1] = IR_NO_BLOCK;
+         }
+      }
+      if (block.exit == IR_JUMP && block.succ[0] == b + 1)
+         block.exit = IR_FALL;
+   }
+}
+
+// add delta to the reads of the temps and mentions of the variables
+// in operand
+void eliminator::count (ir_operand operand, int delta) {
+   switch (operand.kind) {
+      case IR_TEMP:
+         temp_reads[operand.id] += delta;
+         break;
+      case IR_VAR:
+         var_mentions[operand.id] += delta;
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         count (fn.refs[operand.id].base, delta);
+         count (fn.refs[operand.id].index, delta);
+         break;
+      default:
+         break;
+   }
+}
+
+void eliminator::read (ir_operand operand, uint64_t* live) const {
+   switch (operand.kind) {
+      case IR_VAR:
+         set_bit (live, operand.id);
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         read (fn.refs[operand.id].base, live);
+         read (fn.refs[operand.id].index, live);
+         break;
+      default:
+         break;
+   }
+}
+
+// make what instr reads live; a call may read any global
+void eliminator::read_instr (const ir_instr& instr, uint64_t* live) const {
+   if (instr.dst.kind == IR_INDEX || instr.dst.kind == IR_FIELD)
+      read (instr.dst, live);
+   read (instr.a, live);
+   read (instr.b, live);
+   for (uint32_t a = 0; a < instr.arg_count; ++a)
+      read (fn.args[instr.first_arg + a], live);
+   if (instr.opcode == IR_CALL) {
+      for (size_t w = 0; w < words; ++w) live[w] |= globals[w];
+   }
+}
+
+// the caller may read the globals once a function returns, but
+// nothing does once __ocmain has
+void eliminator::read_exit (uint32_t b, uint64_t* live) const {
+   const ir_block& block = fn.blocks[b];
+   read (block.value, live);
+   bool leaves = block.exit == IR_RETURN
+              || (block.exit == IR_FALL && block.succ[0] == IR_NO_BLOCK);
+   if (leaves && !fn.main) {
+      for (size_t w = 0; w < words; ++w) live[w] |= globals[w];
+   }
+}
+
+// the usual backward problem, to a fixed point, over the blocks in
+// postorder so that most are seen after their successors
+void eliminator::compute_liveness() {
+   size_t nblocks = fn.blocks.size();
+   vector<uint64_t> live_in (nblocks * words, 0);
+   live_out.assign (nblocks * words, 0);
+   vector<uint32_t> order;
+   ir_reverse_postorder (fn, order);
+   vector<uint64_t> live (words);
+   for (bool changed = true; changed; ) {
+      changed = false;
+      for (size_t i = order.size(); i-- > 0; ) {
+         uint32_t b = order[i];
+         uint64_t* out = &live_out[b * words];
+         uint32_t succ[2];
+         int nsucc = ir_successors (fn, b, succ);
+         for (int s = 0; s < nsucc; ++s) {
+            const uint64_t* in = &live_in[succ[s] * words];
+            for (size_t w = 0; w < words; ++w) out[w] |= in[w];
+         }
+         copy (out, out + words, live.begin());
+         read_exit (b, live.data());
+         const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+         for (size_t k = instrs.size(); k-- > 0; ) {
+            if (instrs[k].dst.kind == IR_VAR)
+               clear_bit (live.data(), instrs[k].dst.id);
+            read_instr (instrs[k], live.data());
+         }
+         uint64_t* in = &live_in[b * words];
+         for (size_t w = 0; w < words; ++w) {
+            if (in[w] != live[w]) {
+               in[w] = live[w];
+               changed = true;
+            }
+         }
+      }
+   }
+}
+
+// a division is left to trap on unless the divisor is a literal other
+// than zero, as folding leaves it
+bool eliminator::removable (const ir_instr& instr) const {
+   int divisor;
+   switch (instr.opcode) {
+      case IR_MOVE:
+      case IR_UNARY:
+      case IR_ALLOC:
+         return true;
+      case IR_BINARY:
+         if (instr.op != '/' && instr.op != '%') return true;
+         return ir_literal (fn, instr.b, divisor) && divisor != 0;
+      default:
+         return false;
+   }
+}
+
+// the value instr writes is never read; a local's declaration stays
+// as long as the local is mentioned anywhere else
+bool eliminator::dead (const ir_instr& instr, const uint64_t* live) const {
+   switch (instr.dst.kind) {
+      case IR_NONE:
+         return true;
+      case IR_TEMP:
+         return temp_reads[instr.dst.id] == 0;
+      case IR_VAR:
+         return !test_bit (live, instr.dst.id)
+             && (!instr.declares || var_mentions[instr.dst.id] == 1);
+      default:
+         return false;
+   }
+}
+
+void eliminator::remove (ir_instr& instr) {
+   if (instr.dst.kind != IR_TEMP) count (instr.dst, -1);
+   count (instr.a, -1);
+   count (instr.b, -1);
+   for (uint32_t a = 0; a < instr.arg_count; ++a)
+      count (fn.args[instr.first_arg + a], -1);
+   ++instrs_removed;
+}
+
+bool eliminator::sweep_block (uint32_t b) {
+   ir_block& block = fn.blocks[b];
+   vector<uint64_t> live (live_out.begin() + b * words,
+                          live_out.begin() + (b + 1) * words);
+   read_exit (b, live.data());
+   bool changed = false;
+   vector<char> removed (block.instrs.size(), 0);
+   for (size_t i = block.instrs.size(); i-- > 0; ) {
+      ir_instr& instr = block.instrs[i];
+      if (dead (instr, live.data())) {
+         if (removable (instr)) {
+            remove (instr);
+            removed[i] = 1;
+            changed = true;
+            continue;
+         }
+         if (instr.opcode == IR_CALL && instr.dst.kind != IR_NONE) {
+            if (instr.dst.kind != IR_TEMP) count (instr.dst, -1);
+            instr.dst = IR_NO_OPERAND;
+            changed = true;
+         }
+      }
+      if (instr.dst.kind == IR_VAR) clear_bit (live.data(), instr.dst.id);
+      read_instr (instr, live.data());
+   }
+   if (!changed) return false;
+   size_t kept = 0;
+   for (size_t i = 0; i < block.instrs.size(); ++i) {
+      if (removed[i]) continue;
+      if (kept != i) block.instrs[kept] = block.instrs[i];
+      ++kept;
+   }
+   block.instrs.resize (kept);
+   return true;
+}
+
+// the uses of a temp are after its definition, so in postorder most
+// are removed before it is looked at
+bool eliminator::sweep() {
+   compute_liveness();
+   vector<uint32_t> order;
+   ir_reverse_postorder (fn, order);
+   bool changed = false;
+   for (size_t i = order.size(); i-- > 0; ) {
+      if (sweep_block (order[i])) changed = true;
+   }
+   return changed;
+}
+
+bool eliminator::run() {
+   if (fn.blocks.empty()) return false;
+   size_t nblocks = fn.blocks.size();
+   end_at_exits();
+   thread_jumps();
+   ir_compute_cfg (fn);
+   ir_remove_unreachable (fn);
+   blocks_removed = nblocks - fn.blocks.size();
+
+   temp_reads.assign (fn.temps.size(), 0);
+   var_mentions.assign (fn.vars.size(), 0);
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         if (instr.dst.kind != IR_TEMP) count (instr.dst, 1);
+         count (instr.a, 1);
+         count (instr.b, 1);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            count (fn.args[instr.first_arg + a], 1);
+      }
+      count (block.value, 1);
+   }
+   while (sweep()) {}
+   if (is_debugflag ('o')) {
+      eprintf ("dce: %s: %u instructions, %u blocks removed\n",
+               stringset_cstr (fn.name), instrs_removed, blocks_removed);
+   }
+   return instrs_removed != 0 || blocks_removed != 0;
+}
+
+bool ir_eliminate_dead (ir_function& fn) {
+   return eliminator (fn).run();
+}
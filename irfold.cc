@@ -0,0 +1,272 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Constant folding and algebraic simplification.  An operation on
+// literals is done here, with the wrapping int arithmetic the oil does
+// at run time, and its temp is replaced by the result wherever it is
+// read.  A branch on a constant becomes a jump and the arm it can no
+// longer take is dropped.  Division by a constant zero is left for the
+// program to trap on, with a warning.
+
+#include <climits>
+#include <cstdlib>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+// an int literal too big for an int is compared as a long by gcc, so
+// it is left alone
+bool ir_literal (const ir_function& fn, ir_operand operand, int& value) {
+   if (operand.kind != IR_CONST) return false;
+   const ir_const& constant = fn.consts[operand.id];
+   if (!isPrimitive (constant.type) && constant.type != TYPE_NULL)
+      return false;
+   if (constant.type == TYPE_INT && constant.text != IR_NO_TEXT
+       && strtoll (stringset_cstr (constant.text), NULL, 10)
+          != constant.value)
+      return false;
+   value = constant.value;
+   return true;
+}
+
+// operands that read no memory, so dropping them changes nothing
+static bool is_simple (ir_operand operand) {
+   return operand.kind == IR_TEMP || operand.kind == IR_VAR
+       || operand.kind == IR_CONST;
+}
+
+// value as it is stored in a temp of type
+static int narrow (typeref type, int value) {
+   return getOilType (type) == "ubyte" ? value & 0xFF : value;
+}
+
+static void warn_division (const ir_instr& instr) {
+   eprintf ("%s warning: division by zero.\n", getfp (instr.loc).c_str());
+}
+
+bool ir_eval_binary (int op, typeref type, int x, int y, int& value) {
+   unsigned int ux = x, uy = y;
+   switch (op) {
+      case '+': value = ux + uy; break;
+      case '-': value = ux - uy; break;
+      case '*': value = ux * uy; break;
+      case '/':
+      case '%':
+         if (y == 0 || (x == INT_MIN && y == -1)) return false;
+         value = op == '/' ? x / y : x % y;
+         break;
+      case EQ: value = x == y; break;
+      case NE: value = x != y; break;
+      case LT: value = x < y; break;
+      case LE: value = x <= y; break;
+      case GT: value = x > y; break;
+      case GE: value = x >= y; break;
+      default: return false;
+   }
+   value = narrow (type, value);
+   return true;
+}
+
+bool ir_eval_unary (int op, typeref type, int x, int& value) {
+   switch (op) {
+      case '!': value = !x; break;
+      case '+': value = x; break;
+      case '-': value = 0u - (unsigned int) x; break;
+      case ORD:
+      case CHR: value = x; break;
+      default: return false;
+   }
+   value = narrow (type, value);
+   return true;
+}
+
+// a binary operation with one literal operand that needs no
+// arithmetic: x + 0, x - 0, x * 1, x / 1 give x; x * 0, x % 1 give 0
+static bool simplify (const ir_instr& instr, const ir_function& fn,
+                      ir_operand& result, bool& zero) {
+   int x = 0, y = 0;
+   bool a_literal = ir_literal (fn, instr.a, x);
+   bool b_literal = ir_literal (fn, instr.b, y);
+   if (!a_literal && !b_literal) return false;
+   zero = false;
+   switch (instr.op) {
+      case '+':
+         if (b_literal && y == 0) result = instr.a;
+         else if (a_literal && x == 0) result = instr.b;
+         else return false;
+         return true;
+      case '-':
+         if (!b_literal || y != 0) return false;
+         result = instr.a;
+         return true;
+      case '*':
+         if (b_literal && y == 1) result = instr.a;
+         else if (a_literal && x == 1) result = instr.b;
+         else if ((b_literal && y == 0 && is_simple (instr.a))
+                  || (a_literal && x == 0 && is_simple (instr.b)))
+            zero = true;
+         else return false;
+         return true;
+      case '/':
+      case '%':
+         if (!b_literal) return false;
+         if (y == 0) {
+            warn_division (instr);
+            return false;
+         }
+         if (y != 1) return false;
+         if (instr.op == '/') result = instr.a;
+         else if (is_simple (instr.a)) zero = true;
+         else return false;
+         return true;
+      default:
+         return false;
+   }
+}
+
+class folder {
+public:
+   folder (ir_function& fn) : fn(fn),
+         replaced(fn.temps.size(), IR_NO_OPERAND), changed(false) {}
+   bool run();
+
+private:
+   void substitute (ir_operand& operand);
+   ir_operand make_literal (typeref type, int value);
+   bool fold (ir_instr& instr);
+   void fold_block (uint32_t b);
+   ir_function& fn;
+   vector<ir_operand> replaced;   // what each folded temp became
+   bool changed;
+};
+
+// read what a folded temp became instead of the temp
+void folder::substitute (ir_operand& operand) {
+   switch (operand.kind) {
+      case IR_TEMP:
+         if (replaced[operand.id].kind != IR_NONE) {
+            operand = replaced[operand.id];
+            changed = true;
+         }
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         substitute (fn.refs[operand.id].base);
+         substitute (fn.refs[operand.id].index);
+         break;
+      default:
+         break;
+   }
+}
+
+ir_operand folder::make_literal (typeref type, int value) {
+   ir_const constant = {type, value, IR_NO_TEXT};
+   ir_operand operand = {IR_CONST, uint32_t (fn.consts.size()), 0};
+   fn.consts.push_back (constant);
+   return operand;
+}
+
+// fold instr, returning true if it is no longer needed
+bool folder::fold (ir_instr& instr) {
+   substitute (instr.a);
+   substitute (instr.b);
+   for (uint32_t a = 0; a < instr.arg_count; ++a)
+      substitute (fn.args[instr.first_arg + a]);
+   if (instr.dst.kind != IR_TEMP) {
+      substitute (instr.dst);
+      return false;
+   }
+   int x, y, value;
+   ir_operand result;
+   bool zero;
+   switch (instr.opcode) {
+      case IR_BINARY:
+         if (ir_literal (fn, instr.a, x) && ir_literal (fn, instr.b, y)) {
+            if (!ir_eval_binary (instr.op, instr.type, x, y, value)) {
+               if (y == 0 && (instr.op == '/' || instr.op == '%'))
+                  warn_division (instr);
+               return false;
+            }
+            replaced[instr.dst.id] = make_literal (instr.type, value);
+            return true;
+         }
+         if (!simplify (instr, fn, result, zero)) return false;
+         if (zero) {
+            replaced[instr.dst.id] = make_literal (instr.type, 0);
+            return true;
+         }
+         // a variable or element may change before the temp is read
+         if (result.kind == IR_TEMP || result.kind == IR_CONST) {
+            replaced[instr.dst.id] = result;
+            return true;
+         }
+         instr.opcode = IR_MOVE;
+         instr.a = result;
+         instr.b = IR_NO_OPERAND;
+         changed = true;
+         return false;
+      case IR_UNARY:
+         if (!ir_literal (fn, instr.a, x)
+             || !ir_eval_unary (instr.op, instr.type, x, value))
+            return false;
+         replaced[instr.dst.id] = make_literal (instr.type, value);
+         return true;
+      default:
+         return false;
+   }
+}
+
+void folder::fold_block (uint32_t b) {
+   ir_block& block = fn.blocks[b];
+   size_t kept = 0;
+   for (size_t i = 0; i < block.instrs.size(); ++i) {
+      if (fold (block.instrs[i])) {
+         changed = true;
+         continue;
+      }
+      if (kept != i) block.instrs[kept] = block.instrs[i];
+      ++kept;
+   }
+   block.instrs.resize (kept);
+   substitute (block.value);
+}
+
+bool folder::run() {
+   // a temp is written in a block dominating every read of it, so
+   // reverse postorder folds it first; unreachable blocks come last
+   vector<uint32_t> order;
+   ir_reverse_postorder (fn, order);
+   vector<char> seen (fn.blocks.size(), 0);
+   for (size_t i = 0; i < order.size(); ++i) seen[order[i]] = 1;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (!seen[b]) order.push_back (b);
+   }
+   for (size_t i = 0; i < order.size(); ++i) fold_block (order[i]);
+
+   // take the side of a constant branch that is always taken
+   bool pruned = false;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      ir_block& block = fn.blocks[b];
+      int cond;
+      if (block.exit != IR_BRANCH || !ir_literal (fn, block.value, cond))
+         continue;
+      uint32_t target = block.succ[cond ? 0 : 1];
+      block.exit = target == b + 1 ? IR_FALL : IR_JUMP;
+      block.value = IR_NO_OPERAND;
+      block.succ[0] = target;
+      block.succ[1] = IR_NO_BLOCK;
+      pruned = true;
+   }
+   if (pruned) {
+      ir_compute_cfg (fn);
+      ir_remove_unreachable (fn);
+      changed = true;
+   }
+   return changed;
+}
+
+bool ir_fold (ir_function& fn) {
+   return folder (fn).run();
+}
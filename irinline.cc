@@ -0,0 +1,385 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Inlining.  A call to a small function, or to one called from nowhere
+// else, is replaced by a copy of its body: the block is split at the
+// call, the parameters become locals given the arguments, and each
+// return stores the result and jumps to the rest of the block.  The
+// locals copied are mangled into block numbers no scope has used, so
+// the oil declares each once, as it would a nested block.  Functions
+// are done after those they call, so what is copied has already had
+// its own calls inlined.
+
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+// a function of this many instructions is inlined wherever it is called
+static const size_t INLINE_SMALL = 12;
+// and one called from only one place, up to this many
+static const size_t INLINE_ONCE = 80;
+// no caller is grown past this many
+static const size_t CALLER_LIMIT = 2000;
+
+typedef unordered_map<const symbol_record*, uint32_t> function_index;
+
+// the instructions of fn, and the exits that are more than a fall
+static size_t instr_count (const ir_function& fn) {
+   size_t count = 0;
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      count += fn.blocks[b].instrs.size();
+      if (fn.blocks[b].exit != IR_FALL) ++count;
+   }
+   return count;
+}
+
+// a function may be copied unless it calls itself, or gives some
+// caller no result by falling off its end
+static bool inlinable (const ir_function& fn) {
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         if (block.instrs[i].opcode == IR_CALL
+             && block.instrs[i].callee == fn.sym)
+            return false;
+      }
+      if (fn.result != TYPE_VOID && block.exit == IR_FALL
+          && block.succ[0] == IR_NO_BLOCK)
+         return false;
+   }
+   return true;
+}
+
+class inliner {
+public:
+   inliner (ir_function& caller, int& next_block);
+   void inline_call (uint32_t b, size_t i, const ir_function& callee);
+
+private:
+   ir_operand import (ir_operand operand);
+   uint32_t import_var (uint32_t var);
+   uint32_t local (stringid name, typeref type);
+   ir_operand temp (typeref type, char prefix);
+
+   ir_function& fn;
+   int& next_block;
+   int temp_count;
+   int label_count;
+   unordered_map<stringid, uint32_t> var_of;
+   // what the callee being copied has become in fn
+   const ir_function* callee;
+   vector<uint32_t> var_map;
+   vector<uint32_t> temp_map;
+   vector<pair<int, int> > block_map;   // block numbers, old to new
+};
+
+inliner::inliner (ir_function& caller, int& next_block) : fn(caller),
+      next_block(next_block), temp_count(0), label_count(0),
+      callee(NULL) {
+   for (size_t t = 0; t < fn.temps.size(); ++t) {
+      if (fn.temps[t].prefix != 0 && fn.temps[t].number >= temp_count)
+         temp_count = fn.temps[t].number + 1;
+   }
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      if (fn.blocks[b].label != NULL
+          && fn.blocks[b].label_number >= label_count)
+         label_count = fn.blocks[b].label_number + 1;
+   }
+   for (uint32_t v = 0; v < fn.vars.size(); ++v)
+      var_of[fn.vars[v].name] = v;
+}
+
+uint32_t inliner::local (stringid name, typeref type) {
+   ir_var var = {name, type, IR_LOCAL, true, false};
+   var_of[name] = fn.vars.size();
+   fn.vars.push_back (var);
+   return fn.vars.size() - 1;
+}
+
+ir_operand inliner::temp (typeref type, char prefix) {
+   ir_temp temp = {type, prefix, 0};
+   if (prefix != 0) temp.number = temp_count++;
+   ir_operand operand = {IR_TEMP, uint32_t (fn.temps.size()), 0};
+   fn.temps.push_back (temp);
+   return operand;
+}
+
+// a global is the caller's own, if it names it; a parameter or local,
+// _12_x, becomes _n_x for a block number n not used before
+uint32_t inliner::import_var (uint32_t v) {
+   if (var_map[v] != UINT32_MAX) return var_map[v];
+   const ir_var& var = callee->vars[v];
+   uint32_t mapped;
+   if (var.kind == IR_GLOBAL) {
+      unordered_map<stringid, uint32_t>::iterator found
+            = var_of.find (var.name);
+      if (found != var_of.end()) {
+         mapped = found->second;
+      }else {
+         ir_var global = var;
+         global.versioned = false;
+         var_of[var.name] = fn.vars.size();
+         fn.vars.push_back (global);
+         mapped = fn.vars.size() - 1;
+      }
+   }else {
+      const char* name = stringset_cstr (var.name);
+      char* id;
+      int block = strtol (name + 1, &id, 10);
+      size_t k = 0;
+      while (k < block_map.size() && block_map[k].first != block) ++k;
+      if (k == block_map.size())
+         block_map.push_back (make_pair (block, next_block++));
+      string mangled = mangle (block_map[k].second, id + 1);
+      mapped = local (intern_stringset (mangled.c_str()), var.type);
+   }
+   var_map[v] = mapped;
+   return mapped;
+}
+
+ir_operand inliner::import (ir_operand operand) {
+   switch (operand.kind) {
+      case IR_TEMP:
+         operand.id = temp_map[operand.id];
+         break;
+      case IR_VAR:
+         operand.id = import_var (operand.id);
+         break;
+      case IR_CONST:
+         fn.consts.push_back (callee->consts[operand.id]);
+         operand.id = fn.consts.size() - 1;
+         break;
+      case IR_INDEX:
+      case IR_FIELD: {
+         ir_ref ref = callee->refs[operand.id];
+         ref.base = import (ref.base);
+         ref.index = import (ref.index);
+         fn.refs.push_back (ref);
+         operand.id = fn.refs.size() - 1;
+         break;
+      }
+      default:
+         break;
+   }
+   operand.version = 0;
+   return operand;
+}
+
+// Block b becomes the head, up to the call, then the parameters are
+// given the arguments and the callee's blocks follow, and the rest of
+// b goes on in a labelled block after them.
+void inliner::inline_call (uint32_t b, size_t i, const ir_function& from) {
+   callee = &from;
+   var_map.assign (from.vars.size(), UINT32_MAX);
+   block_map.clear();
+   temp_map.resize (from.temps.size());
+   for (size_t t = 0; t < from.temps.size(); ++t) {
+      temp_map[t] = temp (from.temps[t].type, from.temps[t].prefix).id;
+   }
+   uint32_t copied = from.blocks.size();
+   uint32_t base = b + 1;
+   uint32_t rest = base + copied;
+
+   // the blocks after b move down past the copy
+   for (size_t k = 0; k < fn.blocks.size(); ++k) {
+      ir_block& block = fn.blocks[k];
+      for (int s = 0; s < 2; ++s) {
+         if (block.succ[s] != IR_NO_BLOCK && block.succ[s] > b)
+            block.succ[s] += copied + 1;
+      }
+   }
+   ir_block tail;
+   tail.label = "return";
+   tail.label_number = label_count++;
+   tail.exit = IR_FALL;
+   tail.value = IR_NO_OPERAND;
+   tail.succ[0] = tail.succ[1] = IR_NO_BLOCK;
+   tail.independent = false;
+   fn.blocks.insert (fn.blocks.begin() + base, copied + 1, tail);
+   ir_block& head = fn.blocks[b];
+   ir_instr call = head.instrs[i];
+   tail.instrs.assign (head.instrs.begin() + i + 1, head.instrs.end());
+   tail.exit = head.exit;
+   tail.value = head.value;
+   tail.succ[0] = head.succ[0];
+   tail.succ[1] = head.succ[1];
+   head.instrs.resize (i);
+   head.exit = IR_FALL;
+   head.value = IR_NO_OPERAND;
+   head.succ[0] = base;
+   head.succ[1] = IR_NO_BLOCK;
+
+   for (size_t p = 0; p < from.params.size(); ++p) {
+      ir_instr move = call;
+      move.opcode = IR_MOVE;
+      move.declares = true;
+      move.type = from.vars[from.params[p]].type;
+      move.dst.kind = IR_VAR;
+      move.dst.id = import_var (from.params[p]);
+      move.dst.version = 0;
+      move.a = fn.args[call.first_arg + p];
+      move.b = IR_NO_OPERAND;
+      move.first_arg = move.arg_count = 0;
+      move.callee = NULL;
+      head.instrs.push_back (move);
+   }
+
+   // the result goes straight to the call's temp if one return sets
+   // it, else through a local each return stores
+   size_t returns = 0;
+   for (size_t k = 0; k < copied; ++k) {
+      if (from.blocks[k].exit == IR_RETURN) ++returns;
+   }
+   ir_operand result = call.dst;
+   if (call.dst.kind != IR_NONE && returns > 1) {
+      string mangled = mangle (next_block++, "result");
+      result.kind = IR_VAR;
+      result.id = local (intern_stringset (mangled.c_str()),
+                         fn.type (call.dst));
+      result.version = 0;
+   }
+
+   bool declared = false;
+   int label_base = label_count;
+   for (uint32_t k = 0; k < copied; ++k) {
+      const ir_block& source = from.blocks[k];
+      ir_block& block = fn.blocks[base + k];
+      block.label = source.label;
+      block.label_number = source.label_number + label_base;
+      if (source.label != NULL && block.label_number >= label_count)
+         label_count = block.label_number + 1;
+      block.instrs.resize (source.instrs.size());
+      for (size_t j = 0; j < source.instrs.size(); ++j) {
+         ir_instr& instr = block.instrs[j];
+         instr = source.instrs[j];
+         instr.dst = import (instr.dst);
+         instr.a = import (instr.a);
+         instr.b = import (instr.b);
+         if (instr.arg_count != 0) {
+            uint32_t first = fn.args.size();
+            for (uint32_t a = 0; a < instr.arg_count; ++a) {
+               fn.args.push_back (
+                     import (from.args[source.instrs[j].first_arg + a]));
+            }
+            instr.first_arg = first;
+         }
+      }
+      block.exit = source.exit;
+      block.value = import (source.value);
+      for (int s = 0; s < 2; ++s) {
+         block.succ[s] = source.succ[s] == IR_NO_BLOCK
+                       ? IR_NO_BLOCK : source.succ[s] + base;
+      }
+      if (block.exit == IR_RETURN
+          || (block.exit == IR_FALL && block.succ[0] == IR_NO_BLOCK)) {
+         if (block.exit == IR_RETURN && result.kind != IR_NONE) {
+            ir_instr move = call;
+            move.opcode = IR_MOVE;
+            move.declares = result.kind == IR_VAR && !declared;
+            declared = true;
+            move.dst = fn.clone (result);
+            move.a = block.value;
+            move.b = IR_NO_OPERAND;
+            move.first_arg = move.arg_count = 0;
+            move.callee = NULL;
+            block.instrs.push_back (move);
+         }
+         block.exit = k + 1 == copied ? IR_FALL : IR_JUMP;
+         block.value = IR_NO_OPERAND;
+         block.succ[0] = rest;
+         block.succ[1] = IR_NO_BLOCK;
+      }
+   }
+
+   if (result.kind == IR_VAR) {
+      ir_instr move = call;
+      move.opcode = IR_MOVE;
+      move.declares = false;
+      move.a = result;
+      move.b = IR_NO_OPERAND;
+      move.first_arg = move.arg_count = 0;
+      move.callee = NULL;
+      tail.instrs.insert (tail.instrs.begin(), move);
+   }
+   fn.blocks[rest] = tail;
+   callee = NULL;
+}
+
+void ir_inline_calls (vector<ir_function>& functions, ir_function& main,
+                      const ir_call_graph& graph, int& next_block) {
+   function_index index_of;
+   for (size_t f = 0; f < functions.size(); ++f) {
+      if (!functions[f].blocks.empty())
+         index_of[functions[f].sym] = f;
+   }
+   // the places each function is called from
+   vector<uint32_t> sites (functions.size(), 0);
+   vector<ir_function*> callers;
+   for (size_t o = 0; o < graph.order.size(); ++o)
+      callers.push_back (&functions[graph.order[o]]);
+   callers.push_back (&main);
+   for (size_t c = 0; c < callers.size(); ++c) {
+      const ir_function& fn = *callers[c];
+      for (size_t b = 0; b < fn.blocks.size(); ++b) {
+         const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+         for (size_t i = 0; i < instrs.size(); ++i) {
+            if (instrs[i].opcode != IR_CALL) continue;
+            function_index::const_iterator found
+                  = index_of.find (instrs[i].callee);
+            if (found != index_of.end()) ++sites[found->second];
+         }
+      }
+   }
+
+   // whether each function done may be copied; one called before it
+   // is done never is
+   vector<char> candidate (functions.size(), 0);
+   for (size_t c = 0; c < callers.size(); ++c) {
+      ir_function& fn = *callers[c];
+      // what the builder left unreachable is neither counted nor copied
+      if (ir_remove_unreachable (fn)) fn.invalidate();
+      inliner copier (fn, next_block);
+      size_t size = instr_count (fn);
+      unsigned int inlined = 0;
+      for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+         for (size_t i = 0; i < fn.blocks[b].instrs.size(); ++i) {
+            const ir_instr& instr = fn.blocks[b].instrs[i];
+            if (instr.opcode != IR_CALL) continue;
+            function_index::const_iterator found
+                  = index_of.find (instr.callee);
+            if (found == index_of.end() || !candidate[found->second])
+               continue;
+            const ir_function& callee = functions[found->second];
+            size_t cost = instr_count (callee);
+            if (cost > (sites[found->second] == 1 ? INLINE_ONCE
+                                                  : INLINE_SMALL)
+                || size + cost > CALLER_LIMIT)
+               continue;
+            copier.inline_call (b, i, callee);
+            size += cost;
+            ++inlined;
+            // on with the rest of the block, after the copy
+            b += callee.blocks.size();
+            break;
+         }
+      }
+      if (inlined != 0) {
+         ir_compute_cfg (fn);
+         fn.invalidate();
+      }
+      if (c < graph.order.size()) {
+         candidate[graph.order[c]] = inlinable (fn)
+               && find (graph.forward.begin(), graph.forward.end(),
+                        graph.order[c]) == graph.forward.end();
+      }
+      if (is_debugflag ('o')) {
+         eprintf ("inline: %s: %u calls inlined\n",
+                  stringset_cstr (fn.name), inlined);
+      }
+   }
+}
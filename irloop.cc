@@ -0,0 +1,749 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Loop optimization.  Every loop gets a preheader, a block before its
+// header that the ways into the loop, but not around it, now go
+// through.  From the innermost loop out, what each computes the same
+// way on every trip is moved into the preheader: arithmetic on values
+// the loop does not change anywhere, and loads from memory the loop
+// neither stores to nor calls anything that might, but only those made
+// wherever the loop is left, so that none is made the loop would not
+// have made.  A global a loop without calls writes is kept in a local
+// while in it, copied in by the preheader and back out wherever the
+// loop is left.  Then an array indexed by a variable the loop steps by
+// a fixed amount is walked by a pointer stepped with it, so a[i]
+// becomes p[0] with p set to a + i in the preheader.
+//
+// Last, where each array walked is memory from its own xcalloc that
+// nothing else in the loop reaches while it is written, its pointer
+// may be declared restrict for the loop.  If every store in the loop
+// is through such a pointer, no trip writes what another touches, and
+// the loop is marked for the oil to say so.
+
+#include <algorithm>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+struct natural_loop {
+   uint32_t header;
+   uint32_t preheader;
+   vector<uint32_t> blocks;      // in output order, the header first
+   vector<char> in;              // by block
+   vector<uint32_t> latches;     // blocks jumping back to the header
+   vector<uint32_t> exiting;     // blocks going out of the loop
+};
+
+// a variable the loop steps by the same amount each time it is written
+struct induction {
+   uint32_t var;
+   uint32_t block;               // where it is written
+   size_t instr;
+   int op;                       // + or -
+   ir_operand step;
+   vector<ir_instr> steps;       // of the pointers walked with it
+};
+
+// the xcalloc a pointer came from, NO_ORIGIN if not known
+const uint32_t NO_ORIGIN = UINT32_MAX;
+
+// a pointer walking an array with an induction variable
+struct walked {
+   ir_operand array;
+   ir_operand pointer;
+   uint32_t iv;
+   uint32_t origin;
+   bool strides;                 // by a literal other than 0
+};
+
+// a read or write of memory, through a walker or not
+struct access {
+   uint32_t origin;
+   int walker;                   // -1 if not through one of the loop
+   bool store;
+};
+
+static bool later (const induction& x, const induction& y) {
+   return x.block != y.block ? x.block > y.block : x.instr > y.instr;
+}
+
+static bool smaller (const natural_loop& x, const natural_loop& y) {
+   return x.blocks.size() < y.blocks.size();
+}
+
+class loop_optimizer {
+public:
+   loop_optimizer (ir_function& fn);
+   bool run();
+
+private:
+   bool find_loops();
+   void insert_preheaders();
+   void find_origins();
+   uint32_t origin_of (ir_operand operand) const;
+   void summarize (const natural_loop& l);
+   bool invariant (ir_operand operand, bool& loads) const;
+   bool hoistable (const ir_instr& instr, bool& loads) const;
+   void hoist (const natural_loop& l);
+   bool every_trip (const natural_loop& l, uint32_t b) const;
+   bool find_step (uint32_t var, induction& iv) const;
+   void find_indexed (ir_operand operand, vector<uint32_t>& refs) const;
+   stringid fresh_name (uint32_t var, const char* suffix) const;
+   void replace_var (ir_operand& operand, uint32_t var, uint32_t local);
+   void promote (const natural_loop& l);
+   void reduce (const natural_loop& l);
+   void find_accesses (ir_operand operand, bool store,
+                       vector<access>& accesses) const;
+   void qualify (const natural_loop& l);
+
+   ir_function& fn;
+   vector<natural_loop> loops;
+   vector<uint32_t> reverse_postorder;
+   vector<uint32_t> rank;        // by block, in reverse_postorder
+   int temp_count;
+   int label_count;
+   uint32_t zero;                // the constant 0, UINT32_MAX until made
+   vector<uint32_t> origin;      // by temp
+   vector<uint32_t> var_origin;  // by variable, of the walkers
+   // of the loop being optimized
+   bool stores;                  // to memory, by a reference or a call
+   bool calls;
+   vector<int> writes;           // by variable
+   vector<pair<uint32_t, size_t> > written_at;  // block and instruction
+   vector<int> induction_of;     // by variable, -1 if it is not one
+   vector<char> defined_in;      // by temp, in the loop
+   vector<walked> walkers;
+   unsigned int hoisted;
+   unsigned int promoted;
+   unsigned int reduced;
+   unsigned int restricted;
+};
+
+loop_optimizer::loop_optimizer (ir_function& fn) : fn(fn), temp_count(0),
+      label_count(0), zero(UINT32_MAX), stores(false), calls(false),
+      hoisted(0), promoted(0), reduced(0), restricted(0) {
+   for (size_t t = 0; t < fn.temps.size(); ++t) {
+      if (fn.temps[t].prefix != 0 && fn.temps[t].number >= temp_count)
+         temp_count = fn.temps[t].number + 1;
+   }
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      if (fn.blocks[b].label != NULL
+          && fn.blocks[b].label_number >= label_count)
+         label_count = fn.blocks[b].label_number + 1;
+   }
+}
+
+// A back edge goes to a block dominating where it comes from, and the
+// loop is every block reaching the edge without passing the header.
+// Only loops written with the header first are taken, so that what
+// the preheader declares comes before its uses in the oil.
+bool loop_optimizer::find_loops() {
+   ir_compute_dominators (fn);
+   vector<int> loop_of (fn.blocks.size(), -1);
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      uint32_t succ[2];
+      int nsucc = ir_successors (fn, b, succ);
+      for (int s = 0; s < nsucc; ++s) {
+         uint32_t h = succ[s];
+         if (!ir_dominates (fn, h, b)) continue;
+         if (loop_of[h] < 0) {
+            loop_of[h] = loops.size();
+            loops.push_back (natural_loop());
+            loops.back().header = h;
+            loops.back().in.assign (fn.blocks.size(), 0);
+            loops.back().in[h] = 1;
+         }
+         natural_loop& l = loops[loop_of[h]];
+         l.latches.push_back (b);
+         vector<uint32_t> work (1, b);
+         while (!work.empty()) {
+            uint32_t x = work.back();
+            work.pop_back();
+            if (l.in[x] || fn.idom[x] == IR_NO_BLOCK) continue;
+            l.in[x] = 1;
+            const vector<uint32_t>& preds = fn.blocks[x].preds;
+            for (size_t p = 0; p < preds.size(); ++p) work.push_back (preds[p]);
+         }
+      }
+   }
+   size_t kept = 0;
+   for (size_t k = 0; k < loops.size(); ++k) {
+      natural_loop& l = loops[k];
+      bool header_first = true;
+      for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+         if (!l.in[b]) continue;
+         if (b < l.header) header_first = false;
+         l.blocks.push_back (b);
+      }
+      if (!header_first) continue;
+      if (kept != k) loops[kept] = std::move (l);
+      ++kept;
+   }
+   loops.resize (kept);
+   return !loops.empty();
+}
+
+// The preheader of each header goes just before it, so what fell into
+// the header falls into the preheader, which falls into the header.
+void loop_optimizer::insert_preheaders() {
+   size_t nblocks = fn.blocks.size();
+   vector<int> header_of (nblocks, -1);
+   for (size_t k = 0; k < loops.size(); ++k) header_of[loops[k].header] = k;
+   vector<uint32_t> moved (nblocks);
+   uint32_t added = 0;
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      if (header_of[b] >= 0) ++added;
+      moved[b] = b + added;
+   }
+   vector<ir_block> blocks;
+   blocks.reserve (nblocks + loops.size());
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      ir_block& block = fn.blocks[b];
+      for (int s = 0; s < 2; ++s) {
+         uint32_t target = block.succ[s];
+         if (target == IR_NO_BLOCK) continue;
+         block.succ[s] = moved[target];
+         // only the way in goes through the preheader
+         if (header_of[target] >= 0 && !loops[header_of[target]].in[b])
+            --block.succ[s];
+      }
+      if (header_of[b] >= 0) {
+         ir_block preheader;
+         preheader.label = "preheader";
+         preheader.label_number = label_count++;
+         preheader.exit = IR_FALL;
+         preheader.value = IR_NO_OPERAND;
+         preheader.succ[0] = moved[b];
+         preheader.succ[1] = IR_NO_BLOCK;
+         preheader.independent = false;
+         blocks.push_back (preheader);
+      }
+      blocks.push_back (std::move (block));
+   }
+   fn.blocks.swap (blocks);
+   ir_compute_cfg (fn);
+   ir_compute_dominators (fn);
+   ir_reverse_postorder (fn, reverse_postorder);
+   rank.assign (fn.blocks.size(), 0);
+   for (size_t i = 0; i < reverse_postorder.size(); ++i)
+      rank[reverse_postorder[i]] = i;
+
+   // a loop holds the preheaders of the loops in it
+   for (size_t k = 0; k < loops.size(); ++k) {
+      natural_loop& l = loops[k];
+      vector<uint32_t> old_blocks;
+      old_blocks.swap (l.blocks);
+      l.in.assign (fn.blocks.size(), 0);
+      for (size_t j = 0; j < old_blocks.size(); ++j) {
+         uint32_t b = moved[old_blocks[j]];
+         if (header_of[old_blocks[j]] >= 0 && old_blocks[j] != l.header) {
+            l.in[b - 1] = 1;
+            l.blocks.push_back (b - 1);
+         }
+         l.in[b] = 1;
+         l.blocks.push_back (b);
+      }
+      for (size_t j = 0; j < l.latches.size(); ++j)
+         l.latches[j] = moved[l.latches[j]];
+      l.header = moved[l.header];
+      l.preheader = l.header - 1;
+      for (size_t j = 0; j < l.blocks.size(); ++j) {
+         uint32_t succ[2];
+         int nsucc = ir_successors (fn, l.blocks[j], succ);
+         for (int s = 0; s < nsucc; ++s) {
+            if (!l.in[succ[s]]) {
+               l.exiting.push_back (l.blocks[j]);
+               break;
+            }
+         }
+      }
+   }
+}
+
+// Temps are written before they are read along every way, so in
+// reverse postorder a copy comes after what it copies.
+void loop_optimizer::find_origins() {
+   origin.assign (fn.temps.size(), NO_ORIGIN);
+   for (size_t j = 0; j < reverse_postorder.size(); ++j) {
+      const vector<ir_instr>& instrs = fn.blocks[reverse_postorder[j]].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         const ir_instr& instr = instrs[i];
+         if (instr.dst.kind != IR_TEMP) continue;
+         if (instr.opcode == IR_ALLOC)
+            origin[instr.dst.id] = instr.dst.id;
+         else if (instr.opcode == IR_MOVE)
+            origin[instr.dst.id] = origin_of (instr.a);
+      }
+   }
+}
+
+uint32_t loop_optimizer::origin_of (ir_operand operand) const {
+   if (operand.kind == IR_TEMP && operand.id < origin.size())
+      return origin[operand.id];
+   if (operand.kind == IR_VAR && operand.id < var_origin.size())
+      return var_origin[operand.id];
+   return NO_ORIGIN;
+}
+
+// what the loop writes: its variables, temps and memory
+void loop_optimizer::summarize (const natural_loop& l) {
+   stores = calls = false;
+   writes.assign (fn.vars.size(), 0);
+   written_at.resize (fn.vars.size());
+   defined_in.assign (fn.temps.size(), 0);
+   for (size_t j = 0; j < l.blocks.size(); ++j) {
+      const vector<ir_instr>& instrs = fn.blocks[l.blocks[j]].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         const ir_instr& instr = instrs[i];
+         if (instr.opcode == IR_CALL) calls = stores = true;
+         switch (instr.dst.kind) {
+            case IR_TEMP:
+               defined_in[instr.dst.id] = 1;
+               break;
+            case IR_VAR:
+               ++writes[instr.dst.id];
+               written_at[instr.dst.id] = make_pair (l.blocks[j], i);
+               break;
+            case IR_INDEX:
+            case IR_FIELD: stores = true; break;
+            default:       break;
+         }
+      }
+   }
+}
+
+// operand has the same value everywhere in the loop; loads is set if
+// reading it reads memory
+bool loop_optimizer::invariant (ir_operand operand, bool& loads) const {
+   switch (operand.kind) {
+      case IR_NONE:
+      case IR_CONST:
+         return true;
+      case IR_TEMP:
+         return !defined_in[operand.id];
+      case IR_VAR:
+         return writes[operand.id] == 0
+             && (!calls || fn.vars[operand.id].kind != IR_GLOBAL);
+      case IR_INDEX:
+      case IR_FIELD:
+         loads = true;
+         return !stores && invariant (fn.refs[operand.id].base, loads)
+             && invariant (fn.refs[operand.id].index, loads);
+      default:
+         return false;
+   }
+}
+
+// a temp written from invariant operands, that cannot trap but for a
+// load
+bool loop_optimizer::hoistable (const ir_instr& instr, bool& loads) const {
+   if (instr.dst.kind != IR_TEMP) return false;
+   int divisor;
+   switch (instr.opcode) {
+      case IR_MOVE:
+      case IR_UNARY:
+         break;
+      case IR_BINARY:
+         if ((instr.op == '/' || instr.op == '%')
+             && (!ir_literal (fn, instr.b, divisor) || divisor == 0))
+            return false;
+         break;
+      default:
+         return false;
+   }
+   return invariant (instr.a, loads) && invariant (instr.b, loads);
+}
+
+// is b on every way through the loop and out of it
+bool loop_optimizer::every_trip (const natural_loop& l, uint32_t b) const {
+   for (size_t k = 0; k < l.latches.size(); ++k) {
+      if (!ir_dominates (fn, b, l.latches[k])) return false;
+   }
+   for (size_t k = 0; k < l.exiting.size(); ++k) {
+      if (!ir_dominates (fn, b, l.exiting[k])) return false;
+   }
+   return true;
+}
+
+// A temp is written where it dominates its reads, so with the blocks
+// in reverse postorder what an instruction reads is hoisted before it
+// is looked at.
+void loop_optimizer::hoist (const natural_loop& l) {
+   vector<ir_instr>& preheader = fn.blocks[l.preheader].instrs;
+   vector<uint32_t> order (l.blocks);
+   for (size_t j = 0; j < order.size(); ++j) order[j] = rank[order[j]];
+   sort (order.begin(), order.end());
+   for (size_t j = 0; j < order.size(); ++j) {
+      uint32_t b = reverse_postorder[order[j]];
+      vector<ir_instr>& instrs = fn.blocks[b].instrs;
+      enum { UNKNOWN, NO, YES } may_load = UNKNOWN;
+      size_t kept = 0;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         bool loads = false;
+         if (hoistable (instrs[i], loads)) {
+            if (loads && may_load == UNKNOWN)
+               may_load = every_trip (l, b) ? YES : NO;
+            if (!loads || may_load == YES) {
+               defined_in[instrs[i].dst.id] = 0;
+               preheader.push_back (instrs[i]);
+               ++hoisted;
+               continue;
+            }
+         }
+         if (kept != i) instrs[kept] = instrs[i];
+         ++kept;
+      }
+      instrs.resize (kept);
+   }
+}
+
+// The one write to var in the loop adds or subtracts an invariant
+// step, directly or through a temp.
+bool loop_optimizer::find_step (uint32_t var, induction& iv) const {
+   if (writes[var] != 1 || fn.vars[var].type != TYPE_INT
+       || (calls && fn.vars[var].kind == IR_GLOBAL))
+      return false;
+   iv.var = var;
+   iv.block = written_at[var].first;
+   iv.instr = written_at[var].second;
+   const vector<ir_instr>& instrs = fn.blocks[iv.block].instrs;
+   const ir_instr& def = instrs[iv.instr];
+   const ir_instr* sum = NULL;
+   if (def.opcode == IR_BINARY) {
+      sum = &def;
+   }else if (def.opcode == IR_MOVE && def.a.kind == IR_TEMP) {
+      for (size_t k = iv.instr; k-- > 0; ) {
+         if (instrs[k].dst.kind == IR_TEMP && instrs[k].dst.id == def.a.id) {
+            if (instrs[k].opcode == IR_BINARY) sum = &instrs[k];
+            break;
+         }
+      }
+   }
+   if (sum == NULL || (sum->op != '+' && sum->op != '-')) return false;
+   if (sum->a.kind == IR_VAR && sum->a.id == var) {
+      iv.step = sum->b;
+   }else if (sum->op == '+' && sum->b.kind == IR_VAR && sum->b.id == var) {
+      iv.step = sum->a;
+   }else {
+      return false;
+   }
+   iv.op = sum->op;
+   bool loads = false;
+   return invariant (iv.step, loads) && !loads;
+}
+
+// the element references in operand indexed by an induction
+// variable, from an invariant variable or temp
+void loop_optimizer::find_indexed (ir_operand operand,
+                                   vector<uint32_t>& refs) const {
+   if (operand.kind != IR_INDEX && operand.kind != IR_FIELD) return;
+   const ir_ref& ref = fn.refs[operand.id];
+   find_indexed (ref.base, refs);
+   find_indexed (ref.index, refs);
+   bool loads = false;
+   if (operand.kind == IR_INDEX && ref.index.kind == IR_VAR
+       && induction_of[ref.index.id] >= 0
+       && (ref.base.kind == IR_VAR || ref.base.kind == IR_TEMP)
+       && invariant (ref.base, loads))
+      refs.push_back (operand.id);
+}
+
+// var's name with suffix after it, and _ after that until no variable
+// of fn, nor function it calls, has it
+stringid loop_optimizer::fresh_name (uint32_t var, const char* suffix) const {
+   string name = stringset_cstr (fn.vars[var].name);
+   name += suffix;
+   for (bool taken = true; taken; ) {
+      taken = false;
+      for (size_t v = 0; v < fn.vars.size(); ++v) {
+         if (stringset_cstr (fn.vars[v].name) == name) taken = true;
+      }
+      for (size_t b = 0; b < fn.blocks.size() && !taken; ++b) {
+         const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+         for (size_t i = 0; i < instrs.size(); ++i) {
+            if (instrs[i].callee != NULL && instrs[i].callee->oil_name == name)
+               taken = true;
+         }
+      }
+      if (taken) name += "_";
+   }
+   return intern_stringset (name.c_str());
+}
+
+void loop_optimizer::replace_var (ir_operand& operand, uint32_t var,
+                                  uint32_t local) {
+   switch (operand.kind) {
+      case IR_VAR:
+         if (operand.id == var) {
+            operand.id = local;
+            operand.version = 0;
+         }
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         replace_var (fn.refs[operand.id].base, var, local);
+         replace_var (fn.refs[operand.id].index, var, local);
+         break;
+      default:
+         break;
+   }
+}
+
+// Only a call could see a global change, and memory is never a
+// global, so the loop may keep each global it writes in a local.  The
+// blocks it goes out to must be reached from nowhere else, so that
+// they can copy the locals back.
+void loop_optimizer::promote (const natural_loop& l) {
+   if (calls) return;
+   vector<uint32_t> exits;
+   for (size_t j = 0; j < l.exiting.size(); ++j) {
+      uint32_t succ[2];
+      int nsucc = ir_successors (fn, l.exiting[j], succ);
+      for (int s = 0; s < nsucc; ++s) {
+         if (l.in[succ[s]]) continue;
+         const vector<uint32_t>& preds = fn.blocks[succ[s]].preds;
+         for (size_t p = 0; p < preds.size(); ++p) {
+            if (!l.in[preds[p]]) return;
+         }
+         if (find (exits.begin(), exits.end(), succ[s]) == exits.end())
+            exits.push_back (succ[s]);
+      }
+   }
+   size_t nvars = fn.vars.size();
+   for (uint32_t var = 0; var < nvars; ++var) {
+      if (writes[var] == 0 || fn.vars[var].kind != IR_GLOBAL) continue;
+      ir_var copy = {fresh_name (var, "_local"), fn.vars[var].type, IR_LOCAL,
+                     true, false};
+      uint32_t local = fn.vars.size();
+      fn.vars.push_back (copy);
+      for (size_t j = 0; j < l.blocks.size(); ++j) {
+         ir_block& block = fn.blocks[l.blocks[j]];
+         for (size_t i = 0; i < block.instrs.size(); ++i) {
+            ir_instr& instr = block.instrs[i];
+            replace_var (instr.dst, var, local);
+            replace_var (instr.a, var, local);
+            replace_var (instr.b, var, local);
+            for (uint32_t a = 0; a < instr.arg_count; ++a)
+               replace_var (fn.args[instr.first_arg + a], var, local);
+         }
+         replace_var (block.value, var, local);
+      }
+      const ir_instr& where = fn.blocks[written_at[var].first]
+                              .instrs[written_at[var].second];
+      ir_instr load = where;
+      load.opcode = IR_MOVE;
+      load.declares = true;
+      load.op = 0;
+      load.type = copy.type;
+      load.dst.kind = IR_VAR;
+      load.dst.id = local;
+      load.dst.version = 0;
+      load.a = load.dst;
+      load.a.id = var;
+      load.b = IR_NO_OPERAND;
+      load.first_arg = load.arg_count = 0;
+      load.callee = NULL;
+      fn.blocks[l.preheader].instrs.push_back (load);
+      ir_instr store = load;
+      store.declares = false;
+      swap (store.dst, store.a);
+      for (size_t e = 0; e < exits.size(); ++e) {
+         vector<ir_instr>& instrs = fn.blocks[exits[e]].instrs;
+         instrs.insert (instrs.begin(), store);
+      }
+      ++promoted;
+   }
+   if (fn.vars.size() != nvars) summarize (l);
+}
+
+// Each array the loop indexes by an induction variable gets a pointer
+// to the element, set in the preheader and stepped just after the
+// variable is.
+void loop_optimizer::reduce (const natural_loop& l) {
+   walkers.clear();
+   vector<induction> ivs;
+   induction_of.assign (fn.vars.size(), -1);
+   for (uint32_t var = 0; var < fn.vars.size(); ++var) {
+      induction iv;
+      if (!find_step (var, iv)) continue;
+      induction_of[var] = ivs.size();
+      ivs.push_back (iv);
+   }
+   if (ivs.empty()) return;
+   vector<uint32_t> refs;
+   for (size_t j = 0; j < l.blocks.size(); ++j) {
+      const ir_block& block = fn.blocks[l.blocks[j]];
+      for (size_t k = 0; k < block.instrs.size(); ++k) {
+         const ir_instr& instr = block.instrs[k];
+         find_indexed (instr.dst, refs);
+         find_indexed (instr.a, refs);
+         find_indexed (instr.b, refs);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            find_indexed (fn.args[instr.first_arg + a], refs);
+      }
+      find_indexed (block.value, refs);
+   }
+   if (refs.empty()) return;
+   if (zero == UINT32_MAX) {
+      ir_const constant = {TYPE_INT, 0, IR_NO_TEXT};
+      zero = fn.consts.size();
+      fn.consts.push_back (constant);
+   }
+   ir_operand offset = {IR_CONST, zero, 0};
+
+   for (size_t r = 0; r < refs.size(); ++r) {
+      ir_ref& ref = fn.refs[refs[r]];
+      uint32_t n = induction_of[ref.index.id];
+      induction& iv = ivs[n];
+      size_t w = 0;
+      while (w < walkers.size()
+             && (walkers[w].iv != n || walkers[w].array.kind != ref.base.kind
+                 || walkers[w].array.id != ref.base.id))
+         ++w;
+      if (w == walkers.size()) {
+         typeref type = fn.type (ref.base);
+         ir_var pointer = {fresh_name (iv.var, "_ptr"), type, IR_LOCAL, true,
+                           false};
+         int step;
+         walked walker = {ref.base, {IR_VAR, uint32_t (fn.vars.size()), 0},
+                          n, origin_of (ref.base),
+                          ir_literal (fn, iv.step, step) && step != 0};
+         fn.vars.push_back (pointer);
+         var_origin.resize (fn.vars.size(), NO_ORIGIN);
+         var_origin[walker.pointer.id] = walker.origin;
+         ir_temp temp = {type, ir_temp_prefix (type), 0};
+         if (temp.prefix != 0) temp.number = temp_count++;
+         ir_operand start = {IR_TEMP, uint32_t (fn.temps.size()), 0};
+         fn.temps.push_back (temp);
+
+         ir_instr instr = fn.blocks[iv.block].instrs[iv.instr];
+         instr.opcode = IR_BINARY;
+         instr.declares = false;
+         instr.op = '+';
+         instr.type = type;
+         instr.dst = start;
+         instr.a = ref.base;
+         instr.b = ref.index;
+         instr.first_arg = instr.arg_count = 0;
+         instr.callee = NULL;
+         fn.blocks[l.preheader].instrs.push_back (instr);
+         instr.opcode = IR_MOVE;
+         instr.declares = true;
+         instr.dst = walker.pointer;
+         instr.a = start;
+         instr.b = IR_NO_OPERAND;
+         fn.blocks[l.preheader].instrs.push_back (instr);
+         instr.opcode = IR_BINARY;
+         instr.declares = false;
+         instr.op = iv.op;
+         instr.a = walker.pointer;
+         instr.b = iv.step;
+         iv.steps.push_back (instr);
+         walkers.push_back (walker);
+         ++reduced;
+      }
+      ref.base = walkers[w].pointer;
+      ref.index = offset;
+   }
+   // later in a block first, so the places found stay put
+   sort (ivs.begin(), ivs.end(), later);
+   for (size_t n = 0; n < ivs.size(); ++n) {
+      vector<ir_instr>& instrs = fn.blocks[ivs[n].block].instrs;
+      instrs.insert (instrs.begin() + ivs[n].instr + 1,
+                     ivs[n].steps.begin(), ivs[n].steps.end());
+   }
+}
+
+// the memory operand reads or writes, the reference itself last
+void loop_optimizer::find_accesses (ir_operand operand, bool store,
+                                    vector<access>& accesses) const {
+   if (operand.kind != IR_INDEX && operand.kind != IR_FIELD) return;
+   const ir_ref& ref = fn.refs[operand.id];
+   find_accesses (ref.base, false, accesses);
+   find_accesses (ref.index, false, accesses);
+   access made = {origin_of (ref.base), -1, store};
+   for (size_t w = 0; w < walkers.size(); ++w) {
+      if (ref.base.kind == IR_VAR && ref.base.id == walkers[w].pointer.id)
+         made.walker = w;
+   }
+   accesses.push_back (made);
+}
+
+// Everything from the header to the last block of the loop is looked
+// at, since the oil puts what the loop leaves through there too.
+void loop_optimizer::qualify (const natural_loop& l) {
+   if (walkers.empty()) return;
+   vector<access> accesses;
+   for (uint32_t b = l.header; b <= l.blocks.back(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         if (instr.opcode == IR_CALL) return;
+         find_accesses (instr.dst, true, accesses);
+         find_accesses (instr.a, false, accesses);
+         find_accesses (instr.b, false, accesses);
+      }
+      find_accesses (block.value, false, accesses);
+   }
+   vector<char> writing (walkers.size(), 0);
+   for (size_t k = 0; k < accesses.size(); ++k) {
+      if (accesses[k].walker >= 0 && accesses[k].store)
+         writing[accesses[k].walker] = 1;
+   }
+   vector<char> alone (walkers.size(), 1);
+   for (size_t k = 0; k < accesses.size(); ++k) {
+      const access& other = accesses[k];
+      for (size_t w = 0; w < walkers.size(); ++w) {
+         if (other.walker == int (w) || (!other.store && !writing[w]))
+            continue;
+         if (other.origin == NO_ORIGIN || walkers[w].origin == NO_ORIGIN
+             || other.origin == walkers[w].origin)
+            alone[w] = 0;
+      }
+   }
+   bool independent = true;
+   for (size_t k = 0; k < accesses.size(); ++k) {
+      int w = accesses[k].walker;
+      if (accesses[k].store && (w < 0 || !alone[w] || !walkers[w].strides))
+         independent = false;
+   }
+   for (size_t var = 0; var < writes.size(); ++var) {
+      if (writes[var] != 0 && fn.vars[var].kind == IR_GLOBAL)
+         independent = false;
+   }
+   for (size_t w = 0; w < walkers.size(); ++w) {
+      if (!alone[w]) continue;
+      fn.vars[walkers[w].pointer.id].restricted = true;
+      ++restricted;
+   }
+   fn.blocks[l.header].independent = independent;
+}
+
+bool loop_optimizer::run() {
+   if (fn.blocks.empty()) return false;
+   ir_compute_cfg (fn);
+   if (!find_loops()) return false;
+   insert_preheaders();
+   find_origins();
+   stable_sort (loops.begin(), loops.end(), smaller);
+   for (size_t k = 0; k < loops.size(); ++k) {
+      summarize (loops[k]);
+      hoist (loops[k]);
+      promote (loops[k]);
+      reduce (loops[k]);
+      qualify (loops[k]);
+   }
+   if (is_debugflag ('o')) {
+      eprintf ("loops: %s: %zu loops, %u hoisted, %u globals kept in "
+               "locals, %u arrays walked, %u restrict\n",
+               stringset_cstr (fn.name), loops.size(), hoisted, promoted,
+               reduced, restricted);
+   }
+   return true;
+}
+
+bool ir_optimize_loops (ir_function& fn) {
+   return loop_optimizer (fn).run();
+}
@@ -0,0 +1,112 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The passes run in the order listed, each on one function at a time.
+// The local ones run as each function is built; the rest once the
+// whole program is, so that they may use what is known of the globals.
+// A pass that wants ssa form says so and gets it built first; a pass
+// that changes the code marks ssa form out of date.  The time each
+// pass takes is summed over every function and thread.
+
+#include <atomic>
+#include <ctime>
+
+#include "irpass.h"
+#include "auxlib.h"
+
+using namespace std;
+
+static bool run_ssa (ir_function& fn) {
+   ir_build_ssa (fn);
+   return false;
+}
+
+// ssa is built on demand as well, and timed as a pass of its own
+static const ir_pass ssa_pass = {"ssa", run_ssa, false, false};
+
+static bool run_verify (ir_function& fn) {
+   ir_verify (fn);
+   return false;
+}
+
+static const ir_pass pipeline[] = {
+   {"fold", ir_fold, false, true},
+   {"tailcall", ir_eliminate_tail_calls, false, true},
+   {"cse", ir_eliminate_common, true, false},
+   {"propagate", ir_propagate, true, false},
+   {"loops", ir_optimize_loops, false, false},
+   {"dce", ir_eliminate_dead, false, false},
+   {"verify", run_verify, false, false},
+};
+
+static const size_t PIPELINE_SIZE = sizeof pipeline / sizeof pipeline[0];
+
+struct pass_stats {
+   atomic<uint64_t> nanoseconds;
+   atomic<uint64_t> runs;
+   atomic<uint64_t> changes;
+};
+
+// by pipeline position, then ssa
+static pass_stats stats[PIPELINE_SIZE + 1];
+
+static uint64_t now (void) {
+   timespec clock;
+   clock_gettime (CLOCK_MONOTONIC, &clock);
+   return clock.tv_sec * 1000000000ull + clock.tv_nsec;
+}
+
+static void timed (const ir_pass& pass, pass_stats& stat, ir_function& fn) {
+   uint64_t start = now();
+   bool changed = pass.run (fn);
+   stat.nanoseconds += now() - start;
+   ++stat.runs;
+   if (changed) {
+      ++stat.changes;
+      fn.invalidate();
+   }
+}
+
+static void run_stage (ir_function& fn, bool local) {
+   for (size_t p = 0; p < PIPELINE_SIZE; ++p) {
+      const ir_pass& pass = pipeline[p];
+      if (pass.local != local) continue;
+      if (pass.needs_ssa && !fn.ssa)
+         timed (ssa_pass, stats[PIPELINE_SIZE], fn);
+      timed (pass, stats[p], fn);
+   }
+}
+
+void irpass_run_local (ir_function& fn) {
+   run_stage (fn, true);
+}
+
+void irpass_run (ir_function& fn) {
+   run_stage (fn, false);
+   // the dump shows the versions as well
+   if (is_debugflag ('r')) {
+      if (!fn.ssa) timed (ssa_pass, stats[PIPELINE_SIZE], fn);
+      ir_dump (get_messagefile(), fn);
+   }
+}
+
+void irpass_report (FILE* file) {
+   fprintf (file, "%-12s %8s %8s %10s\n", "pass", "runs", "changed",
+            "ms");
+   for (size_t p = 0; p <= PIPELINE_SIZE; ++p) {
+      const char* name = p < PIPELINE_SIZE ? pipeline[p].name
+                                           : ssa_pass.name;
+      fprintf (file, "%-12s %8lu %8lu %10.3f\n", name,
+               (unsigned long) stats[p].runs.load(),
+               (unsigned long) stats[p].changes.load(),
+               stats[p].nanoseconds.load() / 1e6);
+   }
+}
+
+void irpass_reset (void) {
+   for (size_t p = 0; p <= PIPELINE_SIZE; ++p) {
+      stats[p].nanoseconds = 0;
+      stats[p].runs = 0;
+      stats[p].changes = 0;
+   }
+}
@@ -0,0 +1,71 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* passes over the ir of each function, and the manager running them */
+
+#ifndef __IRPASS_H__
+#define __IRPASS_H__
+
+#include <cstdio>
+
+#include "ir.h"
+
+// a pass changes the code of one function, returning true if it did
+typedef bool (*ir_pass_fn) (ir_function& fn);
+
+struct ir_pass {
+   const char* name;
+   ir_pass_fn run;
+   bool needs_ssa;        // build ssa form first if it is out of date
+   bool local;            // needs nothing but the function itself
+};
+
+// the passes, each returning true if it changed fn
+bool ir_fold (ir_function& fn);          // irfold.cc
+bool ir_eliminate_tail_calls (ir_function& fn); // irtail.cc
+bool ir_propagate (ir_function& fn);     // irprop.cc
+bool ir_eliminate_common (ir_function& fn); // ircse.cc
+bool ir_optimize_loops (ir_function& fn); // irloop.cc
+bool ir_eliminate_dead (ir_function& fn); // irdce.cc
+
+// helpers the passes share
+bool ir_literal (const ir_function& fn, ir_operand operand, int& value);
+bool ir_eval_binary (int op, typeref type, int x, int y, int& value);
+bool ir_eval_unary (int op, typeref type, int x, int& value);
+
+// find what the passes may assume of the globals, once every function
+// is built and has had its local passes, and point each at program
+void ir_analyze_program (ir_program& program,
+                         std::vector<ir_function>& functions,
+                         ir_function& main);
+
+// the functions __ocmain reaches through calls, by index
+struct ir_call_graph {
+   std::vector<uint32_t> order;     // each after the functions it calls
+   std::vector<uint32_t> forward;   // called before they are written
+};
+
+void ir_build_call_graph (ir_call_graph& graph,
+                          const std::vector<ir_function>& functions,
+                          const ir_function& main);
+
+// copy the bodies of small functions, and of those called from one
+// place, into their callers, mangling the locals copied into block
+// numbers from next_block on
+void ir_inline_calls (std::vector<ir_function>& functions,
+                      ir_function& main, const ir_call_graph& graph,
+                      int& next_block);
+
+// run the local passes in order on fn, as soon as it is built.  these
+// and irpass_run may be called on several threads at once, for
+// different functions.
+void irpass_run_local (ir_function& fn);
+
+// run the rest of the passes in order on fn
+void irpass_run (ir_function& fn);
+
+// time spent in each pass since the last reset, summed over threads
+void irpass_report (FILE* file);
+void irpass_reset (void);
+
+#endif // __IRPASS_H__
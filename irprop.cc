@@ -0,0 +1,571 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Sparse conditional constant propagation, after Wegman and Zadeck,
+// over the ssa overlay, then copy propagation.  Every temp and version
+// of a variable is given a value assuming only the edges shown to be
+// taken are, so a value set before a while or an if and not changed
+// in it is still known after it, and an arm that cannot be taken does
+// not spoil it.  Uses of a constant then read the literal, and uses of
+// a copy read what it was copied from, where that still holds the
+// same version.  -@o reports the uses rewritten in each function.
+
+#include <unordered_set>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+static const uint32_t NO_NAME = UINT32_MAX;
+
+enum lattice_kind : uint8_t { UNKNOWN, CONSTANT, VARYING };
+
+struct lattice {
+   lattice_kind kind;
+   int value;
+};
+
+static const lattice LATTICE_VARYING = {VARYING, 0};
+
+static lattice meet (lattice a, lattice b) {
+   if (a.kind == UNKNOWN) return b;
+   if (b.kind == UNKNOWN) return a;
+   if (a.kind == CONSTANT && b.kind == CONSTANT && a.value == b.value)
+      return a;
+   return LATTICE_VARYING;
+}
+
+// where an ssa name is read: an instruction, the exit or a phi
+struct use_site {
+   uint32_t block;
+   int32_t index;         // instruction, EXIT_SITE or PHI_SITE - phi
+};
+
+static const int32_t EXIT_SITE = -1;
+static const int32_t PHI_SITE = -2;
+
+class propagator {
+public:
+   propagator (ir_function& fn);
+   bool run();
+
+private:
+   uint32_t var_name (uint32_t var, uint32_t version) const;
+   uint32_t name_of (ir_operand operand) const;
+   void add_uses (ir_operand operand, use_site site, bool counting);
+   void find_uses (bool counting);
+   lattice value_of (ir_operand operand) const;
+   void set (uint32_t name, lattice value);
+   void mark_edge (uint32_t from, uint32_t to);
+   void take_edge (uint32_t from, uint32_t to);
+   void visit_phi (uint32_t b, size_t p);
+   void visit_instr (uint32_t b, size_t i);
+   void visit_exit (uint32_t b);
+   void visit_block (uint32_t b);
+   void solve();
+   void rewrite_constant (ir_operand& operand);
+   bool rewrite_constants();
+   ir_operand copy_root (ir_operand operand) const;
+   void rewrite_copy (ir_operand& operand);
+   void rewrite_copies();
+
+   ir_function& fn;
+   vector<uint32_t> var_base;             // name of version 1 by var
+   vector<lattice> values;                // by name
+   vector<uint32_t> first_use;            // by name, into uses
+   vector<use_site> uses;                 // grouped by name
+   vector<ir_operand> copy_of;            // by name, IR_NONE if none
+   vector<char> block_done;
+   vector<uint32_t> first_edge;           // by block, into edge_done
+   vector<char> edge_done;                // by predecessor of each block
+   vector<pair<uint32_t, uint32_t> > edge_work;
+   vector<uint32_t> name_work;
+   vector<vector<uint32_t> > stacks;      // versions by var, for copies
+   unsigned int constants;
+   unsigned int copies;
+};
+
+// temps are names 0 on, then each version of each versioned variable
+propagator::propagator (ir_function& fn) : fn(fn),
+      var_base(fn.vars.size(), 0), block_done(fn.blocks.size(), 0),
+      first_edge(fn.blocks.size() + 1, 0), stacks(fn.vars.size()),
+      constants(0), copies(0) {
+   vector<uint32_t> versions (fn.vars.size(), 0);
+   for (size_t p = 0; p < fn.params.size(); ++p) versions[fn.params[p]] = 1;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      first_edge[b + 1] = first_edge[b] + block.preds.size();
+      for (size_t p = 0; p < block.phis.size(); ++p) {
+         uint32_t& count = versions[block.phis[p].var];
+         if (block.phis[p].version > count) count = block.phis[p].version;
+      }
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         ir_operand dst = block.instrs[i].dst;
+         if (dst.kind == IR_VAR && dst.version > versions[dst.id])
+            versions[dst.id] = dst.version;
+      }
+   }
+   uint32_t names = fn.temps.size();
+   for (size_t v = 0; v < fn.vars.size(); ++v) {
+      var_base[v] = names;
+      names += versions[v];
+   }
+   lattice unknown = {UNKNOWN, 0};
+   values.assign (names, unknown);
+   edge_done.assign (first_edge.back(), 0);
+   first_use.assign (names + 1, 0);
+   copy_of.assign (names, IR_NO_OPERAND);
+}
+
+uint32_t propagator::var_name (uint32_t var, uint32_t version) const {
+   return version == 0 ? NO_NAME : var_base[var] + version - 1;
+}
+
+uint32_t propagator::name_of (ir_operand operand) const {
+   if (operand.kind == IR_TEMP) return operand.id;
+   if (operand.kind == IR_VAR && fn.vars[operand.id].versioned)
+      return var_name (operand.id, operand.version);
+   return NO_NAME;
+}
+
+// counting, first_use[name + 1] is the number of uses of name;
+// filling, first_use[name] is where the next use of name goes
+void propagator::add_uses (ir_operand operand, use_site site,
+                           bool counting) {
+   if (operand.kind == IR_INDEX || operand.kind == IR_FIELD) {
+      add_uses (fn.refs[operand.id].base, site, counting);
+      add_uses (fn.refs[operand.id].index, site, counting);
+      return;
+   }
+   uint32_t name = name_of (operand);
+   if (name == NO_NAME) return;
+   if (counting) ++first_use[name + 1];
+   else uses[first_use[name]++] = site;
+}
+
+void propagator::find_uses (bool counting) {
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      for (size_t p = 0; p < block.phis.size(); ++p) {
+         use_site site = {b, int32_t (PHI_SITE - p)};
+         const ir_phi& phi = block.phis[p];
+         for (size_t k = 0; k < phi.args.size(); ++k) {
+            ir_operand arg = {IR_VAR, phi.var, phi.args[k]};
+            add_uses (arg, site, counting);
+         }
+      }
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         use_site site = {b, int32_t (i)};
+         add_uses (instr.a, site, counting);
+         add_uses (instr.b, site, counting);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            add_uses (fn.args[instr.first_arg + a], site, counting);
+         if (instr.dst.kind == IR_INDEX || instr.dst.kind == IR_FIELD)
+            add_uses (instr.dst, site, counting);
+      }
+      use_site site = {b, EXIT_SITE};
+      add_uses (block.value, site, counting);
+   }
+}
+
+// only ints, chars and bools are given a constant value
+lattice propagator::value_of (ir_operand operand) const {
+   if (operand.kind == IR_NONE || !isPrimitive (fn.type (operand)))
+      return LATTICE_VARYING;
+   lattice value = LATTICE_VARYING;
+   switch (operand.kind) {
+      case IR_CONST:
+         if (ir_literal (fn, operand, value.value)) value.kind = CONSTANT;
+         return value;
+      case IR_TEMP:
+      case IR_VAR: {
+         uint32_t name = name_of (operand);
+         if (name != NO_NAME) return values[name];
+         if (operand.kind == IR_TEMP || fn.vars[operand.id].versioned
+             || fn.program == NULL)
+            return value;
+         const unordered_map<stringid, ir_const>& globals
+               = fn.program->constant_globals;
+         unordered_map<stringid, ir_const>::const_iterator found
+               = globals.find (fn.vars[operand.id].name);
+         if (found == globals.end()) return value;
+         value.kind = CONSTANT;
+         value.value = found->second.value;
+         return value;
+      }
+      default:
+         return value;
+   }
+}
+
+// values only ever go down, from unknown to constant to varying
+void propagator::set (uint32_t name, lattice value) {
+   lattice old = values[name];
+   value = meet (old, value);
+   if (value.kind == old.kind && value.value == old.value) return;
+   values[name] = value;
+   name_work.push_back (name);
+}
+
+void propagator::mark_edge (uint32_t from, uint32_t to) {
+   edge_work.push_back (make_pair (from, to));
+}
+
+void propagator::take_edge (uint32_t from, uint32_t to) {
+   const vector<uint32_t>& preds = fn.blocks[to].preds;
+   char* done = &edge_done[first_edge[to]];
+   bool fresh = false;
+   for (size_t p = 0; p < preds.size(); ++p) {
+      if (preds[p] == from && !done[p]) {
+         done[p] = 1;
+         fresh = true;
+      }
+   }
+   if (!fresh) return;
+   if (!block_done[to]) {
+      visit_block (to);
+      return;
+   }
+   // only the phis can see the new edge
+   for (size_t p = 0; p < fn.blocks[to].phis.size(); ++p) visit_phi (to, p);
+}
+
+void propagator::visit_phi (uint32_t b, size_t p) {
+   const ir_block& block = fn.blocks[b];
+   const ir_phi& phi = block.phis[p];
+   uint32_t name = var_name (phi.var, phi.version);
+   // nothing can bring a varying value back
+   if (values[name].kind == VARYING) return;
+   lattice value = {UNKNOWN, 0};
+   if (!isPrimitive (fn.vars[phi.var].type)) {
+      value = LATTICE_VARYING;
+   }else {
+      for (size_t k = 0; k < block.preds.size(); ++k) {
+         if (!edge_done[first_edge[b] + k]) continue;
+         uint32_t arg = var_name (phi.var, phi.args[k]);
+         value = meet (value, arg == NO_NAME ? LATTICE_VARYING
+                                             : values[arg]);
+      }
+   }
+   set (name, value);
+}
+
+void propagator::visit_instr (uint32_t b, size_t i) {
+   const ir_instr& instr = fn.blocks[b].instrs[i];
+   uint32_t name = name_of (instr.dst);
+   if (name == NO_NAME || values[name].kind == VARYING) return;
+   lattice value = LATTICE_VARYING;
+   lattice a = value_of (instr.a);
+   lattice b_value = value_of (instr.b);
+   if (!isPrimitive (fn.type (instr.dst))) {
+      // varying
+   }else if (instr.opcode == IR_MOVE) {
+      value = a;
+   }else if (instr.opcode == IR_BINARY || instr.opcode == IR_UNARY) {
+      bool unary = instr.opcode == IR_UNARY;
+      if (a.kind == VARYING || (!unary && b_value.kind == VARYING)) {
+         // varying
+      }else if (a.kind == UNKNOWN || (!unary && b_value.kind == UNKNOWN)) {
+         value.kind = UNKNOWN;
+      }else if (unary ? ir_eval_unary (instr.op, instr.type, a.value,
+                                       value.value)
+                      : ir_eval_binary (instr.op, instr.type, a.value,
+                                        b_value.value, value.value)) {
+         value.kind = CONSTANT;
+      }
+   }
+   set (name, value);
+}
+
+void propagator::visit_exit (uint32_t b) {
+   const ir_block& block = fn.blocks[b];
+   switch (block.exit) {
+      case IR_FALL:
+      case IR_JUMP:
+         if (block.succ[0] != IR_NO_BLOCK) mark_edge (b, block.succ[0]);
+         break;
+      case IR_BRANCH: {
+         lattice cond = value_of (block.value);
+         if (cond.kind == UNKNOWN) break;
+         if (cond.kind == VARYING || cond.value != 0)
+            mark_edge (b, block.succ[0]);
+         if (cond.kind == VARYING || cond.value == 0)
+            mark_edge (b, block.succ[1]);
+         break;
+      }
+      case IR_RETURN:
+      case IR_HALT:
+         break;
+   }
+}
+
+void propagator::visit_block (uint32_t b) {
+   block_done[b] = 1;
+   const ir_block& block = fn.blocks[b];
+   for (size_t p = 0; p < block.phis.size(); ++p) visit_phi (b, p);
+   for (size_t i = 0; i < block.instrs.size(); ++i) visit_instr (b, i);
+   visit_exit (b);
+}
+
+void propagator::solve() {
+   // the uses of every name, counted and then laid out in one array
+   find_uses (true);
+   for (size_t n = 1; n < first_use.size(); ++n)
+      first_use[n] += first_use[n - 1];
+   uses.resize (first_use.back());
+   find_uses (false);
+   for (size_t n = first_use.size() - 1; n > 0; --n)
+      first_use[n] = first_use[n - 1];
+   first_use[0] = 0;
+   // parameters arrive with values unknown to us
+   for (size_t p = 0; p < fn.params.size(); ++p)
+      values[var_name (fn.params[p], 1)] = LATTICE_VARYING;
+
+   visit_block (0);
+   while (!edge_work.empty() || !name_work.empty()) {
+      if (!edge_work.empty()) {
+         pair<uint32_t, uint32_t> edge = edge_work.back();
+         edge_work.pop_back();
+         take_edge (edge.first, edge.second);
+         continue;
+      }
+      uint32_t name = name_work.back();
+      name_work.pop_back();
+      for (uint32_t u = first_use[name]; u < first_use[name + 1]; ++u) {
+         use_site site = uses[u];
+         if (!block_done[site.block]) continue;
+         if (site.index >= 0) visit_instr (site.block, site.index);
+         else if (site.index == EXIT_SITE) visit_exit (site.block);
+         else visit_phi (site.block, PHI_SITE - site.index);
+      }
+   }
+}
+
+void propagator::rewrite_constant (ir_operand& operand) {
+   if (operand.kind == IR_INDEX || operand.kind == IR_FIELD) {
+      rewrite_constant (fn.refs[operand.id].base);
+      rewrite_constant (fn.refs[operand.id].index);
+      return;
+   }
+   if (operand.kind != IR_TEMP && operand.kind != IR_VAR) return;
+   lattice value = value_of (operand);
+   if (value.kind != CONSTANT) return;
+   ir_const constant = {fn.type (operand), value.value, IR_NO_TEXT};
+   operand.kind = IR_CONST;
+   operand.id = fn.consts.size();
+   operand.version = 0;
+   fn.consts.push_back (constant);
+   ++constants;
+}
+
+// read literals for constants, drop the temps they replace and take
+// the only side of a branch that can be taken
+bool propagator::rewrite_constants() {
+   bool changed = false;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (!block_done[b]) continue;
+      ir_block& block = fn.blocks[b];
+      size_t kept = 0;
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         ir_instr& instr = block.instrs[i];
+         rewrite_constant (instr.a);
+         rewrite_constant (instr.b);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            rewrite_constant (fn.args[instr.first_arg + a]);
+         if (instr.dst.kind == IR_INDEX || instr.dst.kind == IR_FIELD)
+            rewrite_constant (instr.dst);
+         if (instr.dst.kind == IR_TEMP
+             && values[instr.dst.id].kind == CONSTANT) {
+            changed = true;
+            continue;
+         }
+         if (kept != i) block.instrs[kept] = instr;
+         ++kept;
+      }
+      block.instrs.resize (kept);
+      if (block.exit != IR_BRANCH) continue;
+      lattice cond = value_of (block.value);
+      rewrite_constant (block.value);
+      if (cond.kind != CONSTANT) continue;
+      uint32_t target = block.succ[cond.value ? 0 : 1];
+      block.exit = target == b + 1 ? IR_FALL : IR_JUMP;
+      block.value = IR_NO_OPERAND;
+      block.succ[0] = target;
+      block.succ[1] = IR_NO_BLOCK;
+      changed = true;
+   }
+   return changed;
+}
+
+ir_operand propagator::copy_root (ir_operand operand) const {
+   for (;;) {
+      uint32_t name = name_of (operand);
+      if (name == NO_NAME || copy_of[name].kind == IR_NONE) return operand;
+      operand = copy_of[name];
+   }
+}
+
+// a temp holds its value everywhere it is read; a variable only until
+// it is written again
+void propagator::rewrite_copy (ir_operand& operand) {
+   if (operand.kind == IR_INDEX || operand.kind == IR_FIELD) {
+      rewrite_copy (fn.refs[operand.id].base);
+      rewrite_copy (fn.refs[operand.id].index);
+      return;
+   }
+   ir_operand root = copy_root (operand);
+   if (root.kind == operand.kind && root.id == operand.id) return;
+   if (root.kind == IR_VAR && (stacks[root.id].empty()
+                               || stacks[root.id].back() != root.version))
+      return;
+   operand = root;
+   ++copies;
+}
+
+void propagator::rewrite_copies() {
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (!block_done[b]) continue;
+      const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         const ir_instr& instr = instrs[i];
+         uint32_t name = name_of (instr.dst);
+         if (instr.opcode != IR_MOVE || name == NO_NAME
+             || values[name].kind == CONSTANT)
+            continue;
+         // a temp of a type the oil has no name for is not spread
+         if ((instr.a.kind == IR_TEMP && fn.temps[instr.a.id].prefix != 0)
+             || (name_of (instr.a) != NO_NAME && instr.a.kind == IR_VAR))
+            copy_of[name] = instr.a;
+      }
+   }
+   // down the dominator tree, with the version of each variable
+   // current at each point, as the renamer had it
+   vector<vector<uint32_t> > children (fn.blocks.size());
+   for (uint32_t b = 1; b < fn.blocks.size(); ++b) {
+      if (fn.idom[b] != IR_NO_BLOCK) children[fn.idom[b]].push_back (b);
+   }
+   for (size_t p = 0; p < fn.params.size(); ++p)
+      stacks[fn.params[p]].push_back (1);
+   vector<uint32_t> defined;
+   vector<size_t> marks (fn.blocks.size(), 0);
+   vector<pair<uint32_t, size_t> > walk;
+   walk.push_back (make_pair (0u, size_t (0)));
+   bool entering = true;
+   while (!walk.empty()) {
+      uint32_t b = walk.back().first;
+      ir_block& block = fn.blocks[b];
+      if (entering) {
+         marks[b] = defined.size();
+         for (size_t p = 0; p < block.phis.size(); ++p) {
+            stacks[block.phis[p].var].push_back (block.phis[p].version);
+            defined.push_back (block.phis[p].var);
+         }
+         for (size_t i = 0; i < block.instrs.size(); ++i) {
+            ir_instr& instr = block.instrs[i];
+            rewrite_copy (instr.a);
+            rewrite_copy (instr.b);
+            for (uint32_t a = 0; a < instr.arg_count; ++a)
+               rewrite_copy (fn.args[instr.first_arg + a]);
+            if (instr.dst.kind == IR_INDEX || instr.dst.kind == IR_FIELD)
+               rewrite_copy (instr.dst);
+            if (instr.dst.kind == IR_VAR && fn.vars[instr.dst.id].versioned) {
+               stacks[instr.dst.id].push_back (instr.dst.version);
+               defined.push_back (instr.dst.id);
+            }
+         }
+         rewrite_copy (block.value);
+      }
+      if (walk.back().second < children[b].size()) {
+         uint32_t child = children[b][walk.back().second++];
+         walk.push_back (make_pair (child, size_t (0)));
+         entering = true;
+         continue;
+      }
+      while (defined.size() > marks[b]) {
+         stacks[defined.back()].pop_back();
+         defined.pop_back();
+      }
+      walk.pop_back();
+      entering = false;
+   }
+}
+
+bool propagator::run() {
+   if (fn.blocks.empty()) return false;
+   solve();
+   // copies are found while the versions are still those of the ssa
+   // form, which rewriting constants leaves alone
+   bool changed = rewrite_constants();
+   rewrite_copies();
+   if (constants != 0 || copies != 0) changed = true;
+   if (is_debugflag ('o')) {
+      eprintf ("propagate: %s: %u constant uses, %u copy uses rewritten\n",
+               stringset_cstr (fn.name), constants, copies);
+   }
+   if (changed) {
+      ir_compute_cfg (fn);
+      ir_remove_unreachable (fn);
+   }
+   return changed;
+}
+
+bool ir_propagate (ir_function& fn) {
+   return propagator (fn).run();
+}
+
+
+/***********************  whole program  ***********************/
+
+void ir_analyze_program (ir_program& program,
+                         vector<ir_function>& functions,
+                         ir_function& main) {
+   // globals written by some function other than __ocmain
+   unordered_set<stringid> shared;
+   for (size_t f = 0; f < functions.size(); ++f) {
+      const ir_function& fn = functions[f];
+      for (size_t b = 0; b < fn.blocks.size(); ++b) {
+         const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+         for (size_t i = 0; i < instrs.size(); ++i) {
+            ir_operand dst = instrs[i].dst;
+            if (dst.kind == IR_VAR && fn.vars[dst.id].kind == IR_GLOBAL)
+               shared.insert (fn.vars[dst.id].name);
+         }
+      }
+   }
+   // __ocmain can then number the rest as it does its locals, since no
+   // call it makes can change them
+   unordered_map<stringid, int> stores;
+   for (size_t v = 0; v < main.vars.size(); ++v) {
+      ir_var& var = main.vars[v];
+      if (var.kind == IR_GLOBAL && shared.count (var.name) == 0)
+         var.versioned = true;
+   }
+   for (size_t b = 0; b < main.blocks.size(); ++b) {
+      const vector<ir_instr>& instrs = main.blocks[b].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         ir_operand dst = instrs[i].dst;
+         if (dst.kind == IR_VAR && main.vars[dst.id].kind == IR_GLOBAL)
+            ++stores[main.vars[dst.id].name];
+      }
+   }
+   // a global stored once from a literal before the first call has
+   // that value in every function, which runs only once called
+   const vector<ir_instr>& entry = main.blocks[0].instrs;
+   for (size_t i = 0; i < entry.size() && entry[i].opcode != IR_CALL; ++i) {
+      const ir_instr& instr = entry[i];
+      int value;
+      if (instr.opcode != IR_MOVE || instr.dst.kind != IR_VAR
+          || !isPrimitive (instr.type)
+          || !ir_literal (main, instr.a, value))
+         continue;
+      const ir_var& var = main.vars[instr.dst.id];
+      if (var.kind == IR_GLOBAL && var.versioned && stores[var.name] == 1)
+         program.constant_globals[var.name] = main.consts[instr.a.id];
+   }
+   for (size_t f = 0; f < functions.size(); ++f)
+      functions[f].program = &program;
+   main.program = &program;
+   main.invalidate();
+}
@@ -0,0 +1,310 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Dominators are found with the iterative algorithm of Cooper, Harvey
+// and Kennedy over the reverse postorder.  Ssa form is an overlay: the
+// instructions keep naming variables by their oil names, and the
+// version of each variable operand says which definition reached it.
+// Globals are left out, since any call may change them, except in
+// __ocmain for the globals no function writes.
+
+#include <algorithm>
+
+#include "ir.h"
+
+using namespace std;
+
+void ir_reverse_postorder (const ir_function& fn, vector<uint32_t>& order) {
+   order.clear();
+   if (fn.blocks.empty()) return;
+   vector<char> seen (fn.blocks.size(), 0);
+   // each frame is a block and the number of successors visited
+   vector<pair<uint32_t, int> > stack;
+   stack.push_back (make_pair (0u, 0));
+   seen[0] = 1;
+   while (!stack.empty()) {
+      uint32_t b = stack.back().first;
+      uint32_t succ[2];
+      int count = ir_successors (fn, b, succ);
+      if (stack.back().second < count) {
+         uint32_t s = succ[stack.back().second++];
+         if (!seen[s]) {
+            seen[s] = 1;
+            stack.push_back (make_pair (s, 0));
+         }
+         continue;
+      }
+      order.push_back (b);
+      stack.pop_back();
+   }
+   reverse (order.begin(), order.end());
+}
+
+void ir_compute_dominators (ir_function& fn) {
+   vector<uint32_t> order;
+   ir_reverse_postorder (fn, order);
+   vector<uint32_t> rank (fn.blocks.size(), IR_NO_BLOCK);
+   for (size_t i = 0; i < order.size(); ++i) rank[order[i]] = i;
+   vector<uint32_t>& idom = fn.idom;
+   idom.assign (fn.blocks.size(), IR_NO_BLOCK);
+   if (order.empty()) return;
+   idom[0] = 0;
+   for (bool changed = true; changed; ) {
+      changed = false;
+      for (size_t i = 1; i < order.size(); ++i) {
+         uint32_t b = order[i];
+         uint32_t dom = IR_NO_BLOCK;
+         const vector<uint32_t>& preds = fn.blocks[b].preds;
+         for (size_t p = 0; p < preds.size(); ++p) {
+            uint32_t other = preds[p];
+            if (idom[other] == IR_NO_BLOCK) continue;
+            if (dom == IR_NO_BLOCK) {
+               dom = other;
+               continue;
+            }
+            // walk both up to their nearest common dominator
+            while (dom != other) {
+               while (rank[dom] > rank[other]) dom = idom[dom];
+               while (rank[other] > rank[dom]) other = idom[other];
+            }
+         }
+         if (idom[b] != dom) {
+            idom[b] = dom;
+            changed = true;
+         }
+      }
+   }
+   idom[0] = IR_NO_BLOCK;
+}
+
+bool ir_dominates (const ir_function& fn, uint32_t a, uint32_t b) {
+   for (; b != IR_NO_BLOCK; b = fn.idom[b]) {
+      if (b == a) return true;
+   }
+   return false;
+}
+
+
+/***********************  ssa  ***********************/
+
+// variables the overlay numbers
+static bool in_ssa (const ir_function& fn, ir_operand operand) {
+   return operand.kind == IR_VAR && fn.vars[operand.id].versioned;
+}
+
+class renamer {
+public:
+   renamer (ir_function& fn);
+   void run();
+
+private:
+   void use (ir_operand& operand);
+   void define (ir_operand& operand);
+   void enter (uint32_t b);
+   void leave (uint32_t b);
+   ir_function& fn;
+   vector<vector<uint32_t> > stacks;      // versions by var, innermost last
+   vector<uint32_t> counts;               // versions made by var
+   vector<vector<uint32_t> > children;    // dominator tree
+   vector<uint32_t> defined;              // vars pushed, in order
+   vector<size_t> marks;                  // size of defined by block
+};
+
+renamer::renamer (ir_function& fn) : fn(fn), stacks(fn.vars.size()),
+      counts(fn.vars.size(), 0), children(fn.blocks.size()),
+      marks(fn.blocks.size(), 0) {
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      if (fn.idom[b] != IR_NO_BLOCK) children[fn.idom[b]].push_back (b);
+   }
+   // parameters arrive defined, as version 1
+   for (size_t p = 0; p < fn.params.size(); ++p) {
+      counts[fn.params[p]] = 1;
+      stacks[fn.params[p]].push_back (1);
+   }
+}
+
+void renamer::use (ir_operand& operand) {
+   switch (operand.kind) {
+      case IR_VAR:
+         if (!in_ssa (fn, operand)) break;
+         operand.version = stacks[operand.id].empty()
+                         ? 0 : stacks[operand.id].back();
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         use (fn.refs[operand.id].base);
+         use (fn.refs[operand.id].index);
+         break;
+      default:
+         break;
+   }
+}
+
+// a reference written through is a use of the variables in it
+void renamer::define (ir_operand& operand) {
+   if (!in_ssa (fn, operand)) {
+      use (operand);
+      return;
+   }
+   operand.version = ++counts[operand.id];
+   stacks[operand.id].push_back (operand.version);
+   defined.push_back (operand.id);
+}
+
+void renamer::enter (uint32_t b) {
+   ir_block& block = fn.blocks[b];
+   marks[b] = defined.size();
+   for (size_t p = 0; p < block.phis.size(); ++p) {
+      ir_phi& phi = block.phis[p];
+      phi.version = ++counts[phi.var];
+      stacks[phi.var].push_back (phi.version);
+      defined.push_back (phi.var);
+   }
+   for (size_t i = 0; i < block.instrs.size(); ++i) {
+      ir_instr& instr = block.instrs[i];
+      use (instr.a);
+      use (instr.b);
+      for (uint32_t a = 0; a < instr.arg_count; ++a)
+         use (fn.args[instr.first_arg + a]);
+      define (instr.dst);
+   }
+   use (block.value);
+   uint32_t succ[2];
+   int count = ir_successors (fn, b, succ);
+   for (int s = 0; s < count; ++s) {
+      ir_block& next = fn.blocks[succ[s]];
+      for (size_t p = 0; p < next.preds.size(); ++p) {
+         if (next.preds[p] != b) continue;
+         for (size_t f = 0; f < next.phis.size(); ++f) {
+            const vector<uint32_t>& stack = stacks[next.phis[f].var];
+            next.phis[f].args[p] = stack.empty() ? 0 : stack.back();
+         }
+      }
+   }
+}
+
+void renamer::leave (uint32_t b) {
+   while (defined.size() > marks[b]) {
+      stacks[defined.back()].pop_back();
+      defined.pop_back();
+   }
+}
+
+void renamer::run() {
+   if (fn.blocks.empty() || fn.idom.empty()) return;
+   // each frame is a block and the number of children visited
+   vector<pair<uint32_t, size_t> > stack;
+   enter (0);
+   stack.push_back (make_pair (0u, size_t (0)));
+   while (!stack.empty()) {
+      uint32_t b = stack.back().first;
+      if (stack.back().second < children[b].size()) {
+         uint32_t child = children[b][stack.back().second++];
+         enter (child);
+         stack.push_back (make_pair (child, size_t (0)));
+         continue;
+      }
+      leave (b);
+      stack.pop_back();
+   }
+}
+
+// add the variables read by operand before any write in the block
+static void note_use (const ir_function& fn, ir_operand operand,
+                      const vector<uint32_t>& killed_in, uint32_t b,
+                      vector<char>& crosses) {
+   switch (operand.kind) {
+      case IR_VAR:
+         if (in_ssa (fn, operand) && killed_in[operand.id] != b)
+            crosses[operand.id] = 1;
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         note_use (fn, fn.refs[operand.id].base, killed_in, b, crosses);
+         note_use (fn, fn.refs[operand.id].index, killed_in, b, crosses);
+         break;
+      default:
+         break;
+   }
+}
+
+void ir_build_ssa (ir_function& fn) {
+   ir_compute_dominators (fn);
+   size_t nblocks = fn.blocks.size();
+   size_t nvars = fn.vars.size();
+   for (size_t b = 0; b < nblocks; ++b) fn.blocks[b].phis.clear();
+
+   // dominance frontiers
+   vector<vector<uint32_t> > frontier (nblocks);
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      const vector<uint32_t>& preds = fn.blocks[b].preds;
+      if (preds.size() < 2 || (b != 0 && fn.idom[b] == IR_NO_BLOCK)) continue;
+      for (size_t p = 0; p < preds.size(); ++p) {
+         uint32_t runner = preds[p];
+         if (runner != 0 && fn.idom[runner] == IR_NO_BLOCK) continue;
+         while (runner != IR_NO_BLOCK && runner != fn.idom[b]) {
+            vector<uint32_t>& df = frontier[runner];
+            if (df.empty() || df.back() != b) df.push_back (b);
+            runner = fn.idom[runner];
+         }
+      }
+   }
+
+   // where each variable is written, and which are read in a block
+   // other than the one writing them; only those need phis
+   vector<vector<uint32_t> > sites (nvars);
+   vector<uint32_t> killed_in (nvars, IR_NO_BLOCK);
+   vector<char> crosses (nvars, 0);
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      const ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         note_use (fn, instr.a, killed_in, b, crosses);
+         note_use (fn, instr.b, killed_in, b, crosses);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            note_use (fn, fn.args[instr.first_arg + a], killed_in, b, crosses);
+         if (in_ssa (fn, instr.dst)) {
+            if (sites[instr.dst.id].empty()
+                || sites[instr.dst.id].back() != b)
+               sites[instr.dst.id].push_back (b);
+            killed_in[instr.dst.id] = b;
+         }else {
+            note_use (fn, instr.dst, killed_in, b, crosses);
+         }
+      }
+      note_use (fn, block.value, killed_in, b, crosses);
+   }
+   for (size_t p = 0; p < fn.params.size(); ++p)
+      sites[fn.params[p]].insert (sites[fn.params[p]].begin(), 0);
+
+   // place phis on the iterated frontier of the writes
+   vector<uint32_t> has_phi (nblocks, IR_NO_BLOCK);
+   vector<uint32_t> queued (nblocks, IR_NO_BLOCK);
+   vector<uint32_t> work;
+   for (uint32_t v = 0; v < nvars; ++v) {
+      if (!crosses[v]) continue;
+      work = sites[v];
+      for (size_t w = 0; w < work.size(); ++w) queued[work[w]] = v;
+      while (!work.empty()) {
+         uint32_t b = work.back();
+         work.pop_back();
+         for (size_t d = 0; d < frontier[b].size(); ++d) {
+            uint32_t join = frontier[b][d];
+            if (has_phi[join] == v) continue;
+            has_phi[join] = v;
+            ir_phi phi;
+            phi.var = v;
+            phi.version = 0;
+            phi.args.assign (fn.blocks[join].preds.size(), 0);
+            fn.blocks[join].phis.push_back (phi);
+            if (queued[join] != v) {
+               queued[join] = v;
+               work.push_back (join);
+            }
+         }
+      }
+   }
+
+   renamer (fn).run();
+   fn.ssa = true;
+}
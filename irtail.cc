@@ -0,0 +1,311 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Tail calls.  A function returning what a call to itself returns
+// need not keep its frame: the arguments are stored in the parameters
+// and it goes back to its start.  When the call's result is added to,
+// or multiplied by, something known before the call, the sum or
+// product so far is carried in a local instead, and each return left
+// gives that combined with its value.  Deep recursion of either kind
+// then runs as a loop, in the one frame.
+
+#include <cstring>
+
+#include "irpass.h"
+#include "astutils.h"
+
+using namespace std;
+
+class looper {
+public:
+   looper (ir_function& fn);
+   bool run();
+
+private:
+   enum site_kind { NO_SITE, TAIL, ACCUMULATE };
+   site_kind find_site (uint32_t b, int& op) const;
+   bool returns_nothing (uint32_t b) const;
+   bool known_before (ir_operand operand) const;
+   bool reads (ir_operand operand, uint32_t var) const;
+   ir_instr like (const ir_instr& instr, ir_opcode opcode, ir_operand dst,
+                  ir_operand a, ir_operand b) const;
+   ir_operand temp (typeref type);
+   ir_operand var (uint32_t id) const;
+   void make_accumulator();
+   void pass_arguments (vector<ir_instr>& instrs, const ir_instr& call);
+
+   ir_function& fn;
+   int temp_count;
+   int label_count;
+   int accumulate_op;           // + or *, 0 if nothing is accumulated
+   uint32_t accumulator;        // the local var carrying it
+};
+
+looper::looper (ir_function& fn) : fn(fn), temp_count(0), label_count(0),
+      accumulate_op(0), accumulator(0) {
+   for (size_t t = 0; t < fn.temps.size(); ++t) {
+      if (fn.temps[t].prefix != 0 && fn.temps[t].number >= temp_count)
+         temp_count = fn.temps[t].number + 1;
+   }
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      if (fn.blocks[b].label != NULL
+          && fn.blocks[b].label_number >= label_count)
+         label_count = fn.blocks[b].label_number + 1;
+   }
+}
+
+// a void function returns from b, or from blocks it goes on to that
+// do nothing
+bool looper::returns_nothing (uint32_t b) const {
+   for (size_t steps = 0; steps < fn.blocks.size(); ++steps) {
+      const ir_block& block = fn.blocks[b];
+      if (block.exit == IR_RETURN) return true;
+      if (block.exit != IR_FALL && block.exit != IR_JUMP) return false;
+      if (block.succ[0] == IR_NO_BLOCK) return true;
+      b = block.succ[0];
+      if (!fn.blocks[b].instrs.empty()) return false;
+   }
+   return false;
+}
+
+// no call can change operand: the callee sees none of the caller's
+// locals, but may store to globals and memory
+bool looper::known_before (ir_operand operand) const {
+   switch (operand.kind) {
+      case IR_TEMP:
+      case IR_CONST:
+         return true;
+      case IR_VAR:
+         return fn.vars[operand.id].kind != IR_GLOBAL;
+      default:
+         return false;
+   }
+}
+
+static bool same (ir_operand x, ir_operand y) {
+   return x.kind == y.kind && x.id == y.id;
+}
+
+// Block b ends in a call to fn that is returned at once, or whose
+// result is returned combined by op with something known before it.
+looper::site_kind looper::find_site (uint32_t b, int& op) const {
+   const ir_block& block = fn.blocks[b];
+   size_t size = block.instrs.size();
+   if (size == 0) return NO_SITE;
+   const ir_instr& last = block.instrs[size - 1];
+   if (last.opcode == IR_CALL && last.callee == fn.sym) {
+      if (fn.result == TYPE_VOID) {
+         return returns_nothing (b) ? TAIL : NO_SITE;
+      }
+      return last.dst.kind == IR_TEMP && block.exit == IR_RETURN
+             && same (block.value, last.dst) ? TAIL : NO_SITE;
+   }
+   if (size < 2 || fn.result != TYPE_INT || last.opcode != IR_BINARY
+       || (last.op != '+' && last.op != '*') || last.dst.kind != IR_TEMP
+       || block.exit != IR_RETURN || !same (block.value, last.dst))
+      return NO_SITE;
+   const ir_instr& call = block.instrs[size - 2];
+   if (call.opcode != IR_CALL || call.callee != fn.sym
+       || call.dst.kind != IR_TEMP)
+      return NO_SITE;
+   ir_operand other;
+   if (same (last.a, call.dst)) other = last.b;
+   else if (same (last.b, call.dst)) other = last.a;
+   else return NO_SITE;
+   if (same (other, call.dst) || !known_before (other)) return NO_SITE;
+   op = last.op;
+   return ACCUMULATE;
+}
+
+bool looper::reads (ir_operand operand, uint32_t var) const {
+   switch (operand.kind) {
+      case IR_VAR:
+         return operand.id == var;
+      case IR_INDEX:
+      case IR_FIELD:
+         return reads (fn.refs[operand.id].base, var)
+             || reads (fn.refs[operand.id].index, var);
+      default:
+         return false;
+   }
+}
+
+// an instruction at the place of instr, for its diagnostics
+ir_instr looper::like (const ir_instr& instr, ir_opcode opcode,
+                       ir_operand dst, ir_operand a, ir_operand b) const {
+   ir_instr made = instr;
+   made.opcode = opcode;
+   made.declares = false;
+   made.type = fn.type (dst);
+   made.dst = dst;
+   made.a = a;
+   made.b = b;
+   made.first_arg = made.arg_count = 0;
+   made.callee = NULL;
+   return made;
+}
+
+ir_operand looper::temp (typeref type) {
+   ir_temp temp = {type, ir_temp_prefix (type), 0};
+   if (temp.prefix != 0) temp.number = temp_count++;
+   ir_operand operand = {IR_TEMP, uint32_t (fn.temps.size()), 0};
+   fn.temps.push_back (temp);
+   return operand;
+}
+
+ir_operand looper::var (uint32_t id) const {
+   ir_operand operand = {IR_VAR, id, 0};
+   return operand;
+}
+
+// The accumulator is mangled into the block of the parameters, under
+// a name none of them has.
+void looper::make_accumulator() {
+   const char* param = stringset_cstr (fn.vars[fn.params[0]].name);
+   string prefix (param, strchr (param + 1, '_') + 1 - param);
+   string name = prefix + "acc";
+   for (bool taken = true; taken; ) {
+      taken = false;
+      for (size_t v = 0; v < fn.vars.size(); ++v) {
+         if (stringset_cstr (fn.vars[v].name) == name) taken = true;
+      }
+      if (taken) name += "_";
+   }
+   ir_var acc = {intern_stringset (name.c_str()), TYPE_INT, IR_LOCAL, true,
+                 false};
+   accumulator = fn.vars.size();
+   fn.vars.push_back (acc);
+}
+
+// The parameters are stored in order, through temps if an argument
+// reads a parameter stored before it.
+void looper::pass_arguments (vector<ir_instr>& instrs,
+                             const ir_instr& call) {
+   bool through_temps = false;
+   for (size_t k = 0; k < fn.params.size(); ++k) {
+      for (size_t j = 0; j < k; ++j) {
+         if (reads (fn.args[call.first_arg + k], fn.params[j]))
+            through_temps = true;
+      }
+   }
+   vector<ir_operand> values;
+   for (size_t k = 0; k < fn.params.size(); ++k) {
+      ir_operand arg = fn.args[call.first_arg + k];
+      if (through_temps && !same (arg, var (fn.params[k]))) {
+         ir_operand value = temp (fn.vars[fn.params[k]].type);
+         instrs.push_back (like (call, IR_MOVE, value, arg, IR_NO_OPERAND));
+         arg = value;
+      }
+      values.push_back (arg);
+   }
+   for (size_t k = 0; k < fn.params.size(); ++k) {
+      if (same (values[k], var (fn.params[k]))) continue;
+      instrs.push_back (like (call, IR_MOVE, var (fn.params[k]), values[k],
+                              IR_NO_OPERAND));
+   }
+}
+
+bool looper::run() {
+   if (fn.main || fn.blocks.empty()) return false;
+   vector<pair<uint32_t, site_kind> > sites;
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      int op = 0;
+      site_kind kind = find_site (b, op);
+      if (kind == ACCUMULATE) {
+         // all must accumulate the same way, into a local named after
+         // a parameter
+         if (fn.params.empty()
+             || (accumulate_op != 0 && accumulate_op != op))
+            continue;
+         accumulate_op = op;
+      }
+      if (kind != NO_SITE) sites.push_back (make_pair (b, kind));
+   }
+   if (sites.empty()) return false;
+   // what is added is placed as the first call was
+   ir_instr origin = fn.blocks[sites[0].first].instrs.back();
+
+   // a new entry goes before the old one, which the calls go back to
+   for (size_t b = 0; b < fn.blocks.size(); ++b) {
+      for (int s = 0; s < 2; ++s) {
+         if (fn.blocks[b].succ[s] != IR_NO_BLOCK) ++fn.blocks[b].succ[s];
+      }
+   }
+   ir_block entry;
+   entry.label = NULL;
+   entry.label_number = 0;
+   entry.exit = IR_FALL;
+   entry.value = IR_NO_OPERAND;
+   entry.succ[0] = 1;
+   entry.succ[1] = IR_NO_BLOCK;
+   entry.independent = false;
+   fn.blocks.insert (fn.blocks.begin(), entry);
+   if (fn.blocks[1].label == NULL) {
+      fn.blocks[1].label = "entry";
+      fn.blocks[1].label_number = label_count++;
+   }
+   if (accumulate_op != 0) {
+      make_accumulator();
+      ir_const identity = {TYPE_INT, accumulate_op == '*', IR_NO_TEXT};
+      ir_operand start = {IR_CONST, uint32_t (fn.consts.size()), 0};
+      fn.consts.push_back (identity);
+      ir_instr init = like (origin, IR_MOVE, var (accumulator), start,
+                            IR_NO_OPERAND);
+      init.declares = true;
+      fn.blocks[0].instrs.push_back (init);
+   }
+
+   unsigned int accumulated = 0;
+   vector<char> is_site (fn.blocks.size(), 0);
+   for (size_t s = 0; s < sites.size(); ++s) {
+      uint32_t b = sites[s].first + 1;
+      is_site[b] = 1;
+      ir_block& block = fn.blocks[b];
+      vector<ir_instr>& instrs = block.instrs;
+      if (sites[s].second == ACCUMULATE) {
+         ir_instr combine = instrs.back();
+         instrs.pop_back();
+         ir_operand other = same (combine.a, instrs.back().dst)
+                          ? combine.b : combine.a;
+         combine.dst = var (accumulator);
+         combine.a = var (accumulator);
+         combine.b = other;
+         ir_instr call = instrs.back();
+         instrs.back() = combine;
+         pass_arguments (instrs, call);
+         ++accumulated;
+      }else {
+         ir_instr call = instrs.back();
+         instrs.pop_back();
+         pass_arguments (instrs, call);
+      }
+      block.exit = IR_JUMP;
+      block.value = IR_NO_OPERAND;
+      block.succ[0] = 1;
+      block.succ[1] = IR_NO_BLOCK;
+   }
+
+   // every other return gives what was accumulated along with its value
+   if (accumulate_op != 0) {
+      for (uint32_t b = 1; b < fn.blocks.size(); ++b) {
+         ir_block& block = fn.blocks[b];
+         if (block.exit != IR_RETURN || is_site[b]) continue;
+         ir_operand result = temp (TYPE_INT);
+         ir_instr combine = like (origin, IR_BINARY, result,
+                                  var (accumulator), block.value);
+         combine.op = accumulate_op;
+         block.instrs.push_back (combine);
+         block.value = result;
+      }
+   }
+   ir_compute_cfg (fn);
+   if (is_debugflag ('o')) {
+      eprintf ("tailcall: %s: %zu calls to itself, %u accumulated\n",
+               stringset_cstr (fn.name), sites.size(), accumulated);
+   }
+   return true;
+}
+
+bool ir_eliminate_tail_calls (ir_function& fn) {
+   return looper (fn).run();
+}
@@ -3,7 +3,6 @@
 // c file for interfacing with flex and bison
 
 #include <vector>
-#include <stack>
 #include <string>
 #include <cassert>
 #include <ctype.h>
@@ -13,6 +12,8 @@
 
 #include "lyutils.h"
 #include "auxlib.h"
+#include "fastscan.h"
+#include "tokbuf.h"
 
 using namespace std;
 
@@ -21,8 +22,35 @@ ast* yyparse_ast = NULL;
 int scan_linenr = 1;
 int scan_offset = 0;
 bool scan_echo = false;
+bool scan_fast = false;
 vector<string> included_filenames;
-stack<ast*> lexemes;
+
+// select the flex scanner ("flex") or the hand-written one ("fast")
+bool scanner_setmode (const char* mode) {
+   if (strcmp (mode, "fast") == 0) scan_fast = true;
+   else if (strcmp (mode, "flex") == 0) scan_fast = false;
+   else return false;
+   return true;
+}
+
+// return the next token from the selected scanner
+int scanner_lex (void) {
+   return scan_fast ? fastscan_lex() : yylex();
+}
+
+// scan the buffer in place, it must be followed by two NUL bytes
+void scanner_setbuffer (char* buffer, size_t length) {
+   tokbuf_reset (buffer);
+   if (scan_fast) {
+      fastscan_setbuffer (buffer, length);
+   }else if (yy_scan_buffer (buffer, length + 2) == NULL) {
+      errprintf ("%: error: failed to set scanner buffer\n");
+   }
+}
+
+void scanner_settokfile (FILE* tokfile) {
+   pipe_tok = tokfile;
+}
 
 void scanner_openpipe (char* fname) {
    string fname_tok (fname);
@@ -35,6 +63,7 @@ void scanner_openpipe (char* fname) {
 }
 
 void scanner_closepipe (void) {
+   tokbuf_dump (pipe_tok);
    int fclose_rc = fclose (pipe_tok);
    if (fclose_rc != 0) 
       errprintf("%: error: pipe_tok closed with code \'%d\'.\n", fclose_rc);
@@ -51,6 +80,8 @@ void scanner_newfilename (const char* filename) {
 void scanner_newline (void) {
    ++scan_linenr;
    scan_offset = 0;
+   tokbuf_newline (yytext + yyleng, included_filenames.size() - 1,
+                   scan_linenr);
 }
 
 void scanner_setecho (bool echoflag) {
@@ -84,11 +115,7 @@ void scanner_badtoken (const char* message, char* lexeme) {
 }
 
 int yylval_token (int symbol) {
-   int offset = scan_offset - yyleng;
-   yylval = new ast (symbol, included_filenames.size() - 1, scan_linenr, 
-                     offset, yytext);
-   yylval->dump_tok (pipe_tok);
-   lexemes.push(yylval);  // keep track of lexemes for deletion
+   yylval.token = tokbuf_push (symbol, yytext, yyleng);
    return symbol;
 }
 
@@ -100,16 +127,11 @@ void scanner_include (void) {
    if (scan_rc != 2) {
       errprintf ("%: %d: [%s]: invalid directive, ignored\n", scan_rc, yytext);
    }else {
-      fprintf (pipe_tok, ";# %d \"%s\"\n", linenr, filename);
       scanner_newfilename (filename);
+      tokbuf_marker (linenr, included_filenames.size() - 1);
       scan_linenr = linenr - 1;
       DEBUGF ('s', "filename=%s, scan_linenr=%d\n",
               included_filenames.back().c_str(), scan_linenr);
    }
 }
 
-void free_ast (void) {
-   while (!lexemes.empty()) {
-      lexemes.pop();
-   }
-}
@@ -22,12 +22,19 @@ extern int yydebug;               // bison debug flag
 extern size_t yyleng;
 
 int yylex (void);
+int scanner_lex (void);
 int yyparse (void);
 void yyerror (const char* message);
 int yylex_destroy (void);
 const char* get_yytname (int symbol);
 bool is_defined_token (int symbol);
 
+struct yy_buffer_state;
+yy_buffer_state* yy_scan_buffer (char* base, size_t size);
+
+bool scanner_setmode (const char* mode);
+void scanner_setbuffer (char* buffer, size_t length);
+void scanner_settokfile (FILE* tokfile);
 void scanner_openpipe (char* fname);
 void scanner_closepipe (void);
 const std::string* scanner_filename (int filenr);
@@ -37,7 +44,6 @@ void scanner_badtoken (const char* message, char* lexeme);
 void scanner_newline (void);
 void scanner_setecho (bool echoflag);
 void scanner_useraction (void);
-void free_ast (void);
 
 // scanner action after recognizing a token
 int yylval_token (int symbol);
@@ -45,7 +51,7 @@ int yylval_token (int symbol);
 void scanner_include (void);
 
 typedef ast* ast_ptr;
-#define YYSTYPE ast_ptr
 #include "yyparse.h"
+#include "tokbuf.h"
 
 #endif
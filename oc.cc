@@ -15,9 +15,6 @@
 
 using namespace std;
 
-bool opt_D = false;                  // cpp define flag
-string cpp_define = "-D";            // define this str
-string cpp_command = "/usr/bin/cpp"; // cpp path
 extern ast_ptr yyparse_ast;          // abstract syntax tree root pointer
 
 // global symbol table
@@ -47,21 +44,18 @@ int main (int argc, char **argv) {
       EXIT();
    }
 
-   // open the oc file with cpp and assign the pipe to yyin
-   cpp_popen (fname);
+   // preprocess the oc file and hand the buffer to the scanner
+   cpp_open (fname);
    
    // enable dump to .tok file 
    scanner_openpipe (bname);
 
-   DEBUGF ('v', "filename = %s, yyin = %p, fileno (yyin) = %d\n",
-           fname, yyin, fileno (yyin));
-
    // call yyparse to parse file
    yyparse();
 
-   // close yyin
-   cpp_pclose();
+   // dump the token buffer, then release the preprocessed source
    scanner_closepipe();
+   cpp_close();
 
    DEBUGSTMT ('s', dump_stringset (stderr); );
 
@@ -77,11 +71,11 @@ int main (int argc, char **argv) {
      yyparse_ast->rec_typecheck();
      
      DEBUGSTMT ('z', global_scope.dump(stderr, 0); );
+     DEBUGSTMT ('z', dump_structtable(stderr); );
      // dump symbol table to .sym file
      dumpfile_sym (bname);
 
      if (get_exitstatus() == EXIT_SUCCESS){
-       DEBUGSTMT ('i', yyparse_ast->dump_code(stderr); );
        // dump intermediate code to .oil file
        dumpfile_oil(bname);
      }
@@ -99,28 +93,22 @@ int main (int argc, char **argv) {
 }
 
 
-// open a pipe from CPP and assign it to yyin
-void cpp_popen (const char* filename) {
-   if (opt_D) {
-      cpp_command.append (" ");
-      cpp_command.append (cpp_define);
-   }
-   cpp_command.append (" ");
-   cpp_command.append (filename);
-   yyin = popen (cpp_command.c_str(), "r");
-   if (yyin == NULL) {
-      syserrprintf (cpp_command.c_str());
+// preprocess filename in process and set it as the scanner input
+void cpp_open (const char* filename) {
+   size_t length;
+   char* buffer = preproc_file (filename, &length);
+   if (buffer == NULL) {
       EXIT ();
    }
+   DEBUGF ('v', "filename = %s, buffer = %p, length = %zu\n",
+           filename, buffer, length);
+   scanner_setbuffer (buffer, length);
 }
 
 
-// close yyin
-void cpp_pclose (void) {
-   int pclose_rc = pclose (yyin);
-   if (pclose_rc != 0) 
-      errprintf("%: error: cpp closed with code \'%d\'.\n", 
-                pclose_rc);
+// release the preprocessed source buffer
+void cpp_close (void) {
+   preproc_release();
 }
 
 
@@ -130,11 +118,15 @@ const char* scan_opts (int argc, char** argv) {
    yy_flex_debug = 0;
    yydebug = 0;
    while (true) {
-      int opt = getopt (argc, argv, "@:D:ly");
+      int opt = getopt (argc, argv, "@:D:L:j:ly");
       if (opt == EOF) break;
       switch (opt) {
          case '@': set_debugflags (optarg);                            break;
-         case 'D': opt_D = true; cpp_define.append (optarg);           break;
+         case 'D': preproc_define (optarg);                            break;
+         case 'L': if (!scanner_setmode (optarg))
+                      errprintf ("%: unknown scanner (%s)\n", optarg);
+                   break;
+         case 'j': set_worker_threads (atoi (optarg));              break;
          case 'l': yy_flex_debug = 1;                                  break;
          case 'y': yydebug = 1;                                        break;
          default: errprintf ("%: unrecognized option (%c)\n", optopt); break;
@@ -164,7 +156,9 @@ void dumpfile_ast (char* bname) {
    string fname_ast = (bname);
    fname_ast.append (".ast");
    FILE *outfile_ast = fopen (fname_ast.c_str(), "w");
-   yyparse_ast->rec_dump(outfile_ast, 0);
+   flat_ast flat;
+   flatast_build (flat, yyparse_ast);
+   flatast_dump (outfile_ast, flat);
    fclose (outfile_ast);
 }
 
@@ -184,7 +178,11 @@ void dumpfile_sym (char* bname) {
 void dumpfile_oil (char* bname) {
    string fname_oil (bname);
    fname_oil.append (".oil");
+   oil_buffer oil;
+   static_cast<root*>(yyparse_ast)->dump_code(oil);
+   DEBUGSTMT ('i', oil.write(stderr); );
+   DEBUGSTMT ('p', irpass_report(stderr); );
    FILE *outfile_oil = fopen (fname_oil.c_str(), "w");
-   yyparse_ast->dump_code(outfile_oil);
+   oil.write(outfile_oil);
    fclose (outfile_oil);
 }
@@ -21,12 +21,15 @@
 #include "auxlib.h"
 #include "symtable.h"
 #include "ralib.h"
+#include "preproc.h"
+#include "flatast.h"
+#include "irpass.h"
 
-// open a pipe from CPP and assign it to yyin
-void cpp_popen (const char* filename);
+// preprocess filename in process and set it as the scanner input
+void cpp_open (const char* filename);
 
-// close yyin
-void cpp_pclose (void);
+// release the preprocessed source buffer
+void cpp_close (void);
 
 // scan options and setup oc
 const char* scan_opts (int argc, char **argv);
@@ -0,0 +1,280 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* benchmark driver for the oc front end
+ *
+ * usage: ocbench [-n runs] [-t threads] command file.oc...
+ *
+ * scan   - tokens per second of the flex scanner and the fast scanner
+ * intern - strings per second interned by 1 to threads threads at once
+ * parse  - parse time, allocations per parse and peak resident set size
+ * flat   - footprint and sweep time of the pointer tree and the flat ast
+ * check  - typecheck time, each file checked once into the global scope,
+ *          function bodies on threads threads
+ * oil    - code generation time and oil MB/s of each file once it has
+ *          been checked, function bodies on threads threads, and the
+ *          time spent in each ir pass
+ */
+
+#include <ctime>
+#include <new>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "oc.h"
+
+using namespace std;
+
+// ast.cc refers to the global symbol table defined by oc.cc
+SymbolTable global_scope(NULL);
+
+static int runs = 10;
+static size_t heap_allocs = 0;       // calls to operator new
+static int max_threads = std::thread::hardware_concurrency();
+static FILE* devnull = NULL;
+
+// count every heap allocation made through operator new
+void* operator new (size_t size) {
+   ++heap_allocs;
+   void* result = malloc (size);
+   if (result == NULL) throw std::bad_alloc();
+   return result;
+}
+
+void operator delete (void* ptr) noexcept { free (ptr); }
+void operator delete (void* ptr, size_t) noexcept { free (ptr); }
+
+// seconds elapsed since start
+static double elapsed (const timespec& start) {
+   timespec now;
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+// scan the preprocessed buffer runs times with the given scanner
+static void bench_scan (const char* fname, const char* mode,
+                        char* buffer, size_t length) {
+   scanner_setmode (mode);
+   scanner_settokfile (devnull);
+   size_t tokens = 0;
+   timespec start;
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   for (int run = 0; run < runs; ++run) {
+      scanner_setbuffer (buffer, length);
+      while (scanner_lex() != YYEOF) ++tokens;
+   }
+   double seconds = elapsed (start);
+   printf ("%-28s %-5s %10zu tokens %9.2f MB/s %12.0f tokens/s\n",
+           fname, mode, tokens / runs, length * runs / seconds / 1e6,
+           tokens / seconds);
+}
+
+static void cmd_scan (int argc, char** argv) {
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      bench_scan (argv[i], "flex", buffer, length);
+      bench_scan (argv[i], "fast", buffer, length);
+   }
+}
+
+// intern every identifier runs times
+static void intern_all (const vector<string>* idents) {
+   for (int run = 0; run < runs; ++run) {
+      for (size_t i = 0; i < idents->size(); ++i)
+         intern_stringset ((*idents)[i].data(), (*idents)[i].size());
+   }
+}
+
+static void cmd_intern (int argc, char** argv) {
+   // gather the identifiers of every file with the fast scanner
+   vector<string> idents;
+   scanner_setmode ("fast");
+   scanner_settokfile (devnull);
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      scanner_setbuffer (buffer, length);
+      for (int symbol; (symbol = scanner_lex()) != YYEOF; ) {
+         if (symbol == IDENT) idents.push_back (string (yytext, yyleng));
+      }
+   }
+   if (idents.empty()) return;
+   for (int nthreads = 1; nthreads <= max_threads; ++nthreads) {
+      vector<thread> threads;
+      timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      for (int t = 0; t < nthreads; ++t)
+         threads.push_back (thread (intern_all, &idents));
+      for (int t = 0; t < nthreads; ++t) threads[t].join();
+      double seconds = elapsed (start);
+      double interned = double (idents.size()) * runs * nthreads;
+      printf ("%3d threads %10zu idents %12.0f interns/s "
+              "%9.2f M/s per thread\n",
+              nthreads, idents.size(), interned / seconds,
+              interned / seconds / nthreads / 1e6);
+   }
+   printf ("%zu distinct strings\n", stringset_size());
+}
+
+static void cmd_parse (int argc, char** argv) {
+   scanner_setmode ("fast");
+   scanner_settokfile (devnull);
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      size_t allocs = 0;
+      astarena_stats arena = {0, 0, 0, 0};
+      double seconds = 0;
+      for (int run = 0; run < runs; ++run) {
+         scanner_setbuffer (buffer, length);
+         size_t before = heap_allocs;
+         timespec start;
+         clock_gettime (CLOCK_MONOTONIC, &start);
+         yyparse();
+         seconds += elapsed (start);
+         allocs += heap_allocs - before;
+         arena = astarena_getstats();
+         astarena_release();
+      }
+      rusage usage;
+      getrusage (RUSAGE_SELF, &usage);
+      printf ("%-28s %9.3f ms %9zu heap allocs %9zu arena allocs "
+              "%9zu arena KB %7ld KB peak RSS\n", argv[i],
+              seconds / runs * 1e3, allocs / runs, arena.allocs,
+              arena.bytes / 1024, usage.ru_maxrss);
+   }
+}
+
+// visit every node of the pointer tree, summing identifier locations
+static size_t walk_tree (ast* node) {
+   size_t sum = node->symbol == IDENT ? node->loc : 0;
+   for (size_t i = 0; i < node->children.size(); ++i)
+      sum += walk_tree (node->children[i]);
+   return sum;
+}
+
+// visit every node of the flat ast, summing identifier locations
+static size_t sweep_flat (const flat_ast& flat) {
+   size_t sum = 0;
+   for (size_t i = 0; i < flat.size(); ++i)
+      if (flat.symbol[i] == IDENT) sum += flat.loc[i];
+   return sum;
+}
+
+static void cmd_flat (int argc, char** argv) {
+   scanner_setmode ("fast");
+   scanner_settokfile (devnull);
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      scanner_setbuffer (buffer, length);
+      yyparse();
+      size_t tree_bytes = astarena_getstats().bytes;
+      flat_ast flat;
+      flatast_build (flat, yyparse_ast);
+      if (flat.size() == 0) continue;
+      timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      size_t tree_sum = 0;
+      for (int run = 0; run < runs; ++run)
+         tree_sum += walk_tree (yyparse_ast);
+      double tree_seconds = elapsed (start);
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      size_t flat_sum = 0;
+      for (int run = 0; run < runs; ++run) flat_sum += sweep_flat (flat);
+      double flat_seconds = elapsed (start);
+      if (tree_sum != flat_sum)
+         errprintf ("%: %s: sweeps disagree\n", argv[i]);
+      printf ("%-28s %9zu nodes  tree %6.1f B/node %9.3f ms  "
+              "flat %6.1f B/node %9.3f ms\n", argv[i], flat.size(),
+              double (tree_bytes) / flat.size(), tree_seconds / runs * 1e3,
+              double (flat.bytes()) / flat.size(), flat_seconds / runs * 1e3);
+      astarena_release();
+   }
+}
+
+static void cmd_check (int argc, char** argv) {
+   set_worker_threads (max_threads);
+   scanner_setmode ("fast");
+   scanner_settokfile (devnull);
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      scanner_setbuffer (buffer, length);
+      yyparse();
+      timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      yyparse_ast->rec_typecheck();
+      double seconds = elapsed (start);
+      printf ("%-28s %9.3f ms typecheck\n", argv[i], seconds * 1e3);
+   }
+}
+
+static void cmd_oil (int argc, char** argv) {
+   set_worker_threads (max_threads);
+   scanner_setmode ("fast");
+   scanner_settokfile (devnull);
+   for (int i = 0; i < argc; ++i) {
+      size_t length;
+      char* buffer = preproc_file (argv[i], &length);
+      if (buffer == NULL) continue;
+      scanner_setbuffer (buffer, length);
+      yyparse();
+      yyparse_ast->rec_typecheck();
+      // like oc, generate code only for programs that typecheck
+      if (get_exitstatus() != EXIT_SUCCESS) continue;
+      oil_buffer oil;
+      irpass_reset();
+      timespec start;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      static_cast<root*> (yyparse_ast)->dump_code (oil);
+      oil.write (devnull);
+      double seconds = elapsed (start);
+      printf ("%-28s %9.3f ms codegen %9zu bytes %9.2f MB/s\n", argv[i],
+              seconds * 1e3, oil.size(), oil.size() / seconds / 1e6);
+      irpass_report (stdout);
+   }
+}
+
+int main (int argc, char** argv) {
+   set_execname (argv[0]);
+   yy_flex_debug = 0;
+   while (true) {
+      int opt = getopt (argc, argv, "n:t:");
+      if (opt == EOF) break;
+      if (opt == 'n') runs = atoi (optarg);
+      else if (opt == 't') max_threads = atoi (optarg);
+      else errprintf ("%: unrecognized option (%c)\n", optopt);
+   }
+   if (max_threads < 1) max_threads = 1;
+   if (optind >= argc || runs < 1) {
+      errprintf ("%: Usage: \"%s [-n runs] [-t threads] command "
+                 "file.oc...\"\n", get_execname());
+      return get_exitstatus();
+   }
+   devnull = fopen ("/dev/null", "w");
+   string command (argv[optind]);
+   if (command == "scan") {
+      cmd_scan (argc - optind - 1, argv + optind + 1);
+   }else if (command == "parse") {
+      cmd_parse (argc - optind - 1, argv + optind + 1);
+   }else if (command == "flat") {
+      cmd_flat (argc - optind - 1, argv + optind + 1);
+   }else if (command == "check") {
+      cmd_check (argc - optind - 1, argv + optind + 1);
+   }else if (command == "oil") {
+      cmd_oil (argc - optind - 1, argv + optind + 1);
+   }else if (command == "intern") {
+      cmd_intern (argc - optind - 1, argv + optind + 1);
+   }else {
+      errprintf ("%: unknown command (%s)\n", command.c_str());
+   }
+   return get_exitstatus();
+}
@@ -0,0 +1,94 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The code generator used to hand every line to fprintf, with each
+// argument copied into a std::string on the way.  It now appends to a
+// buffer that doubles as it fills and is written out in one piece.
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "oilbuf.h"
+#include "auxlib.h"
+
+using namespace std;
+
+static const size_t FIRST_CAPACITY = 64 * 1024;
+
+oil_buffer::oil_buffer (oil_buffer&& other) : buf(other.buf),
+      used(other.used), capacity(other.capacity), indented(other.indented),
+      nested(other.nested) {
+   other.buf = NULL;
+   other.used = other.capacity = 0;
+}
+
+oil_buffer::~oil_buffer() { free (buf); }
+
+// make room for length more bytes
+void oil_buffer::grow (size_t length) {
+   size_t wanted = capacity == 0 ? FIRST_CAPACITY : capacity * 2;
+   while (wanted < used + length) wanted *= 2;
+   char* bigger = static_cast<char*> (realloc (buf, wanted));
+   if (bigger == NULL) {
+      errprintf ("%: out of memory for the oil buffer\n");
+      abort();
+   }
+   buf = bigger;
+   capacity = wanted;
+}
+
+// write the digits of number backwards from the end of digits,
+// returning where they start
+static char* format_int (char* end, int number) {
+   unsigned int magnitude = number < 0 ? 0u - number : number;
+   char* digits = end;
+   do {
+      *--digits = '0' + magnitude % 10;
+      magnitude /= 10;
+   }while (magnitude != 0);
+   if (number < 0) *--digits = '-';
+   return digits;
+}
+
+void oil_buffer::put (int number) {
+   char digits[16];
+   char* begin = format_int (digits + sizeof digits, number);
+   put (begin, digits + sizeof digits - begin);
+}
+
+void oil_buffer::write (FILE* file) const {
+   fflush (file);
+   int fd = fileno (file);
+   for (size_t done = 0; done < used; ) {
+      ssize_t wrote = ::write (fd, buf + done, used - done);
+      if (wrote < 0) {
+         syserrprintf ("oil");
+         return;
+      }
+      done += wrote;
+   }
+}
+
+void append_int (string& name, int number) {
+   char digits[16];
+   char* begin = format_int (digits + sizeof digits, number);
+   name.append (begin, digits + sizeof digits - begin);
+}
+
+const char* oil_literal (oil_buffer& out, const char* format) {
+   for (;;) {
+      const char* percent = strchr (format, '%');
+      if (percent == NULL) {
+         out.put (format);
+         return NULL;
+      }
+      out.put (format, percent - format);
+      if (percent[1] != '%') return percent[1] == '\0' ? NULL : percent + 2;
+      out.put ('%');
+      format = percent + 2;
+   }
+}
+
+void oil_mismatch (const char* format) {
+   errprintf ("%: codegen: arguments do not match \"%s\"\n", format);
+}
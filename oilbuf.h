@@ -0,0 +1,102 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* growable output buffer the oil code is generated into */
+
+#ifndef __OILBUF_H__
+#define __OILBUF_H__
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Code is appended to one buffer per thread and written out with a
+// single write once the whole file is done.  Names, labels and small
+// integers are copied in directly, without building strings first.
+class oil_buffer {
+public:
+   oil_buffer() : buf(NULL), used(0), capacity(0), indented(false),
+         nested(0) {}
+   oil_buffer(oil_buffer&& other);
+   oil_buffer(const oil_buffer&) = delete;
+   oil_buffer& operator=(const oil_buffer&) = delete;
+   ~oil_buffer();
+
+   size_t size() const { return used; }
+   const char* data() const { return buf; }
+   void clear() { used = 0; }
+
+   // indent each emit by 8 spaces while on
+   void set_indent (bool on) { indented = on; }
+   bool indent() const { return indented; }
+
+   // and by 3 more for each loop the code is written in
+   void nest (int levels) { nested += levels; }
+   int nesting() const { return nested; }
+
+   void put (const char* text, size_t length) {
+      if (used + length > capacity) grow (length);
+      memcpy (buf + used, text, length);
+      used += length;
+   }
+   void put (char c) {
+      if (used == capacity) grow (1);
+      buf[used++] = c;
+   }
+   void put (const char* text) { put (text, strlen (text)); }
+   void put (const std::string& text) { put (text.data(), text.size()); }
+   void put (int number);
+
+   // write the buffer to file with one write, after anything file
+   // still holds in its own buffer
+   void write (FILE* file) const;
+
+private:
+   void grow (size_t length);
+   char* buf;
+   size_t used;
+   size_t capacity;
+   bool indented;
+   int nested;
+};
+
+// append the decimal digits of number to name
+void append_int (std::string& name, int number);
+
+// copy format up to its next placeholder into out.  returns what
+// follows the placeholder or NULL if there is none left.
+const char* oil_literal (oil_buffer& out, const char* format);
+
+// report an emit with more placeholders than arguments or fewer
+void oil_mismatch (const char* format);
+
+inline void oil_format (oil_buffer& out, const char* format) {
+   if (oil_literal (out, format) != NULL) oil_mismatch (format);
+}
+
+template <typename First, typename... Rest>
+void oil_format (oil_buffer& out, const char* format, const First& first,
+                 const Rest&... rest) {
+   const char* after = oil_literal (out, format);
+   if (after == NULL) {
+      oil_mismatch (format);
+      return;
+   }
+   out.put (first);
+   oil_format (out, after, rest...);
+}
+
+// Write format to out, each "%s" or "%d" replaced by the next argument.
+// How an argument is written depends only on its type, which must be
+// one oil_buffer::put takes, so there is nothing to get wrong in the
+// format itself.  "%%" writes a "%".
+template <typename... Args>
+void emit (oil_buffer& out, const char* format, const Args&... args) {
+   if (out.indent()) {
+      out.put ("        ", 8);
+      for (int level = out.nesting(); level > 0; --level) out.put ("   ", 3);
+   }
+   oil_format (out, format, args...);
+}
+
+#endif // __OILBUF_H__
@@ -0,0 +1,473 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Each block is written in order under its label, if some goto names
+// it.  A block that falls through needs no jump, and a branch needs
+// only the jump for the side that is not the next block.  Temps are declared
+// where they are written; locals where the move declaring them is.
+// Every function but __ocmain is static, since only the oil calls it.
+//
+// A loop is written as a for instead when its blocks run from a header
+// holding no more than its test to the one block going back to it, the
+// test leaving for the block after that.  Nothing outside may jump into
+// the run, and nothing declared in it may be used outside it.  The
+// pointers the loop walks that nothing else reaches are declared
+// restrict by the for, so that they mean nothing past it, and the
+// steps at the end of the last block are the for's steps.  A loop whose
+// trips are independent gets a pragma saying so, for gcc to vectorize.
+
+#include "oilgen.h"
+#include "astutils.h"
+
+using namespace std;
+
+// write "type name = " or "name = " for what instr writes, indented
+static void put_dst (oil_buffer& out, const ir_function& fn,
+                     const ir_instr& instr) {
+   emit (out, "");
+   if (instr.dst.kind == IR_NONE) return;
+   if (instr.dst.kind == IR_TEMP || instr.declares) {
+      oil_format (out, "%s ", getOilType (fn.type (instr.dst)));
+   }
+   ir_put_operand (out, fn, instr.dst);
+   out.put (" = ");
+}
+
+static void put_alloc (oil_buffer& out, const ir_function& fn,
+                       const ir_instr& instr) {
+   const string& oil_type = getOilType (instr.type);
+   if (instr.op == 0) { // NEW basetype()
+      // the declared type is spelled out as the ast has always done
+      emit (out, "");
+      if (isUsertype (instr.type)) {
+         oil_format (out, "struct %s ", oil_type);
+         ir_put_operand (out, fn, instr.dst);
+         oil_format (out, " = xcalloc (1, sizeof (struct %s));\n", oil_type);
+      }else {
+         oil_format (out, "%s ", oil_type);
+         ir_put_operand (out, fn, instr.dst);
+         oil_format (out, " = xcalloc (1, sizeof (%s));\n", oil_type);
+      }
+      return;
+   }
+   if (instr.op == '(') { // NEW string(expr)
+      emit (out, "ubyte* ");
+      ir_put_operand (out, fn, instr.dst);
+      out.put (" = xcalloc (");
+      ir_put_operand (out, fn, instr.a);
+      out.put (", sizeof (ubyte));\n");
+      return;
+   }
+   put_dst (out, fn, instr);
+   out.put ("xcalloc (");
+   ir_put_operand (out, fn, instr.a);
+   if (instr.type == type_array (TYPE_STRING)) {
+      out.put (", sizeof (ubyte*));\n");
+   }else {
+      oil_format (out, ", sizeof (%s));\n", oil_type);
+   }
+}
+
+// the value a move, binary or unary instruction computes
+static void put_expr (oil_buffer& out, const ir_function& fn,
+                      const ir_instr& instr) {
+   switch (instr.opcode) {
+      case IR_BINARY:
+         ir_put_operand (out, fn, instr.a);
+         oil_format (out, " %s ", ir_opname (instr.op));
+         ir_put_operand (out, fn, instr.b);
+         break;
+      case IR_UNARY:
+         if (instr.op == ORD || instr.op == CHR) out.put ("(int) ");
+         else out.put (ir_opname (instr.op));
+         ir_put_operand (out, fn, instr.a);
+         break;
+      default:
+         ir_put_operand (out, fn, instr.a);
+         break;
+   }
+}
+
+static void put_instr (oil_buffer& out, const ir_function& fn,
+                       const ir_instr& instr) {
+   switch (instr.opcode) {
+      case IR_MOVE:
+      case IR_BINARY:
+      case IR_UNARY:
+         put_dst (out, fn, instr);
+         put_expr (out, fn, instr);
+         out.put (";\n");
+         break;
+      case IR_CALL:
+         put_dst (out, fn, instr);
+         out.put (instr.callee->oil_name);
+         out.put ('(');
+         for (uint32_t i = 0; i < instr.arg_count; ++i) {
+            if (i > 0) out.put (", ");
+            ir_put_operand (out, fn, fn.args[instr.first_arg + i]);
+         }
+         out.put (");\n");
+         break;
+      case IR_ALLOC:
+         put_alloc (out, fn, instr);
+         break;
+   }
+}
+
+static void put_label (oil_buffer& out, const ir_block& block) {
+   oil_format (out, "%s_%d", block.label, block.label_number);
+}
+
+static void put_goto (oil_buffer& out, const ir_function& fn, uint32_t b) {
+   out.put ("goto ");
+   put_label (out, fn.blocks[b]);
+   out.put (";\n");
+}
+
+static void put_exit (oil_buffer& out, const ir_function& fn, uint32_t b) {
+   const ir_block& block = fn.blocks[b];
+   switch (block.exit) {
+      case IR_FALL:
+         break;
+      case IR_JUMP:
+         emit (out, "");
+         put_goto (out, fn, block.succ[0]);
+         break;
+      case IR_BRANCH:
+         if (block.succ[0] == b + 1) {
+            emit (out, "if (!");
+            ir_put_operand (out, fn, block.value);
+            out.put (") ");
+            put_goto (out, fn, block.succ[1]);
+         }else {
+            emit (out, "if (");
+            ir_put_operand (out, fn, block.value);
+            out.put (") ");
+            put_goto (out, fn, block.succ[0]);
+            if (block.succ[1] != b + 1) {
+               emit (out, "");
+               put_goto (out, fn, block.succ[1]);
+            }
+         }
+         break;
+      case IR_RETURN:
+         if (block.value.kind == IR_NONE) {
+            emit (out, "return;\n");
+         }else {
+            emit (out, "return ");
+            ir_put_operand (out, fn, block.value);
+            out.put (";\n");
+         }
+         break;
+      case IR_HALT:
+         break;
+   }
+}
+
+// a loop written as a for, by its header
+struct for_loop {
+   uint32_t last;                // going back to the header, IR_NO_BLOCK
+                                 // if the block heads no for
+   size_t steps;                 // where the for's steps start in last
+   vector<size_t> declared;      // the pointers the for declares, by
+                                 // place in the block before the header
+};
+
+// the first and last blocks something is named in
+typedef pair<uint32_t, uint32_t> span;
+
+static void widen (span& named, uint32_t b) {
+   if (b < named.first) named.first = b;
+   if (b > named.second) named.second = b;
+}
+
+static void note_span (const ir_function& fn, ir_operand operand, uint32_t b,
+                       vector<span>& temps, vector<span>& vars) {
+   switch (operand.kind) {
+      case IR_TEMP:
+         widen (temps[operand.id], b);
+         break;
+      case IR_VAR:
+         widen (vars[operand.id], b);
+         break;
+      case IR_INDEX:
+      case IR_FIELD:
+         note_span (fn, fn.refs[operand.id].base, b, temps, vars);
+         note_span (fn, fn.refs[operand.id].index, b, temps, vars);
+         break;
+      default:
+         break;
+   }
+}
+
+static bool names_var (const ir_function& fn, ir_operand operand,
+                       uint32_t var) {
+   switch (operand.kind) {
+      case IR_VAR:
+         return operand.id == var;
+      case IR_INDEX:
+      case IR_FIELD:
+         return names_var (fn, fn.refs[operand.id].base, var)
+             || names_var (fn, fn.refs[operand.id].index, var);
+      default:
+         return false;
+   }
+}
+
+// a variable set from variables and literals, fit for a for's steps
+static bool is_step (const ir_instr& instr) {
+   if (instr.declares || instr.dst.kind != IR_VAR
+       || (instr.opcode != IR_MOVE && instr.opcode != IR_BINARY
+           && instr.opcode != IR_UNARY))
+      return false;
+   ir_operand_kind a = instr.a.kind;
+   ir_operand_kind b = instr.b.kind;
+   return (a == IR_VAR || a == IR_CONST)
+       && (b == IR_NONE || b == IR_VAR || b == IR_CONST);
+}
+
+// The restrict pointers declared just before the header and named
+// nowhere after the loop, all of one type.
+static void find_declared (const ir_function& fn, uint32_t h,
+                           const vector<span>& vars, for_loop& loop) {
+   const ir_block& before = fn.blocks[h - 1];
+   if (before.exit != IR_FALL) return;
+   typeref type = 0;
+   for (size_t i = 0; i < before.instrs.size(); ++i) {
+      const ir_instr& instr = before.instrs[i];
+      if (!instr.declares || instr.dst.kind != IR_VAR
+          || !fn.vars[instr.dst.id].restricted
+          || vars[instr.dst.id].first != h - 1
+          || vars[instr.dst.id].second > loop.last
+          || (!loop.declared.empty() && fn.vars[instr.dst.id].type != type))
+         continue;
+      bool named = false;
+      for (size_t k = i + 1; k < before.instrs.size() && !named; ++k) {
+         const ir_instr& later = before.instrs[k];
+         named = names_var (fn, later.dst, instr.dst.id)
+              || names_var (fn, later.a, instr.dst.id)
+              || names_var (fn, later.b, instr.dst.id);
+         for (uint32_t a = 0; a < later.arg_count; ++a)
+            named = named || names_var (fn, fn.args[later.first_arg + a],
+                                        instr.dst.id);
+      }
+      if (named) continue;
+      type = fn.vars[instr.dst.id].type;
+      loop.declared.push_back (i);
+   }
+}
+
+// the loops of fn that can be written as fors
+static void find_fors (const ir_function& fn, vector<for_loop>& fors) {
+   uint32_t nblocks = fn.blocks.size();
+   for_loop none;
+   none.last = IR_NO_BLOCK;
+   none.steps = 0;
+   fors.assign (nblocks, none);
+   const span nowhere (UINT32_MAX, 0);
+   vector<uint32_t> npreds (nblocks, 0);
+   vector<span> preds (nblocks, nowhere);
+   vector<span> temps (fn.temps.size(), nowhere);
+   vector<span> vars (fn.vars.size(), nowhere);
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      uint32_t succ[2];
+      int nsucc = ir_successors (fn, b, succ);
+      for (int s = 0; s < nsucc; ++s) {
+         ++npreds[succ[s]];
+         widen (preds[succ[s]], b);
+      }
+      const ir_block& block = fn.blocks[b];
+      for (size_t i = 0; i < block.instrs.size(); ++i) {
+         const ir_instr& instr = block.instrs[i];
+         note_span (fn, instr.dst, b, temps, vars);
+         note_span (fn, instr.a, b, temps, vars);
+         note_span (fn, instr.b, b, temps, vars);
+         for (uint32_t a = 0; a < instr.arg_count; ++a)
+            note_span (fn, fn.args[instr.first_arg + a], b, temps, vars);
+      }
+      note_span (fn, block.value, b, temps, vars);
+   }
+   // how far what each block declares is named
+   vector<span> reach (nblocks, nowhere);
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      const vector<ir_instr>& instrs = fn.blocks[b].instrs;
+      for (size_t i = 0; i < instrs.size(); ++i) {
+         const span* named = NULL;
+         if (instrs[i].dst.kind == IR_TEMP) named = &temps[instrs[i].dst.id];
+         else if (instrs[i].declares) named = &vars[instrs[i].dst.id];
+         if (named == NULL) continue;
+         widen (reach[b], named->first);
+         widen (reach[b], named->second);
+      }
+   }
+
+   vector<uint32_t> open;        // the last blocks of the fors around h
+   for (uint32_t h = 0; h < nblocks; ++h) {
+      while (!open.empty() && open.back() < h) open.pop_back();
+      const ir_block& header = fn.blocks[h];
+      if (header.exit != IR_BRANCH || header.succ[0] != h + 1
+          || header.succ[1] < h + 2)
+         continue;
+      uint32_t last = header.succ[1] - 1;
+      if (fn.blocks[last].exit != IR_JUMP || fn.blocks[last].succ[0] != h
+          || (!open.empty() && open.back() < last))
+         continue;
+      if (!header.instrs.empty()) {
+         const ir_instr& test = header.instrs[0];
+         if (header.instrs.size() > 1
+             || (test.opcode != IR_BINARY && test.opcode != IR_UNARY)
+             || test.dst.kind != IR_TEMP || header.value.kind != IR_TEMP
+             || header.value.id != test.dst.id
+             || temps[test.dst.id] != span (h, h))
+            continue;
+      }
+      // the header is come to from the block before it and from last
+      uint32_t expected = 1;
+      if (h > 0) {
+         uint32_t succ[2];
+         int nsucc = ir_successors (fn, h - 1, succ);
+         for (int s = 0; s < nsucc; ++s) expected += succ[s] == h;
+      }
+      bool fits = npreds[h] == expected;
+      for (uint32_t b = h + 1; b <= last && fits; ++b) {
+         fits = preds[b].first >= h && preds[b].second <= last
+             && reach[b].first >= h && reach[b].second <= last;
+      }
+      if (!fits) continue;
+      for_loop& loop = fors[h];
+      loop.last = last;
+      const vector<ir_instr>& instrs = fn.blocks[last].instrs;
+      loop.steps = instrs.size();
+      while (loop.steps > 0 && is_step (instrs[loop.steps - 1]))
+         --loop.steps;
+      if (h > 0) find_declared (fn, h, vars, loop);
+      open.push_back (last);
+   }
+}
+
+static void put_for (oil_buffer& out, const ir_function& fn, uint32_t h,
+                     const for_loop& loop) {
+   const ir_block& header = fn.blocks[h];
+   if (header.independent) out.put ("#pragma GCC ivdep\n");
+   emit (out, "for (");
+   for (size_t k = 0; k < loop.declared.size(); ++k) {
+      const ir_instr& instr = fn.blocks[h - 1].instrs[loop.declared[k]];
+      const string& type = getOilType (fn.type (instr.dst));
+      if (k == 0) oil_format (out, "%s restrict ", type);
+      else oil_format (out, ", %s restrict ", type.substr (type.find ('*')));
+      ir_put_operand (out, fn, instr.dst);
+      out.put (" = ");
+      ir_put_operand (out, fn, instr.a);
+   }
+   out.put ("; ");
+   if (header.instrs.empty()) ir_put_operand (out, fn, header.value);
+   else put_expr (out, fn, header.instrs[0]);
+   out.put ("; ");
+   const vector<ir_instr>& instrs = fn.blocks[loop.last].instrs;
+   for (size_t i = loop.steps; i < instrs.size(); ++i) {
+      if (i > loop.steps) out.put (", ");
+      ir_put_operand (out, fn, instrs[i].dst);
+      out.put (" = ");
+      put_expr (out, fn, instrs[i]);
+   }
+   out.put (") {\n");
+}
+
+// the blocks put_exit writes a goto to, but for the exits of the
+// headers and last blocks of fors
+static void find_targets (const ir_function& fn,
+                          const vector<for_loop>& fors,
+                          const vector<uint32_t>& closes,
+                          vector<char>& targeted) {
+   targeted.assign (fn.blocks.size(), 0);
+   for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+      const ir_block& block = fn.blocks[b];
+      if (fors[b].last != IR_NO_BLOCK || closes[b] != IR_NO_BLOCK) continue;
+      if (block.exit == IR_JUMP) {
+         targeted[block.succ[0]] = 1;
+      }else if (block.exit == IR_BRANCH) {
+         if (block.succ[0] == b + 1) {
+            targeted[block.succ[1]] = 1;
+         }else {
+            targeted[block.succ[0]] = 1;
+            if (block.succ[1] != b + 1) targeted[block.succ[1]] = 1;
+         }
+      }
+   }
+}
+
+static void put_header (oil_buffer& out, const ir_function& fn) {
+   if (fn.main) {
+      out.put ("\nvoid __ocmain ()\n{\n");
+      return;
+   }
+   oil_format (out, "static %s\n%s(\n", getOilType (fn.result),
+               stringset_cstr (fn.name));
+   out.set_indent (true);
+   for (size_t p = 0; p < fn.params.size(); ++p) {
+      const ir_var& param = fn.vars[fn.params[p]];
+      emit (out, "%s %s", getOilType (param.type), stringset_cstr (param.name));
+      if (p + 1 < fn.params.size()) out.put (",\n");
+   }
+   out.set_indent (false);
+   out.put (")\n{\n");
+}
+
+void oilgen_prototype (oil_buffer& out, const ir_function& fn) {
+   oil_format (out, "static %s %s (", getOilType (fn.result),
+               stringset_cstr (fn.name));
+   for (size_t p = 0; p < fn.params.size(); ++p) {
+      if (p > 0) out.put (", ");
+      out.put (getOilType (fn.vars[fn.params[p]].type));
+   }
+   out.put (");\n");
+}
+
+void oilgen_function (oil_buffer& out, const ir_function& fn) {
+   put_header (out, fn);
+   uint32_t nblocks = fn.blocks.size();
+   vector<for_loop> fors;
+   find_fors (fn, fors);
+   vector<uint32_t> closes (nblocks, IR_NO_BLOCK);
+   for (uint32_t h = 0; h < nblocks; ++h) {
+      if (fors[h].last != IR_NO_BLOCK) closes[fors[h].last] = h;
+   }
+   vector<char> targeted;
+   find_targets (fn, fors, closes, targeted);
+   for (uint32_t b = 0; b < nblocks; ++b) {
+      const ir_block& block = fn.blocks[b];
+      if (block.label != NULL && targeted[b]) {
+         put_label (out, block);
+         out.put (":;\n");
+      }
+      out.set_indent (true);
+      if (fors[b].last != IR_NO_BLOCK) {
+         put_for (out, fn, b, fors[b]);
+         out.nest (1);
+         out.set_indent (false);
+         continue;
+      }
+      const vector<size_t>* declared = NULL;
+      if (b + 1 < nblocks && fors[b + 1].last != IR_NO_BLOCK)
+         declared = &fors[b + 1].declared;
+      size_t end = block.instrs.size();
+      if (closes[b] != IR_NO_BLOCK) end = fors[closes[b]].steps;
+      size_t skip = 0;
+      for (size_t i = 0; i < end; ++i) {
+         if (declared != NULL && skip < declared->size()
+             && (*declared)[skip] == i) {
+            ++skip;
+            continue;
+         }
+         put_instr (out, fn, block.instrs[i]);
+      }
+      if (closes[b] != IR_NO_BLOCK) {
+         out.nest (-1);
+         emit (out, "}\n");
+      }else {
+         put_exit (out, fn, b);
+      }
+      out.set_indent (false);
+   }
+   out.put (fn.main ? "}\n" : "}\n\n");
+}
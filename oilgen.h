@@ -0,0 +1,18 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* lowering of the ir to oil, the c code handed to gcc */
+
+#ifndef __OILGEN_H__
+#define __OILGEN_H__
+
+#include "ir.h"
+#include "oilbuf.h"
+
+// write the definition of fn as oil
+void oilgen_function (oil_buffer& out, const ir_function& fn);
+
+// write a declaration of fn, for calls written before it is
+void oilgen_prototype (oil_buffer& out, const ir_function& fn);
+
+#endif // __OILGEN_H__
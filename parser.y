@@ -6,6 +6,8 @@
 #include "lyutils.h"
 #include "ast.h"
 
+#define yylex scanner_lex
+
 %}
 
 %debug
@@ -14,11 +16,18 @@
 %token-table
 %verbose
 
+/* tokens are indexes into the token buffer, an ast node is made only
+   for the tokens an action keeps (see tokbuf_node) */
+%union {
+   ast* node;
+   int token;
+}
+
 /* regular tokens */
-%token VOID      BOOL      CHAR      INT       STRING
-%token IF        ELSE      WHILE     RETURN    STRUCT
-%token ARRAY     IDENT     TOK_TRUE  TOK_NULL  TOK_FALSE 
-%token STRINGCON INTCON    CHARCON   ERROR
+%token <token> VOID      BOOL      CHAR      INT       STRING
+%token <token> IF        ELSE      WHILE     RETURN    STRUCT
+%token <token> ARRAY     IDENT     TOK_TRUE  TOK_NULL  TOK_FALSE 
+%token <token> STRINGCON INTCON    CHARCON   ERROR
 
 /* nonterminal and root */
 %token NT ROOT
@@ -27,21 +36,25 @@
 %right ELSE "then"
 
 /* binary ops */
-%right '='
-%left  EQ NE LT LE GT GE
-%left  '+' '-'
-%left  '*' '/' '%'
+%right <token> '='
+%left  <token> EQ NE LT LE GT GE
+%left  <token> '+' '-'
+%left  <token> '*' '/' '%'
 
 /* unary ops */
-%right POS NEG '!' ORD CHR
-%left  NEW
+%right <token> POS NEG '!' ORD CHR
+%left  <token> NEW
 
 /* other */
 %left  ARRAY
-%right '[' '.' '{' '('
+%right <token> '[' '.' '{' '('
 %nonassoc "low"
 %nonassoc "high"
 
+%type <node> program structdef field function params paramlist block
+%type <node> stmtseq stmt vardecl decl type basetype while ifelse return
+%type <node> expr binop unop allocator call args arglist variable constant
+
 %start program
 
 %%
@@ -49,18 +62,20 @@
 program   : program stmt        { $$ = $1->add($2); }
           | program function    { $$ = $1->add($2); }
           | program structdef   { $$ = $1->add($2); }
-          | program error       { $$ = $1->add($2); }
+          | program error       { $$ = $1; }
           |                     { $$ = new root(); }
           ;
 
-structdef : STRUCT IDENT '{' field '}' { $$ = new structdef($2, $4); }
+structdef : STRUCT IDENT '{' field '}'
+                                { $$ = new structdef(tokbuf_node($2), $4); }
           ;
 
 field     : decl ';' field      { $$ = $3->add($1); }
           |                     { $$ = new field(); }
           ;
 
-function  : type IDENT '(' params ')' block { $$ = new func($1, $2, $4, $6); }
+function  : type IDENT '(' params ')' block
+                                { $$ = new func($1, tokbuf_node($2), $4, $6); }
           ;
 
 params    : paramlist           { $$ = $1; }
@@ -88,22 +103,23 @@ stmt      : block               { $$ = $1; }
           | expr ';'            { $$ = $1; }
           ;
 
-vardecl   : type IDENT '=' expr ';' { $$ = new vardecl($1, $2, $3, $4); }
+vardecl   : type IDENT '=' expr ';' { $$ = new vardecl($1, tokbuf_node($2),
+                                                   tokbuf_node($3), $4); }
           ;
 
-decl      : type IDENT          { $$ = new decl($1, $2); }
+decl      : type IDENT          { $$ = new decl($1, tokbuf_node($2)); }
           ;
 
 type      : basetype            { $$ = new type($1); }
-          | basetype ARRAY      { $$ = new type($1, $2); }
+          | basetype ARRAY      { $$ = new type($1, tokbuf_node($2)); }
           ;
 
-basetype  : VOID                { $$ = new basetype($1); }
-          | BOOL                { $$ = new basetype($1); }
-          | CHAR                { $$ = new basetype($1); }
-          | INT                 { $$ = new basetype($1); }
-          | STRING              { $$ = new basetype($1); }
-          | IDENT               { $$ = new basetype($1); }
+basetype  : VOID                { $$ = new basetype(tokbuf_node($1)); }
+          | BOOL                { $$ = new basetype(tokbuf_node($1)); }
+          | CHAR                { $$ = new basetype(tokbuf_node($1)); }
+          | INT                 { $$ = new basetype(tokbuf_node($1)); }
+          | STRING              { $$ = new basetype(tokbuf_node($1)); }
+          | IDENT               { $$ = new basetype(tokbuf_node($1)); }
           ;
 
 while     : WHILE '(' expr ')' stmt { $$ = new loop($3, $5); }
@@ -113,8 +129,10 @@ ifelse    : IF '(' expr ')' stmt %prec "then" { $$ = new ifelse($3, $5); }
           | IF '(' expr ')' stmt ELSE stmt    { $$ = new ifelse($3, $5, $7); } 
           ;
 
-return    : RETURN ';'          { $$ = new funcreturn(); $$->absorb($1); }
-          | RETURN expr ';'     { $$ = new funcreturn(); $$->add($2); $$->absorb($1); }
+return    : RETURN ';'          { $$ = new funcreturn();
+                                  $$->absorb(tokbuf_node($1)); }
+          | RETURN expr ';'     { $$ = new funcreturn(); $$->add($2);
+                                  $$->absorb(tokbuf_node($1)); }
           ;
 
 expr      : variable            { $$ = $1; }
@@ -126,33 +144,35 @@ expr      : variable            { $$ = $1; }
           | '(' expr ')'        { $$ = $2; }
           ;
 
-binop     : expr '=' expr       { $$ = new binop($1, $2, $3); }
-          | expr EQ expr        { $$ = new binop($1, $2, $3); }
-          | expr NE expr        { $$ = new binop($1, $2, $3); }
-          | expr GT expr        { $$ = new binop($1, $2, $3); }
-          | expr GE expr        { $$ = new binop($1, $2, $3); }
-          | expr LT expr        { $$ = new binop($1, $2, $3); }
-          | expr LE expr        { $$ = new binop($1, $2, $3); }
-          | expr '+' expr       { $$ = new binop($1, $2, $3); }
-          | expr '-' expr       { $$ = new binop($1, $2, $3); }
-          | expr '*' expr       { $$ = new binop($1, $2, $3); }
-          | expr '/' expr       { $$ = new binop($1, $2, $3); }
-          | expr '%' expr       { $$ = new binop($1, $2, $3); }
+binop     : expr '=' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr EQ expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr NE expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr GT expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr GE expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr LT expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr LE expr        { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr '+' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr '-' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr '*' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr '/' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
+          | expr '%' expr       { $$ = new binop($1, tokbuf_node($2), $3); }
           ;
 
-unop      : '+' expr %prec POS  { $$ = new unop($1, $2); }
-          | '-' expr %prec NEG  { $$ = new unop($1, $2); }
-          | '!' expr %prec '!'  { $$ = new unop($1, $2); }
-          | ORD expr %prec ORD  { $$ = new unop($1, $2); }
-          | CHR expr %prec CHR  { $$ = new unop($1, $2); }
+unop      : '+' expr %prec POS  { $$ = new unop(tokbuf_node($1), $2); }
+          | '-' expr %prec NEG  { $$ = new unop(tokbuf_node($1), $2); }
+          | '!' expr %prec '!'  { $$ = new unop(tokbuf_node($1), $2); }
+          | ORD expr %prec ORD  { $$ = new unop(tokbuf_node($1), $2); }
+          | CHR expr %prec CHR  { $$ = new unop(tokbuf_node($1), $2); }
           ;
 
-allocator : NEW basetype '(' expr ')' { $$ = new alloc($2, $3, $4); }
-          | NEW basetype '[' expr ']' { $$ = new alloc($2, $3, $4); }
+allocator : NEW basetype '(' expr ')'
+                                { $$ = new alloc($2, tokbuf_node($3), $4); }
+          | NEW basetype '[' expr ']'
+                                { $$ = new alloc($2, tokbuf_node($3), $4); }
           | NEW basetype '(' ')'      { $$ = new alloc($2); }
           ;
 
-call      : IDENT '(' args ')'  { $$ = new call($1, $3); }
+call      : IDENT '(' args ')'  { $$ = new call(tokbuf_node($1), $3); }
           ;
 
 args      : arglist             { $$ = $1; }
@@ -163,17 +183,20 @@ arglist   : arglist ',' expr    { $$ = $1->add($3); }
           | expr                { $$ = new arguments(); $$->add($1); }
           ;
 
-variable  : IDENT               { $$ = new variable($1); }
-          | expr '[' expr ']'   { $$ = new variable($1, $2, $3); }
-          | expr '.' IDENT      { $$ = new variable($1, $2, $3); }
+variable  : IDENT               { $$ = new variable(tokbuf_node($1)); }
+          | expr '[' expr ']'   { $$ = new variable($1, tokbuf_node($2), $3); }
+          | expr '.' IDENT      { $$ = new variable($1, tokbuf_node($2),
+                                                tokbuf_node($3)); }
           ;
 
-constant  : INTCON              { $$ = new constant($1); }
-          | CHARCON             { $$ = new constant($1); }
-          | STRINGCON           { $$ = new constant($1); }
-          | TOK_FALSE           { $$ = new constant($1); }
-          | TOK_TRUE            { $$ = new constant($1); }
-          | TOK_NULL            { $$ = new constant($1); }
+constant  : INTCON              { $$ = new constant(tokbuf_node($1),
+                                                tokbuf_value($1)); }
+          | CHARCON             { $$ = new constant(tokbuf_node($1),
+                                                tokbuf_value($1)); }
+          | STRINGCON           { $$ = new constant(tokbuf_node($1)); }
+          | TOK_FALSE           { $$ = new constant(tokbuf_node($1)); }
+          | TOK_TRUE            { $$ = new constant(tokbuf_node($1)); }
+          | TOK_NULL            { $$ = new constant(tokbuf_node($1)); }
           ;
 
 %%
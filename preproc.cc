@@ -0,0 +1,759 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// In-process replacement for /usr/bin/cpp.  Source files are mmap'd,
+// comments and line continuations are removed, directives are
+// interpreted and macros are expanded into a single output buffer which
+// the scanner reads in place.  Line markers use the same
+// "# linenr "filename"" form as cpp so scanner_include() is unchanged.
+
+#include <string>
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "preproc.h"
+#include "auxlib.h"
+
+using namespace std;
+
+struct macro {
+   bool funclike;
+   vector<string> params;
+   string body;
+};
+
+struct logical_line {
+   string text;      // line text with comments and continuations removed
+   int linenr;       // physical line number of the first line
+   int nlines;       // number of physical lines spanned
+};
+
+struct cond_state {
+   bool parent_active; // enclosing conditional is active
+   bool taken;         // some branch of this conditional was taken
+   bool active;        // current branch is active
+   bool seen_else;
+};
+
+static unordered_map<string,macro> macros;
+static string output;
+static const int MAX_INCLUDE_DEPTH = 200;
+static int include_depth = 0;
+
+// state of the file currently being preprocessed
+static const char* cur_filename = "";
+static int cur_linenr = 0;
+
+static bool process_file (const char* filename);
+
+static void pp_error (const char* message, const string& what) {
+   errprintf ("%:%s: %d: %s%s%s\n", cur_filename, cur_linenr, message,
+              what.empty() ? "" : " ", what.c_str());
+}
+
+static bool is_identstart (char c) {
+   return isalpha ((unsigned char) c) || c == '_';
+}
+
+static bool is_identchar (char c) {
+   return isalnum ((unsigned char) c) || c == '_';
+}
+
+// length of the token starting at text[pos]: identifiers, pp-numbers,
+// string and character literals (possibly unterminated) or one char
+static size_t token_length (const string& text, size_t pos) {
+   size_t end = pos;
+   char c = text[pos];
+   if (is_identstart (c)) {
+      while (end < text.size() && is_identchar (text[end])) ++end;
+   }else if (isdigit ((unsigned char) c)) {
+      while (end < text.size() && (is_identchar (text[end])
+                                   || text[end] == '.')) ++end;
+   }else if (c == '"' || c == '\'') {
+      for (++end; end < text.size() && text[end] != c; ++end) {
+         if (text[end] == '\\' && end + 1 < text.size()) ++end;
+      }
+      if (end < text.size()) ++end;
+   }else {
+      ++end;
+   }
+   return end - pos;
+}
+
+static size_t skip_space (const string& text, size_t pos) {
+   while (pos < text.size() && isspace ((unsigned char) text[pos])) ++pos;
+   return pos;
+}
+
+static string trim (const string& text) {
+   size_t first = skip_space (text, 0);
+   size_t last = text.size();
+   while (last > first && isspace ((unsigned char) text[last - 1])) --last;
+   return text.substr (first, last - first);
+}
+
+static string stringify (const string& arg) {
+   string result ("\"");
+   string text = trim (arg);
+   for (size_t i = 0; i < text.size(); ++i) {
+      if (text[i] == '"' || text[i] == '\\') result += '\\';
+      result += text[i];
+   }
+   result += '"';
+   return result;
+}
+
+/******************* macro expansion *******************/
+
+static string expand (const string& text, const set<string>& disabled,
+                      bool* incomplete);
+
+// collect the arguments of a function-like macro invocation whose
+// opening parenthesis is at text[pos].  returns the position after
+// the closing parenthesis or string::npos if the text ends first.
+static size_t collect_args (const string& text, size_t pos,
+                            vector<string>& args) {
+   int depth = 0;
+   string arg;
+   for (size_t i = pos; i < text.size(); ) {
+      size_t len = token_length (text, i);
+      char c = text[i];
+      if (c == '(') {
+         if (depth++ > 0) arg += c;
+      }else if (c == ')') {
+         if (--depth == 0) {
+            args.push_back (arg);
+            return i + 1;
+         }
+         arg += c;
+      }else if (c == ',' && depth == 1) {
+         args.push_back (arg);
+         arg.clear();
+      }else {
+         arg.append (text, i, len);
+      }
+      i += len;
+   }
+   return string::npos;
+}
+
+// index of the parameter named by the identifier at body[pos] or -1
+static int param_index (const macro& m, const string& body, size_t pos) {
+   if (pos >= body.size() || !is_identstart (body[pos])) return -1;
+   string id = body.substr (pos, token_length (body, pos));
+   for (size_t p = 0; p < m.params.size(); ++p) {
+      if (m.params[p] == id) return p;
+   }
+   return -1;
+}
+
+// substitute args for params in the body of m, handling # and ##
+static string substitute (const macro& m, const vector<string>& args,
+                          const set<string>& disabled) {
+   string result;
+   const string& body = m.body;
+   bool pasting = false;
+   for (size_t i = 0; i < body.size(); ) {
+      size_t len = token_length (body, i);
+      if (body.compare (i, 2, "##") == 0) {
+         while (!result.empty() && isspace ((unsigned char) result.back()))
+            result.pop_back();
+         i = skip_space (body, i + 2);
+         pasting = true;
+         continue;
+      }
+      if (body[i] == '#') {
+         size_t next = skip_space (body, i + 1);
+         int p = param_index (m, body, next);
+         if (p >= 0) {
+            result += stringify (args[p]);
+            i = next + token_length (body, next);
+            pasting = false;
+            continue;
+         }
+      }
+      int p = param_index (m, body, i);
+      if (p >= 0) {
+         // operands of ## are not macro expanded
+         size_t after = skip_space (body, i + len);
+         if (pasting || body.compare (after, 2, "##") == 0)
+            result += trim (args[p]);
+         else
+            result += expand (trim (args[p]), disabled, NULL);
+      }else {
+         result.append (body, i, len);
+      }
+      pasting = false;
+      i += len;
+   }
+   return result;
+}
+
+// expand all macros in text.  when incomplete is not NULL and a
+// function-like invocation is not closed before the end of the text,
+// *incomplete is set and the partial result is returned.
+static string expand (const string& text, const set<string>& disabled,
+                      bool* incomplete) {
+   string result;
+   for (size_t i = 0; i < text.size(); ) {
+      size_t len = token_length (text, i);
+      if (!is_identstart (text[i])) {
+         result.append (text, i, len);
+         i += len;
+         continue;
+      }
+      string id = text.substr (i, len);
+      if (id == "__FILE__") {
+         result += stringify (cur_filename);
+         i += len;
+         continue;
+      }
+      if (id == "__LINE__") {
+         char buffer[16];
+         sprintf (buffer, "%d", cur_linenr);
+         result += buffer;
+         i += len;
+         continue;
+      }
+      if (id == "__DATE__" || id == "__TIME__") {
+         char buffer[32];
+         time_t now = time (NULL);
+         strftime (buffer, sizeof buffer, id == "__DATE__" ? "%b %e %Y"
+                   : "%H:%M:%S", localtime (&now));
+         result += stringify (buffer);
+         i += len;
+         continue;
+      }
+      unordered_map<string,macro>::const_iterator itor = macros.find (id);
+      if (itor == macros.end() || disabled.count (id) > 0) {
+         result += id;
+         i += len;
+         continue;
+      }
+      const macro& m = itor->second;
+      set<string> inner (disabled);
+      inner.insert (id);
+      if (!m.funclike) {
+         result += expand (m.body, inner, NULL);
+         i += len;
+         continue;
+      }
+      size_t paren = skip_space (text, i + len);
+      if (paren >= text.size() || text[paren] != '(') {
+         if (paren >= text.size() && incomplete != NULL) {
+            *incomplete = true;
+            return result;
+         }
+         result += id;
+         i += len;
+         continue;
+      }
+      vector<string> args;
+      size_t end = collect_args (text, paren, args);
+      if (end == string::npos) {
+         if (incomplete != NULL) {
+            *incomplete = true;
+            return result;
+         }
+         pp_error ("unterminated argument list invoking macro", id);
+         return result;
+      }
+      if (m.params.empty() && args.size() == 1 && trim (args[0]).empty())
+         args.clear();
+      if (args.size() != m.params.size()) {
+         pp_error ("wrong number of arguments to macro", id);
+         i = end;
+         continue;
+      }
+      result += expand (substitute (m, args, disabled), inner, NULL);
+      i = end;
+   }
+   return result;
+}
+
+/******************* #if expressions *******************/
+
+struct if_parser {
+   const string& text;
+   size_t pos;
+   if_parser (const string& t) : text (t), pos (0) {}
+
+   bool accept (const char* op) {
+      pos = skip_space (text, pos);
+      size_t len = strlen (op);
+      if (text.compare (pos, len, op) != 0) return false;
+      // do not mistake "<=" for "<" or "==" for "="
+      if (len == 1 && pos + 1 < text.size() && text[pos + 1] == '='
+          && strchr ("<>!=", op[0]) != NULL) return false;
+      pos += len;
+      return true;
+   }
+
+   long primary () {
+      pos = skip_space (text, pos);
+      if (accept ("(")) {
+         long value = ternary();
+         if (!accept (")")) pp_error ("missing ')' in expression", "");
+         return value;
+      }
+      if (accept ("!")) return !primary();
+      if (accept ("-")) return -primary();
+      if (accept ("+")) return primary();
+      if (accept ("~")) return ~primary();
+      if (pos < text.size() && isdigit ((unsigned char) text[pos])) {
+         char* end;
+         long value = strtol (text.c_str() + pos, &end, 0);
+         pos = end - text.c_str();
+         while (pos < text.size() && is_identchar (text[pos])) ++pos;
+         return value;
+      }
+      if (pos < text.size() && text[pos] == '\'') {
+         size_t len = token_length (text, pos);
+         long value = len > 2 ? (unsigned char) text[pos + 1] : 0;
+         pos += len;
+         return value;
+      }
+      if (pos < text.size() && is_identstart (text[pos])) {
+         // identifiers remaining after expansion evaluate to 0
+         pos += token_length (text, pos);
+         return 0;
+      }
+      pp_error ("invalid expression in #if", text);
+      pos = text.size();
+      return 0;
+   }
+
+   long product () {
+      long value = primary();
+      for (;;) {
+         if (accept ("*")) {
+            value *= primary();
+         }else if (accept ("/") || accept ("%")) {
+            bool divide = text[pos - 1] == '/';
+            long divisor = primary();
+            if (divisor == 0) {
+               pp_error ("division by zero in #if", "");
+               value = 0;
+            }else {
+               value = divide ? value / divisor : value % divisor;
+            }
+         }else {
+            return value;
+         }
+      }
+   }
+
+   long sum () {
+      long value = product();
+      for (;;) {
+         if (accept ("+")) value += product();
+         else if (accept ("-")) value -= product();
+         else return value;
+      }
+   }
+
+   long relation () {
+      long value = sum();
+      for (;;) {
+         if (accept ("<=")) value = value <= sum();
+         else if (accept (">=")) value = value >= sum();
+         else if (accept ("<")) value = value < sum();
+         else if (accept (">")) value = value > sum();
+         else return value;
+      }
+   }
+
+   long equality () {
+      long value = relation();
+      for (;;) {
+         if (accept ("==")) value = value == relation();
+         else if (accept ("!=")) value = value != relation();
+         else return value;
+      }
+   }
+
+   long logical_and () {
+      long value = equality();
+      while (accept ("&&")) {
+         long rhs = equality();
+         value = value && rhs;
+      }
+      return value;
+   }
+
+   long logical_or () {
+      long value = logical_and();
+      while (accept ("||")) {
+         long rhs = logical_and();
+         value = value || rhs;
+      }
+      return value;
+   }
+
+   long ternary () {
+      long value = logical_or();
+      if (accept ("?")) {
+         long lhs = ternary();
+         if (!accept (":")) pp_error ("missing ':' in expression", "");
+         long rhs = ternary();
+         value = value ? lhs : rhs;
+      }
+      return value;
+   }
+};
+
+// replace "defined NAME" and "defined (NAME)" before macro expansion
+static string replace_defined (const string& text) {
+   string result;
+   for (size_t i = 0; i < text.size(); ) {
+      size_t len = token_length (text, i);
+      if (text.compare (i, len, "defined") != 0 || len != 7) {
+         result.append (text, i, len);
+         i += len;
+         continue;
+      }
+      size_t pos = skip_space (text, i + len);
+      bool paren = pos < text.size() && text[pos] == '(';
+      if (paren) pos = skip_space (text, pos + 1);
+      size_t idlen = pos < text.size() && is_identstart (text[pos])
+                   ? token_length (text, pos) : 0;
+      string id = text.substr (pos, idlen);
+      pos += idlen;
+      if (paren) {
+         pos = skip_space (text, pos);
+         if (pos < text.size() && text[pos] == ')') ++pos;
+      }
+      result += macros.count (id) > 0 ? " 1 " : " 0 ";
+      i = pos;
+   }
+   return result;
+}
+
+static bool eval_if (const string& text) {
+   string expanded = expand (replace_defined (text), set<string>(), NULL);
+   if_parser parser (expanded);
+   long value = parser.ternary();
+   if (skip_space (expanded, parser.pos) != expanded.size())
+      pp_error ("garbage at end of #if expression", expanded);
+   return value != 0;
+}
+
+/******************* directives *******************/
+
+static void define_macro (const string& text) {
+   size_t pos = skip_space (text, 0);
+   if (pos >= text.size() || !is_identstart (text[pos])) {
+      pp_error ("macro names must be identifiers", trim (text));
+      return;
+   }
+   size_t len = token_length (text, pos);
+   string name = text.substr (pos, len);
+   macro m;
+   m.funclike = false;
+   pos += len;
+   if (pos < text.size() && text[pos] == '(') {
+      m.funclike = true;
+      size_t close = text.find (')', pos);
+      if (close == string::npos) {
+         pp_error ("missing ')' in macro parameter list", name);
+         return;
+      }
+      string plist = text.substr (pos + 1, close - pos - 1);
+      size_t start = 0;
+      while (!trim (plist).empty()) {
+         size_t comma = plist.find (',', start);
+         m.params.push_back (trim (plist.substr (start, comma - start)));
+         if (comma == string::npos) break;
+         start = comma + 1;
+      }
+      pos = close + 1;
+   }
+   m.body = trim (text.substr (pos));
+   macros[name] = m;
+}
+
+// the include file is looked up relative to the including file,
+// the same way cpp resolves #include "file"
+static string include_path (const string& name) {
+   if (name.empty() || name[0] == '/') return name;
+   const char* slash = strrchr (cur_filename, '/');
+   if (slash == NULL) return name;
+   string path (cur_filename, slash - cur_filename + 1);
+   path.append (name);
+   if (access (path.c_str(), R_OK) == 0) return path;
+   return name;
+}
+
+static void emit_marker (int linenr, const char* filename, const char* flag) {
+   char buffer[32];
+   sprintf (buffer, "# %d \"", linenr);
+   output += buffer;
+   output += filename;
+   output += "\"";
+   output += flag;
+   output += "\n";
+}
+
+// returns false if nothing was included
+static bool include_file (const string& text, int next_linenr) {
+   string arg = trim (expand (text, set<string>(), NULL));
+   size_t end = string::npos;
+   if (!arg.empty() && (arg[0] == '"' || arg[0] == '<'))
+      end = arg.find (arg[0] == '<' ? '>' : '"', 1);
+   if (end == string::npos) {
+      pp_error ("#include expects \"FILENAME\" or <FILENAME>", "");
+      return false;
+   }
+   if (include_depth >= MAX_INCLUDE_DEPTH) {
+      pp_error ("#include nested too deeply", "");
+      return false;
+   }
+   string path = include_path (arg.substr (1, end - 1));
+   const char* filename = cur_filename;
+   int linenr = cur_linenr;
+   ++include_depth;
+   bool included = process_file (path.c_str());
+   --include_depth;
+   cur_filename = filename;
+   cur_linenr = linenr;
+   if (included) emit_marker (next_linenr, cur_filename, " 2");
+   return included;
+}
+
+// returns true if the directive emitted its own trailing newline
+static bool directive (const string& text, vector<cond_state>& conds,
+                       int next_linenr) {
+   size_t pos = skip_space (text, skip_space (text, 0) + 1);
+   size_t len = pos < text.size() && is_identstart (text[pos])
+              ? token_length (text, pos) : 0;
+   string name = text.substr (pos, len);
+   string rest = text.substr (pos + len);
+   bool active = conds.empty() || conds.back().active;
+
+   if (name == "ifdef" || name == "ifndef" || name == "if") {
+      cond_state c;
+      c.parent_active = active;
+      c.seen_else = false;
+      bool value = false;
+      if (active) {
+         if (name == "if") value = eval_if (rest);
+         else value = (macros.count (trim (rest)) > 0) == (name == "ifdef");
+      }
+      c.active = active && value;
+      c.taken = c.active;
+      conds.push_back (c);
+   }else if (name == "elif" || name == "else") {
+      if (conds.empty() || conds.back().seen_else) {
+         pp_error ("unexpected", "#" + name);
+         return false;
+      }
+      cond_state& c = conds.back();
+      if (name == "else") c.seen_else = true;
+      bool value = c.parent_active && !c.taken
+                 && (name == "else" || eval_if (rest));
+      c.active = value;
+      c.taken = c.taken || value;
+   }else if (name == "endif") {
+      if (conds.empty()) pp_error ("#endif without #if", "");
+      else conds.pop_back();
+   }else if (!active) {
+      // other directives inside a skipped group are ignored
+   }else if (name == "define") {
+      define_macro (rest);
+   }else if (name == "undef") {
+      macros.erase (trim (rest));
+   }else if (name == "include") {
+      return include_file (rest, next_linenr);
+   }else if (name == "error") {
+      pp_error ("#error", trim (rest));
+   }else if (name == "line" || name == "pragma" || name == "ident"
+             || name.empty()) {
+      // accepted and ignored
+   }else {
+      pp_error ("invalid preprocessing directive", "#" + name);
+   }
+   return false;
+}
+
+/******************* source reading *******************/
+
+// split the source into logical lines, removing comments and
+// backslash-newline continuations
+static void read_lines (const char* src, size_t size,
+                        vector<logical_line>& lines) {
+   logical_line line;
+   line.linenr = 1;
+   line.nlines = 1;
+   int linenr = 1;
+   char quote = '\0';
+   for (size_t i = 0; i < size; ++i) {
+      char c = src[i];
+      if (c == '\\' && i + 1 < size && src[i + 1] == '\n') {
+         ++i;
+         ++linenr;
+         ++line.nlines;
+         continue;
+      }
+      if (c == '\n') {
+         lines.push_back (line);
+         line.text.clear();
+         line.linenr = ++linenr;
+         line.nlines = 1;
+         quote = '\0';
+         continue;
+      }
+      if (quote != '\0') {
+         line.text += c;
+         if (c == '\\' && i + 1 < size && src[i + 1] != '\n') {
+            line.text += src[++i];
+         }else if (c == quote) {
+            quote = '\0';
+         }
+         continue;
+      }
+      if (c == '"' || c == '\'') {
+         quote = c;
+         line.text += c;
+      }else if (c == '/' && i + 1 < size && src[i + 1] == '/') {
+         while (i + 1 < size && src[i + 1] != '\n') {
+            if (src[i + 1] == '\\' && i + 2 < size && src[i + 2] == '\n') {
+               i += 2;
+               ++linenr;
+               ++line.nlines;
+            }else {
+               ++i;
+            }
+         }
+      }else if (c == '/' && i + 1 < size && src[i + 1] == '*') {
+         size_t start_linenr = linenr;
+         for (i += 2; i < size; ++i) {
+            if (src[i] == '*' && i + 1 < size && src[i + 1] == '/') break;
+            if (src[i] == '\n') {
+               ++linenr;
+               ++line.nlines;
+            }
+         }
+         if (i >= size) {
+            cur_linenr = start_linenr;
+            pp_error ("unterminated comment", "");
+            break;
+         }
+         ++i;
+         line.text += ' ';
+      }else {
+         line.text += c;
+      }
+   }
+   if (!line.text.empty() || line.nlines > 1) lines.push_back (line);
+}
+
+static void process_lines (const vector<logical_line>& lines) {
+   vector<cond_state> conds;
+   for (size_t n = 0; n < lines.size(); ++n) {
+      const logical_line& line = lines[n];
+      cur_linenr = line.linenr;
+      int nlines = line.nlines;
+      size_t first = skip_space (line.text, 0);
+      bool active = conds.empty() || conds.back().active;
+      if (first < line.text.size() && line.text[first] == '#') {
+         if (directive (line.text, conds, line.linenr + nlines)) continue;
+      }else if (active) {
+         // a macro invocation may continue onto following lines
+         string text = line.text;
+         bool incomplete = false;
+         string expanded = expand (text, set<string>(), &incomplete);
+         while (incomplete && n + 1 < lines.size()) {
+            size_t next = skip_space (lines[n + 1].text, 0);
+            if (next < lines[n + 1].text.size()
+                && lines[n + 1].text[next] == '#') break;
+            ++n;
+            text += ' ';
+            text += lines[n].text;
+            nlines += lines[n].nlines;
+            incomplete = false;
+            expanded = expand (text, set<string>(), &incomplete);
+         }
+         if (incomplete) expanded = expand (text, set<string>(), NULL);
+         output += expanded;
+      }
+      output.append (nlines, '\n');
+   }
+   if (!conds.empty()) pp_error ("unterminated conditional directive", "");
+}
+
+// returns false if the file could not be read
+static bool process_file (const char* filename) {
+   int fd = open (filename, O_RDONLY);
+   if (fd < 0) {
+      syserrprintf (filename);
+      return false;
+   }
+   struct stat info;
+   if (fstat (fd, &info) < 0) {
+      syserrprintf (filename);
+      close (fd);
+      return false;
+   }
+   size_t size = info.st_size;
+   const char* src = "";
+   void* mapping = MAP_FAILED;
+   if (size > 0) {
+      mapping = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+         syserrprintf (filename);
+         close (fd);
+         return false;
+      }
+      src = static_cast<const char*> (mapping);
+   }
+   close (fd);
+   DEBUGF ('x', "preprocessing %s, %zu bytes\n", filename, size);
+
+   cur_filename = filename;
+   cur_linenr = 1;
+   emit_marker (1, filename, include_depth > 0 ? " 1" : "");
+
+   // the filename is referenced by diagnostics until the file is done
+   string name (filename);
+   cur_filename = name.c_str();
+   vector<logical_line> lines;
+   read_lines (src, size, lines);
+   if (mapping != MAP_FAILED) munmap (mapping, size);
+   process_lines (lines);
+   return true;
+}
+
+// define a macro from the command line, "NAME" or "NAME=VALUE"
+void preproc_define (const char* definition) {
+   string text (definition);
+   size_t equals = text.find ('=');
+   if (equals == string::npos) text.append (" 1");
+   else text[equals] = ' ';
+   define_macro (text);
+}
+
+// preprocess filename and return a scanner ready buffer
+char* preproc_file (const char* filename, size_t* length) {
+   output.clear();
+   if (!process_file (filename)) return NULL;
+   *length = output.size();
+   // flex requires two end-of-buffer characters after the text
+   output.append (2, '\0');
+   return &output[0];
+}
+
+// release the buffer returned by preproc_file
+void preproc_release (void) {
+   string().swap (output);
+}
@@ -0,0 +1,25 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* in-process C preprocessor for oc source files */
+
+#ifndef __PREPROC_H__
+#define __PREPROC_H__
+
+#include <cstddef>
+
+#include "auxlib.h"
+
+// define a macro from the command line, "NAME" or "NAME=VALUE"
+void preproc_define (const char* definition);
+
+// preprocess filename and return a scanner ready buffer.
+// the buffer holds length bytes of text followed by two NUL bytes
+// and contains "# linenr "filename"" markers for every file entered.
+// returns NULL if the file could not be read.
+char* preproc_file (const char* filename, size_t* length);
+
+// release the buffer returned by preproc_file
+void preproc_release (void);
+
+#endif // __PREPROC_H__
@@ -1,51 +1,249 @@
 //$Id: stringset.cc,v 1.2 2013/10/28 03:56:36 ranetsbe Exp ranetsbe $
 // Reid Anetsberger ~ ranetsbe@ucsc.edu
 
-// Use cpp to scan a file and print line numbers.
-// Inserts strings from the file into the stringset adt
+// Inserts strings from the file into the stringset adt.
+//
+// The stringset is split into shards chosen by the top bits of a
+// string's hash.  A shard stores string bytes in large arena blocks
+// which are never moved, so the text of an id is stable for the life of
+// the compiler.  Ids index the shard's entry pages, which hold the
+// text, its length and its cached hash; pages are never moved either,
+// so an id may be resolved without taking a lock.
+//
+// Lookup within a shard is an open-addressing table of entry indexes
+// with linear probing, kept at most half full.  Most lookups find a
+// string that is already interned, so they probe the table without a
+// lock; only a miss takes the shard's mutex, probes again and inserts.
+// A slot is published after its entry is written, and a table replaced
+// by a larger one is kept so that readers still probing it are safe.
 
-#include <iostream>
-#include <unordered_set>
-#include <errno.h>
-#include <libgen.h>
-#include <stdlib.h>
-#include <string.h>
-//#include <wait.h>
+#include <cstdlib>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
 #include "stringset.h"
 #include "auxlib.h"
 using namespace std;
 
-typedef std::unordered_set<std::string> stringset;
-typedef stringset::const_iterator stringset_itor;
-typedef stringset::const_local_iterator stringset_bucket_itor;
+struct stringset_entry {
+   const char* text;       // NUL terminated text in the arena
+   uint32_t length;
+   uint32_t hash;
+};
 
-stringset set;                               // hashtable
+static const size_t SHARD_BITS = 4;
+static const size_t SHARD_COUNT = 1 << SHARD_BITS;
+static const size_t PAGE_BITS = 12;
+static const size_t PAGE_SIZE = 1 << PAGE_BITS;   // entries per page
+static const size_t PAGE_COUNT = 4096;            // pages per shard
+static const size_t ARENA_BLOCK = 64 * 1024;
+static const uint32_t EMPTY_SLOT = 0;  // slots hold index + 1
 
-// insert string to stringset
-const string* intern_stringset (const char* str) {
-   pair<stringset_itor,bool> handle = set.insert (str);
-   return &*handle.first;
+struct slot_table {
+   size_t size;
+   atomic<uint32_t>* slots;
+};
+
+struct alignas (64) stringset_shard {
+   atomic<slot_table*> table {NULL};  // open-addressing table
+   mutex lock;                   // held to insert
+   vector<slot_table*> retired;  // tables replaced by a larger one
+   vector<char*> arena_blocks;   // every block ever allocated
+   char* arena_next = NULL;      // free space in the last block
+   size_t arena_left = 0;
+   size_t arena_bytes = 0;       // bytes of string text stored
+   size_t count = 0;             // entries in this shard
+   stringset_entry* pages[PAGE_COUNT] = {};
+};
+
+static stringset_shard shards[SHARD_COUNT];
+
+// an id is the entry index within its shard followed by the shard bits
+static inline stringid make_id (size_t shard, size_t index) {
+   return (index << SHARD_BITS) | shard;
+}
+
+static inline stringset_entry& shard_entry (stringset_shard& shard,
+                                            size_t index) {
+   return shard.pages[index >> PAGE_BITS][index & (PAGE_SIZE - 1)];
+}
+
+// FNV-1a
+static uint32_t hash_string (const char* str, size_t length) {
+   uint32_t hash = 2166136261u;
+   for (size_t i = 0; i < length; ++i) {
+      hash ^= (unsigned char) str[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+// copy str into the shard's arena and NUL terminate it
+static const char* arena_copy (stringset_shard& shard, const char* str,
+                               size_t length) {
+   if (length + 1 > shard.arena_left) {
+      size_t size = length + 1 > ARENA_BLOCK ? length + 1 : ARENA_BLOCK;
+      char* block = new char[size];
+      shard.arena_blocks.push_back (block);
+      shard.arena_next = block;
+      shard.arena_left = size;
+   }
+   char* text = shard.arena_next;
+   memcpy (text, str, length);
+   text[length] = '\0';
+   shard.arena_next += length + 1;
+   shard.arena_left -= length + 1;
+   shard.arena_bytes += length + 1;
+   return text;
+}
+
+// build a table twice the size and reinsert every entry using its
+// cached hash, then publish it in place of the old one
+static slot_table* grow_slots (stringset_shard& shard, slot_table* old) {
+   slot_table* table = new slot_table;
+   table->size = old == NULL ? 256 : old->size * 2;
+   table->slots = new atomic<uint32_t>[table->size];
+   for (size_t slot = 0; slot < table->size; ++slot)
+      table->slots[slot].store (EMPTY_SLOT, memory_order_relaxed);
+   size_t mask = table->size - 1;
+   for (size_t index = 0; index < shard.count; ++index) {
+      size_t slot = shard_entry (shard, index).hash & mask;
+      while (table->slots[slot].load (memory_order_relaxed) != EMPTY_SLOT)
+         slot = (slot + 1) & mask;
+      table->slots[slot].store (index + 1, memory_order_relaxed);
+   }
+   if (old != NULL) shard.retired.push_back (old);
+   shard.table.store (table, memory_order_release);
+   return table;
+}
+
+// probe table for [str, str + length), return index + 1 of the entry
+// or EMPTY_SLOT with *slot set to the empty slot that ended the probe
+static uint32_t probe_slots (stringset_shard& shard, slot_table* table,
+                             const char* str, size_t length, uint32_t hash,
+                             size_t* slot) {
+   size_t mask = table->size - 1;
+   for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+      uint32_t found = table->slots[pos].load (memory_order_acquire);
+      if (found == EMPTY_SLOT) {
+         *slot = pos;
+         return EMPTY_SLOT;
+      }
+      const stringset_entry& entry = shard_entry (shard, found - 1);
+      if (entry.hash == hash && entry.length == length
+          && memcmp (entry.text, str, length) == 0) return found;
+   }
+}
+
+// append an entry, adding a page when the last one is full
+static size_t append_entry (stringset_shard& shard,
+                            const stringset_entry& entry) {
+   size_t index = shard.count;
+   size_t page = index >> PAGE_BITS;
+   if (page >= PAGE_COUNT) {
+      errprintf ("%: stringset shard is full\n");
+      abort();
+   }
+   if (shard.pages[page] == NULL)
+      shard.pages[page] = new stringset_entry[PAGE_SIZE];
+   shard_entry (shard, index) = entry;
+   ++shard.count;
+   return index;
+}
+
+// insert a string to the stringset and return its id
+stringid intern_stringset (const char* str, size_t length) {
+   uint32_t hash = hash_string (str, length);
+   size_t shardnr = hash >> (32 - SHARD_BITS);
+   stringset_shard& shard = shards[shardnr];
+   size_t slot;
+   slot_table* table = shard.table.load (memory_order_acquire);
+   if (table != NULL) {
+      uint32_t found = probe_slots (shard, table, str, length, hash, &slot);
+      if (found != EMPTY_SLOT) return make_id (shardnr, found - 1);
+   }
+   lock_guard<mutex> guard (shard.lock);
+   table = shard.table.load (memory_order_relaxed);
+   if (table == NULL || (shard.count + 1) * 2 > table->size)
+      table = grow_slots (shard, table);
+   uint32_t found = probe_slots (shard, table, str, length, hash, &slot);
+   if (found != EMPTY_SLOT) return make_id (shardnr, found - 1);
+   stringset_entry entry = {arena_copy (shard, str, length),
+                            uint32_t (length), hash};
+   size_t index = append_entry (shard, entry);
+   table->slots[slot].store (index + 1, memory_order_release);
+   return make_id (shardnr, index);
+}
+
+stringid intern_stringset (const char* str) {
+   return intern_stringset (str, strlen (str));
+}
+
+// return the interned string, NUL terminated and never moved
+const char* stringset_cstr (stringid id) {
+   return shard_entry (shards[id & (SHARD_COUNT - 1)], id >> SHARD_BITS).text;
+}
+
+string_view stringset_view (stringid id) {
+   const stringset_entry& entry =
+         shard_entry (shards[id & (SHARD_COUNT - 1)], id >> SHARD_BITS);
+   return string_view (entry.text, entry.length);
+}
+
+// number of strings in the stringset
+size_t stringset_size (void) {
+   size_t count = 0;
+   for (size_t shardnr = 0; shardnr < SHARD_COUNT; ++shardnr) {
+      lock_guard<mutex> guard (shards[shardnr].lock);
+      count += shards[shardnr].count;
+   }
+   return count;
 }
 
 // write the stringset to a file
 void dump_stringset (FILE* out) {
-   size_t max_bucket_size = 0;
-   for (size_t bucket = 0; bucket < set.bucket_count(); ++bucket) {
-      bool need_index = true;
-      size_t curr_size = set.bucket_size (bucket);
-      if (max_bucket_size < curr_size) max_bucket_size = curr_size;
-      for (stringset_bucket_itor itor = set.cbegin (bucket);
-           itor != set.cend (bucket); ++itor) {
-         if (need_index) fprintf (out, "stringset[%4lu]: ", bucket);
-                    else fprintf (out, "          %4s   ", "");
-         need_index = false;
-         const string* str = &*itor;
-         fprintf (out, "%22lu %p->\"%s\"\n", set.hash_function()(*str),
-                  str, str->c_str());
+   size_t slot_count = 0;
+   size_t string_count = 0;
+   size_t arena_bytes = 0;
+   size_t arena_blocks = 0;
+   size_t max_probe = 0;
+   size_t total_probe = 0;
+   size_t max_shard = 0;
+   for (size_t shardnr = 0; shardnr < SHARD_COUNT; ++shardnr) {
+      stringset_shard& shard = shards[shardnr];
+      lock_guard<mutex> guard (shard.lock);
+      slot_table* table = shard.table.load (memory_order_relaxed);
+      if (table == NULL) continue;
+      size_t mask = table->size - 1;
+      for (size_t slot = 0; slot < table->size; ++slot) {
+         uint32_t found = table->slots[slot].load (memory_order_relaxed);
+         if (found == EMPTY_SLOT) continue;
+         size_t index = found - 1;
+         const stringset_entry& entry = shard_entry (shard, index);
+         size_t probe = ((slot - entry.hash) & mask) + 1;
+         if (max_probe < probe) max_probe = probe;
+         total_probe += probe;
+         fprintf (out, "stringset[%2lu:%4lu]: %10u %5u %2lu %p->\"%s\"\n",
+                  shardnr, slot, entry.hash, make_id (shardnr, index), probe,
+                  entry.text, entry.text);
       }
+      slot_count += table->size;
+      string_count += shard.count;
+      arena_bytes += shard.arena_bytes;
+      arena_blocks += shard.arena_blocks.size();
+      if (max_shard < shard.count) max_shard = shard.count;
    }
-   fprintf (out, "load_factor = %.3f\n", set.load_factor());
-   fprintf (out, "bucket_count = %lu\n", set.bucket_count());
-   fprintf (out, "max_bucket_size = %lu\n", max_bucket_size);
+   fprintf (out, "load_factor = %.3f\n",
+            slot_count == 0 ? 0.0 : double (string_count) / slot_count);
+   fprintf (out, "shard_count = %lu\n", SHARD_COUNT);
+   fprintf (out, "slot_count = %lu\n", slot_count);
+   fprintf (out, "string_count = %lu\n", string_count);
+   fprintf (out, "max_shard_strings = %lu\n", max_shard);
+   fprintf (out, "arena_bytes = %lu in %lu blocks\n", arena_bytes,
+            arena_blocks);
+   fprintf (out, "max_probe_length = %lu\n", max_probe);
+   fprintf (out, "mean_probe_length = %.3f\n",
+            string_count == 0 ? 0.0 : double (total_probe) / string_count);
 }
@@ -5,13 +5,27 @@
 #define __STRINGSET_H__
 
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "auxlib.h"
 
-// insert a string to the stringset
-const std::string* intern_stringset (const char* str);
+// id of an interned string, equal ids mean equal strings
+typedef uint32_t stringid;
+
+// every function may be called from any number of threads at once
+
+// insert a string to the stringset and return its id
+stringid intern_stringset (const char* str, size_t length);
+stringid intern_stringset (const char* str);
+
+// return the interned string, NUL terminated and never moved
+const char* stringset_cstr (stringid id);
+std::string_view stringset_view (stringid id);
+
+// number of strings in the stringset
+size_t stringset_size (void);
 
 // write the stringset to a file
 void dump_stringset (FILE*);
@@ -0,0 +1,119 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// A struct is laid out once, when its definition is checked: its fields
+// keep the order the oil code declares them in and get C offsets.
+// Field names are found through a hash chosen so that no two names of
+// the struct collide, so a field access is one multiply and one index.
+
+#include <algorithm>
+
+#include "structtable.h"
+
+using namespace std;
+
+static vector<struct_layout> layouts;
+static vector<structref> struct_of_type;   // indexed by typeref
+
+static const uint32_t MULTIPLIER = 0x9E3779B1u;
+
+static uint32_t field_slot (const struct_layout& layout, stringid name) {
+   return ((name ^ layout.seed) * MULTIPLIER) >> layout.shift;
+}
+
+// size of a field of type in the oil code, also its alignment
+static uint32_t field_size (typeref type) {
+   if (type == TYPE_INT) return 4;
+   if (type == TYPE_CHAR || type == TYPE_BOOL) return 1;
+   return sizeof (void*);       // strings, structs and arrays are pointers
+}
+
+// try to place every field name of layout with the current seed
+static bool place_fields (struct_layout& layout) {
+   fill (layout.slots.begin(), layout.slots.end(), 0);
+   for (size_t i = 0; i < layout.fields.size(); ++i) {
+      stringid name = layout.fields[i].name;
+      uint16_t& slot = layout.slots[field_slot (layout, name)];
+      if (slot == 0) slot = i + 1;
+      else if (layout.fields[slot - 1].name != name) return false;
+      // a repeated field name keeps its first declaration
+   }
+   return true;
+}
+
+// find a seed for which the field names do not collide, doubling the
+// table until one turns up
+static void build_hash (struct_layout& layout) {
+   uint32_t bits = 1;
+   while ((1u << bits) < 2 * layout.fields.size()) ++bits;
+   for (;; ++bits) {
+      layout.shift = 32 - bits;
+      layout.slots.assign (size_t (1) << bits, 0);
+      for (layout.seed = 0; layout.seed < 256; ++layout.seed) {
+         if (place_fields (layout)) return;
+      }
+   }
+}
+
+// define struct type with fields given in oil order, returns
+// NO_STRUCT if it is already defined
+structref struct_define (typeref type, const vector<stringid>& names,
+                         const vector<typeref>& types) {
+   if (struct_lookup (type) != NO_STRUCT) return NO_STRUCT;
+   struct_layout layout;
+   layout.type = type;
+   layout.size = 0;
+   layout.align = 1;
+   for (size_t i = 0; i < names.size(); ++i) {
+      uint32_t size = field_size (types[i]);
+      layout.size = (layout.size + size - 1) / size * size;
+      field_layout field = {names[i], types[i], layout.size};
+      layout.fields.push_back (field);
+      layout.size += size;
+      if (size > layout.align) layout.align = size;
+   }
+   layout.size = (layout.size + layout.align - 1) / layout.align
+               * layout.align;
+   build_hash (layout);
+   structref s = layouts.size();
+   layouts.push_back (layout);
+   if (type >= struct_of_type.size()) {
+      struct_of_type.resize (type + 1, NO_STRUCT);
+   }
+   struct_of_type[type] = s;
+   return s;
+}
+
+// return the struct defined for type or NO_STRUCT
+structref struct_lookup (typeref type) {
+   if (type >= struct_of_type.size()) return NO_STRUCT;
+   return struct_of_type[type];
+}
+
+const struct_layout& struct_get (structref s) {
+   return layouts[s];
+}
+
+// return the index of field name in struct s or -1 if there is none
+int struct_field (structref s, stringid name) {
+   const struct_layout& layout = layouts[s];
+   uint16_t slot = layout.slots[field_slot (layout, name)];
+   if (slot == 0 || layout.fields[slot - 1].name != name) return -1;
+   return slot - 1;
+}
+
+// print every struct with its fields and their offsets
+void dump_structtable (FILE* out) {
+   for (size_t s = 0; s < layouts.size(); ++s) {
+      const struct_layout& layout = layouts[s];
+      fprintf (out, "struct %s: size %u align %u slots %zu seed %u\n",
+               type_name (layout.type).c_str(), layout.size, layout.align,
+               layout.slots.size(), layout.seed);
+      for (size_t i = 0; i < layout.fields.size(); ++i) {
+         const field_layout& field = layout.fields[i];
+         fprintf (out, "   %4u %s %s\n", field.offset,
+                  type_name (field.type).c_str(),
+                  stringset_cstr (field.name));
+      }
+   }
+}
@@ -0,0 +1,52 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* layouts of the structs defined by the program */
+
+#ifndef __STRUCTTABLE_H__
+#define __STRUCTTABLE_H__
+
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+
+#include "stringset.h"
+#include "typetable.h"
+
+// index of a defined struct in the table
+typedef uint32_t structref;
+const structref NO_STRUCT = UINT32_MAX;
+
+struct field_layout {
+   stringid name;
+   typeref type;
+   uint32_t offset;                 // bytes from the start of the struct
+};
+
+struct struct_layout {
+   typeref type;                    // the struct type itself
+   std::vector<field_layout> fields;  // in the order of the oil code
+   uint32_t size;                   // bytes, padded to align
+   uint32_t align;
+   uint32_t seed;                   // perfect hash of the field names
+   uint32_t shift;
+   std::vector<uint16_t> slots;     // field index + 1, 0 if empty
+};
+
+// define struct type with fields given in oil order, returns
+// NO_STRUCT if it is already defined
+structref struct_define (typeref type, const std::vector<stringid>& names,
+                         const std::vector<typeref>& types);
+
+// return the struct defined for type or NO_STRUCT
+structref struct_lookup (typeref type);
+
+const struct_layout& struct_get (structref s);
+
+// return the index of field name in struct s or -1 if there is none
+int struct_field (structref s, stringid name);
+
+// print every struct with its fields and their offsets
+void dump_structtable (FILE* out);
+
+#endif // __STRUCTTABLE_H__
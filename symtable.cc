@@ -1,11 +1,101 @@
 // $Id: symtable.cc,v 1.1 2013/11/27 15:58:42 ranetsbe Exp ranetsbe $
 // Reid Anetsberger ~ ranetsbe@ucsc.edu
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
 #include "auxlib.h"
+#include "astutils.h"
 #include "symtable.h"
 
 using namespace std;
 
+// Lookups during typechecking go through a hash table holding the
+// innermost visible symbol of each name: entering a block costs
+// nothing, adding a symbol pushes it over the symbol it shadows and
+// leaving the block pops its symbols again.  Blocks that are no longer
+// entered are searched one at a time instead.
+//
+// The global statements are checked first, on one thread.  Function
+// bodies may then be checked on other threads, each with a table of
+// its own locals in front of the table of globals, which no longer
+// changes.  A body only sees the globals declared before its function,
+// as if everything had been checked in order.
+
+static const stringid NO_NAME = UINT32_MAX;
+
+// open addressing map from a name to the symbol visible under it
+class binding_table {
+  std::vector<stringid> keys;
+  std::vector<symbol_record*> values;
+  size_t count;
+
+  size_t slot(stringid key) const {
+    size_t mask = keys.size() - 1;
+    size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+    while (keys[i] != NO_NAME && keys[i] != key) i = (i + 1) & mask;
+    return i;
+  }
+
+  void grow() {
+    std::vector<stringid> old_keys(keys.size() * 2, NO_NAME);
+    std::vector<symbol_record*> old_values(values.size() * 2, NULL);
+    old_keys.swap(keys);
+    old_values.swap(values);
+    for (size_t i = 0; i < old_keys.size(); ++i) {
+      if (old_keys[i] == NO_NAME) continue;
+      size_t s = slot(old_keys[i]);
+      keys[s] = old_keys[i];
+      values[s] = old_values[i];
+    }
+  }
+
+public:
+  binding_table() : keys(64, NO_NAME), values(64, NULL), count(0) {}
+
+  // returns the symbol stored under key or NULL
+  symbol_record* find(stringid key) const {
+    return values[slot(key)];
+  }
+
+  // store symbol under key, replacing what was there
+  void put(stringid key, symbol_record* symbol) {
+    size_t s = slot(key);
+    if (keys[s] == NO_NAME) {
+      if (2 * (count + 1) > keys.size()) {
+        grow();
+        s = slot(key);
+      }
+      keys[s] = key;
+      ++count;
+    }
+    values[s] = symbol;
+  }
+};
+
+// name -> innermost symbol visible to the global statements
+static binding_table global_visible;
+
+// number of global declarations made so far
+static uint32_t global_count = 0;
+
+// every declaration of a global declared more than once, in order
+static unordered_map<stringid, vector<symbol_record*> > global_history;
+
+// name -> innermost local of the function body a thread is checking
+static thread_local binding_table body_visible;
+
+// the table the entered block of this thread looks names up in
+static thread_local binding_table* visible = &global_visible;
+
+// innermost block entered and not yet left, NULL before the first one
+static thread_local SymbolTable* entered = NULL;
+
+// function block entered by resume() and the globals visible in it
+static thread_local SymbolTable* resumed = NULL;
+static thread_local uint32_t globals_seen = UINT32_MAX;
+
 // Creates and returns a new symbol table.
 //
 // Use "new SymbolTable(NULL)" to create the global table
@@ -14,223 +104,217 @@ SymbolTable::SymbolTable(SymbolTable* parent) {
   this->parent = parent;
   // Assign a unique number and increment the global N
   this->number = SymbolTable::N++;
+  // A block belongs to the function of its parent
+  this->function = parent == NULL ? TYPE_UNDEF : parent->function;
+  this->first_block = 0;
+  this->globals = UINT32_MAX;
 }
 
 // Creates a new empty table beneath the current table and returns it.
 SymbolTable* SymbolTable::enterBlock() {
   // Create a new symbol table beneath the current one
   SymbolTable* child = new SymbolTable(this);
-  // Convert child->number to a string stored in buffer
-  char buffer[10];
-  sprintf(&buffer[0], "%d", child->number);
-  // Use the number as ID for this symbol table
-  // to identify all child symbol tables
-  this->subscopes[buffer] = child;
+  // Remember it in the order entered, which is also the number order
+  this->blocks.push_back(child);
+  entered = child;
   // Return the newly created symbol table
   return child;
 }
 
 // Returns the parent block
 SymbolTable* SymbolTable::leave() {
+  // Uncover the symbols shadowed by the ones declared in this block
+  for (size_t i = symbols.size(); i-- > 0; ) {
+    visible->put(symbols[i].name, symbols[i].shadowed);
+  }
+  entered = parent;
+  if (this == resumed) {
+    // Back to the globals once a resumed function body is done
+    visible = &global_visible;
+    resumed = NULL;
+    globals_seen = UINT32_MAX;
+  }
   return parent;
 }
 
 // adds the function name as symbol to the current table
 // and creates a new empty table beneath the current one
-SymbolTable* SymbolTable::enterFunction(string name, string signature, string pos) {
+SymbolTable* SymbolTable::enterFunction(stringid name, typeref signature,
+                                        srcloc pos) {
+  SymbolTable* child = declareFunction(name, signature, pos, 0);
+  entered = child;
+  return child;
+}
+
+// adds the function name as symbol to the current table and creates
+// the table of its body without entering it
+SymbolTable* SymbolTable::declareFunction(stringid name, typeref signature,
+                                          srcloc pos, int nested) {
   this->addSymbol(name, signature, pos);
   SymbolTable* child = new SymbolTable(this);
-  this->subscopes[name] = child;
+  child->function = signature;
+  // A function block is dumped under its name, not among the blocks
+  symbols.back().function = child;
+  // Set aside the numbers of the blocks nested in the body
+  child->first_block = N;
+  N += nested;
+  child->globals = global_count;
   return child;
 }
 
+// enters a table made by declareFunction on the calling thread
+SymbolTable* SymbolTable::resume() {
+  visible = &body_visible;
+  resumed = this;
+  globals_seen = globals;
+  entered = this;
+  N = first_block;
+  return this;
+}
+
 // add a symbol with the provided name and type to the current table
-void SymbolTable::addSymbol(string name, string type, string pos) {
-  this->mapping[name] = val(type, pos);
+void SymbolTable::addSymbol(stringid name, typeref type, srcloc pos) {
+  symbol_record* shadowed = visible->find(name);
+  symbol_record symbol = {name, type, pos, number,
+                          mangle(number, stringset_cstr(name)), shadowed,
+                          NULL, parent == NULL ? global_count++ : 0, false};
+  if (shadowed != NULL && shadowed->number == number) {
+    // A second declaration in the same block replaces the first
+    shadowed->replaced = true;
+    symbol.function = shadowed->function;
+  }
+  symbols.push_back(symbol);
+  visible->put(name, &symbols.back());
+  if (parent == NULL && shadowed != NULL) {
+    // Keep every declaration for bodies checked after the global pass
+    vector<symbol_record*>& history = global_history[name];
+    if (history.empty()) history.push_back(shadowed);
+    history.push_back(&symbols.back());
+  }
+}
+
+// orders symbols by the spelling of their names
+static bool symbol_less(const symbol_record* a, const symbol_record* b) {
+  return strcmp(stringset_cstr(a->name), stringset_cstr(b->name)) < 0;
+}
+
+// orders blocks by the spelling of their numbers
+static bool block_less(SymbolTable* a, SymbolTable* b) {
+  char abuf[16], bbuf[16];
+  sprintf(abuf, "%d", a->getNumber());
+  sprintf(bbuf, "%d", b->getNumber());
+  return strcmp(abuf, bbuf) < 0;
 }
 
 // dumps the content of the symbol table and all its inner scopes
 // depth denotes the level of indention.
 void SymbolTable::dump(FILE* symfile, int depth) {
-  std::map<string,val>::iterator it;
-  for (it = this->mapping.begin(); it != this->mapping.end(); ++it) {
-    const char* name = it->first.c_str();
-    const char* type = it->second.first.c_str();
-    const char* pos = it->second.second.c_str();
-    // Print the symbol as "name (pos) {blocknumber} type"
+  std::vector<const symbol_record*> sorted;
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    if (!symbols[i].replaced) sorted.push_back(&symbols[i]);
+  }
+  std::sort(sorted.begin(), sorted.end(), symbol_less);
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    const symbol_record& symbol = *sorted[i];
+    const char* name = stringset_cstr(symbol.name);
+    const char* type = type_name(symbol.type).c_str();
+    size_t filenr, linenr, offset;
+    tokbuf_decode(symbol.pos, &filenr, &linenr, &offset);
+    // Print the symbol as "name (filenr.linenr.offset) {blocknumber} type"
     // indented by 3 spaces for each level
-    fprintf(symfile, "%*s%s %s {%d} %s\n", 3*depth, "", name, pos, this->number, type);
+    fprintf(symfile, "%*s%s (%zu.%zu.%zu) {%d} %s\n", 3*depth, "", name,
+            filenr, linenr, offset, this->number, type);
     // If the symbol we just printed is actually a function
-    // then we can find the symbol table of the function by the name
-    if (this->subscopes.count(name) > 0) {
-      // And recursively dump the functions symbol table
-      // before continuing the iteration
-      this->subscopes[name]->dump(symfile, depth + 1);
+    // then recursively dump the functions symbol table
+    // before continuing the iteration
+    if (symbol.function != NULL) {
+      symbol.function->dump(symfile, depth + 1);
     }
   }
-  // Create a new iterator for <string,SymbolTable*>
-  std::map<string,SymbolTable*>::iterator i;
-  // Iterate over all the child symbol tables
-  for (i = this->subscopes.begin(); i != this->subscopes.end(); ++i) {
-    // If we find the key of this symbol table in the symbol mapping
-    // then it is actually a function scope which we already dumped above
-    if (this->mapping.count(i->first) < 1) {
-      // Otherwise, recursively dump the (non-function) symbol table
-      i->second->dump(symfile, depth + 1);
-    }
+  // Then recursively dump the (non-function) symbol tables
+  std::vector<SymbolTable*> nested(blocks);
+  std::sort(nested.begin(), nested.end(), block_less);
+  for (size_t i = 0; i < nested.size(); ++i) {
+    nested[i]->dump(symfile, depth + 1);
   }
 }
 
-// Look up name in this and all surrounding blocks and return its type.
-//
-// Returns "undef" if variable was not found
-string SymbolTable::lookup(string name) {
-  // Look up "name" in the identifier mapping of the current block
-  if (this->mapping.count(name) > 0) {
-    // If we found an entry, just return its type
-    return this->mapping[name].first;
-  }
-  // Otherwise, if there is a surrounding scope
-  if (this->parent != NULL) {
-    // look up the symbol in the surrounding scope
-    // and return its reported type
-    return this->parent->lookup(name);
-  } else {
-    // Return "undef" if the global symbol table has no entry
-    //errprintf("Unknown identifier: %s\n", name.c_str());
-    return "undef";
-  }
+// orders global symbols by when they were declared
+static bool order_less(const symbol_record* symbol, uint32_t order) {
+  return symbol->order < order;
 }
 
-// Looks through the symbol table chain to find the function which
-// surrounds the scope and returns its signature
-// or "undef" if there is no surrounding function.
-//
-// Use parentFunction(NULL) to get the parentFunction of the current block.
-string SymbolTable::parentFunction(SymbolTable* innerScope) {
-  // Create a new <string,SymbolTable*> iterator
-  std::map<string,SymbolTable*>::iterator it;
-  // Iterate over all the subscopes of the current scopes
-  for (it = this->subscopes.begin(); it != this->subscopes.end(); ++it) {
-    // If we find the requested inner scope and if its name is a symbol
-    // in the identifier mapping
-    if (it->second == innerScope && this->mapping.count(it->first) > 0) {
-      // Then it must be the surrounding function, so return its type/signature
-      return this->mapping[it->first].first;
-    }
-  }
-  // If we did not find a surrounding function
-  if (this->parent != NULL) {
-    // Continue the lookup with the parent scope if there is one
-    return this->parent->parentFunction(this);
-  }
-  // If there is no parent scope, return "undef"
-  //errprintf("Could not find surrounding function\n");
-  return "undef";
+// returns the last global declaration of name before order or NULL
+static symbol_record* earlier_global(stringid name, uint32_t order) {
+  unordered_map<stringid, vector<symbol_record*> >::iterator found =
+      global_history.find(name);
+  if (found == global_history.end()) return NULL;
+  vector<symbol_record*>& history = found->second;
+  vector<symbol_record*>::iterator after =
+      lower_bound(history.begin(), history.end(), order, order_less);
+  return after == history.begin() ? NULL : *(after - 1);
 }
 
-// looks through the symbol table chain to find the block number where this
-// variable first appears
-//
-// returns -1 if not found
-int SymbolTable::lookup_number(string name) {
-  // Look up "name" in the identifier mapping of the current block
-  if (this->mapping.count(name) > 0) {
-    return this->number;
+// returns the symbol of name visible in this block or NULL
+symbol_record* SymbolTable::find(stringid name) {
+  if (this == entered || (entered == NULL && parent == NULL)) {
+    // The innermost visible symbol is kept up to date for the
+    // entered block, so there is no need to search
+    symbol_record* symbol = visible->find(name);
+    if (symbol != NULL || visible == &global_visible) return symbol;
+    // A resumed function body goes on to the globals declared before
+    // the function
+    symbol = global_visible.find(name);
+    if (symbol == NULL || symbol->order < globals_seen) return symbol;
+    return earlier_global(name, globals_seen);
   }
-  if (this->parent != NULL) {
-    return this->parent->lookup_number(name);
-  } else {
-    // Return -1 if the variable is not found
-    return -1;
+  // Otherwise look up "name" in each surrounding block in turn
+  for (SymbolTable* scope = this; scope != NULL; scope = scope->parent) {
+    for (size_t i = scope->symbols.size(); i-- > 0; ) {
+      symbol_record* symbol = &scope->symbols[i];
+      if (symbol->name != name) continue;
+      if (scope->parent == NULL && symbol->order >= globals_seen) continue;
+      return symbol;
+    }
   }
+  return NULL;
 }
 
-
-// return the number of this block
-int SymbolTable::getNumber() { return number; }
-
-// initialize running block ID to 0
-int SymbolTable::N(0);
-
-// Parses a function signature and returns all types as vector.
-// The first element of the vector is always the return type.
+// Look up name in this and all surrounding blocks and return its type.
 //
-// Example: "SymbolTable::parseSig("void(int,int)")
-//          returns ["void", "int", "int"]
-vector<string> SymbolTable::parseSig(string sig) {
-  // Initialize result string vector
-  vector<string> results;
-  // Find first opening parenthesis
-  size_t left = sig.find_first_of('(');
-  if (left == string::npos) {
-    // Print error and return empty results if not a function signature
-    //errprintf("%s is not a function\n", sig.c_str());
-    return results;
-  }
-  // Add return type
-  results.push_back(sig.substr(0, left));
-  // Starting with the position of the left parenthesis
-  // Find the next comma or closing parenthesis at each step
-  // and stop when the end is reached.
-  for (size_t i = left + 1; i < sig.length()-1; i = sig.find_first_of(",)", i) + 1) {
-    // At each step, get the substring between the current position
-    // and the next comma or closing parenthesis
-    results.push_back(sig.substr(i, sig.find_first_of(",)", i) - i));
-  }
-  return results;
+// Returns TYPE_UNDEF if variable was not found
+typeref SymbolTable::lookup(stringid name) {
+  symbol_record* symbol = this->find(name);
+  // Return TYPE_UNDEF if the global symbol table has no entry
+  return symbol == NULL ? TYPE_UNDEF : symbol->type;
 }
 
-// initialize usertypes map
-map<string, map<string, string> > SymbolTable::usertypes;
-
-void SymbolTable::debugstruct(){
-  eprintf("\nDEBUGSTRUCT\n");
-  std::map<string,map<string,string>>::iterator it = usertypes.begin();
-  for(; it != usertypes.end(); ++it) {
-     eprintf("struct name: %s\n", it->first.c_str());
-     std::map<string,string>::iterator iter;
-     for (iter = it->second.begin(); iter != it->second.end(); ++iter){
-        eprintf("  field: %s %s\n", iter->first.c_str(), iter->second.c_str());
-     }
-  }
-  eprintf("\n");
-}
-
-// insert a struct and its fields into the defined_types table
-/* TODO: does not check for duplicate ident declarations */
-void SymbolTable::define_usertype(string tname, std::vector<val>* fields) {
-   map<string, string> *set = new map<string, string>();
-   std::vector<val>::iterator it;
-   for (it = fields->begin(); it != fields->end(); ++it) {
-      set->insert (*it);
-   }
-   usertypes[tname] = *set;
+// Look up name in this and all surrounding blocks and return its symbol.
+//
+// Returns NULL if variable was not found
+const symbol_record* SymbolTable::resolve(stringid name) {
+  return this->find(name);
 }
 
-// returns true if the type "tname" exists in usertypes
-bool SymbolTable::lookup_usertype(string tname) {
-  if (usertypes.find(tname) != usertypes.end()) 
-    return true;
-  return false;
+// Returns the signature of the function which surrounds the scope
+// or TYPE_UNDEF if there is no surrounding function.
+typeref SymbolTable::parentFunction() {
+  return function;
 }
 
-// returns true if the field "tname.ident" exists in usertypes
-bool SymbolTable::lookup_field(string tname, string ident) {
-  std::map<string, map<string,string> >::iterator it = usertypes.find(tname);
-
-  if (it != usertypes.end() && it->second.find(ident) != it->second.end())
-    return true;
-  return false;
+// looks through the symbol table chain to find the block number where this
+// variable first appears
+//
+// returns -1 if not found
+int SymbolTable::lookup_number(stringid name) {
+  symbol_record* symbol = this->find(name);
+  // Return -1 if the variable is not found
+  return symbol == NULL ? -1 : symbol->number;
 }
 
-// returns the type of the field "tname.ident" if it exists
-// returns the empty string ("") if not found
-string SymbolTable::lookup_fieldtype(string tname, string ident) {
-  std::map<string, map<string,string> >::iterator it = usertypes.find(tname);
-  if (it != usertypes.end() && it->second.find(ident) != it->second.end())
-    return it->second.find(ident)->second;
-  return "undef";
-}
 
+// return the number of this block
+int SymbolTable::getNumber() { return number; }
 
+// initialize running block ID to 0
+thread_local int SymbolTable::N(0);
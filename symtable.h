@@ -5,30 +5,56 @@
 
 #include <stdio.h>
 
+#include <deque>
 #include <string>
 #include <vector>
-#include <utility>
-#include <map>
+
+#include "stringset.h"
+#include "typetable.h"
+#include "tokbuf.h"
 
 using namespace std;
-typedef std::pair<string,string> val; // val(type, pos)
+
+class SymbolTable;
+
+// A declared name.  Typechecking binds every use of a name to its
+// symbol, so code generation reads the mangled name from here instead
+// of searching the blocks again.
+struct symbol_record {
+  stringid name;
+  typeref type;
+  srcloc pos;
+  int number;              // block the symbol was declared in
+  std::string oil_name;    // name of the symbol in the oil code
+  symbol_record* shadowed; // symbol of the same name visible before this one
+  SymbolTable* function;   // block of the function named by this symbol
+  uint32_t order;          // position among the global declarations
+  bool replaced;           // declared again later in the same block
+};
 
 class SymbolTable {
 
-  // block number
+  // block number, also the order in which blocks were entered
   int number;
 
   SymbolTable* parent;
 
-  // the mapping of identifiers to their types
-  std::map<string,val>mapping;
+  // signature of the function this block belongs to, TYPE_UNDEF if none
+  typeref function;
+
+  // symbols declared in this block, in the order declared
+  std::deque<symbol_record> symbols;
 
-  // subscopes are mapped by their unique number or in the case of
-  // functions, the function name.
-  std::map<string,SymbolTable*> subscopes;
+  // nested blocks which are not function bodies, in the order entered
+  std::vector<SymbolTable*> blocks;
 
-  // global user defined types
-  static std::map<string, std::map<string, string> > usertypes;
+  // number of the first block nested in a function declared but not
+  // yet entered, and the global declarations its body can see
+  int first_block;
+  uint32_t globals;
+
+  // returns the symbol of name visible in this block
+  symbol_record* find(stringid name);
 
 public:
   // Creates and returns a new symbol table.
@@ -44,14 +70,25 @@ public:
   // and creates a new empty table beneath the current one.
   //
   // Example: To enter the function "void add(int a, int b)",
-  //          use "currentSymbolTable->enterFunction("add", "void(int,int)");
-  SymbolTable* enterFunction(string name, string signature, string pos);
+  //          use "currentSymbolTable->enterFunction(add,
+  //               type_function(TYPE_VOID, {TYPE_INT, TYPE_INT}), pos);
+  SymbolTable* enterFunction(stringid name, typeref signature, srcloc pos);
+
+  // Like enterFunction, but the new table is not entered.  Block
+  // numbers are set aside for the given number of nested blocks, so
+  // the body can be checked later, on any thread, by resume().
+  SymbolTable* declareFunction(stringid name, typeref signature, srcloc pos,
+                               int nested);
+
+  // Enters a table made by declareFunction on the calling thread.  Its
+  // body sees the globals declared up to the function, not later ones.
+  SymbolTable* resume();
 
   // Add a symbol with the provided name and type to the current table.
   //
   // Example: To add the variable declaration "int i = 23;"
-  //          use "currentSymbolTable->addSymbol("i", "int");
-  void addSymbol(string name, string type, string pos);
+  //          use "currentSymbolTable->addSymbol(i, TYPE_INT, pos);
+  void addSymbol(stringid name, typeref type, srcloc pos);
 
   // Dumps the content of the symbol table and all its inner scopes
   // depth denotes the level of indention.
@@ -61,15 +98,17 @@ public:
 
   // Look up name in this and all surrounding blocks and return its type.
   //
-  // Returns the "undef" if variable was not found
-  string lookup(string name);
+  // Returns TYPE_UNDEF if variable was not found
+  typeref lookup(stringid name);
 
-  // Looks through the symbol table chain to find the function which
-  // surrounds the scope and returns its signature
-  // or "" if there is no surrounding function.
+  // Look up name in this and all surrounding blocks and return its symbol.
   //
-  // Use parentFunction(NULL) to get the parentFunction of the current block.
-  string parentFunction(SymbolTable* innerScope);
+  // Returns NULL if variable was not found
+  const symbol_record* resolve(stringid name);
+
+  // Returns the signature of the function which surrounds the scope
+  // or TYPE_UNDEF if there is no surrounding function.
+  typeref parentFunction();
 
   // return the number of this block
   int getNumber();
@@ -78,32 +117,10 @@ public:
   // variable first appears
   //
   // returns -1 if not found
-  int lookup_number(string name);
-
-  // Running id number for symbol tables
-  static int N;
-
-  // Parses a function signature and returns all types as vector.
-  // The first element of the vector is always the return type.
-  //
-  // Example: "SymbolTable::parseSig("void(int,int)")
-  //          returns ["void", "int", "int"]
-  static std::vector<string> parseSig(string signature);
-
-  void debugstruct();
-
-  // insert a struct into the usertypes table
-  void define_usertype(std::string tname,  std::vector<val>* fields);
-
-  // returns true if the type "tname" exists in usertypes
-  bool lookup_usertype(std::string tname);
-
-  // returns true if the field "tname.ident" exists in usertypes
-  bool lookup_field(std::string tname, std::string ident);
+  int lookup_number(stringid name);
 
-  // returns the type of the field "tname.ident" if it exists
-  // returns the empty string "undef" if not found
-  string lookup_fieldtype(std::string tname, std::string ident);
+  // Running id number for symbol tables, kept by each thread
+  static thread_local int N;
 };
 
 #endif
@@ -0,0 +1,158 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// The scanner appends every token to a struct-of-arrays buffer instead
+// of allocating an ast for it.  A token is its symbol, a 32-bit source
+// location, the length of its lexeme in the scanned text and, for
+// INTCON and CHARCON, its parsed value.  The parser asks for an ast
+// node only for the tokens it keeps in the tree, and the .tok file is
+// written from the buffer in one pass when scanning is done.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "tokbuf.h"
+#include "lyutils.h"
+#include "stringset.h"
+
+using namespace std;
+
+struct token_columns {
+   vector<int16_t> symbol;    // token symbol
+   vector<srcloc> loc;        // offset of the lexeme in the scanned text
+   vector<uint32_t> length;   // length of the lexeme
+   vector<int32_t> value;     // INTCON and CHARCON value, 0 otherwise
+};
+
+struct line_entry {
+   srcloc start;              // offset of the first character of the line
+   int filenr;
+   int linenr;
+};
+
+struct tok_marker {
+   size_t token;              // index of the token following the marker
+   int linenr;
+   int filenr;
+};
+
+static const char* scan_base = NULL;
+static token_columns tokens;
+static vector<line_entry> lines;
+static vector<tok_marker> markers;
+
+// start a new token buffer over the scanned text beginning at base
+void tokbuf_reset (const char* base) {
+   scan_base = base;
+   tokens.symbol.clear();
+   tokens.loc.clear();
+   tokens.length.clear();
+   tokens.value.clear();
+   lines.clear();
+   markers.clear();
+   line_entry first = {0, 0, 1};
+   lines.push_back (first);
+}
+
+// value of the character constant 'c' or '\c'
+static int32_t charcon_value (const char* text, size_t length) {
+   if (length < 3) return 0;
+   if (text[1] != '\\') return (unsigned char) text[1];
+   switch (text[2]) {
+      case 'n': return '\n';
+      case 't': return '\t';
+      case '0': return '\0';
+      default:  return (unsigned char) text[2];
+   }
+}
+
+// append the token [text, text + length) and return its index
+int tokbuf_push (int symbol, const char* text, size_t length) {
+   int32_t value = 0;
+   if (symbol == INTCON) {
+      // wraps like the int the value is emitted as
+      uint32_t number = 0;
+      for (size_t i = 0; i < length && text[i] >= '0' && text[i] <= '9'; ++i)
+         number = number * 10 + (text[i] - '0');
+      value = number;
+   }else if (symbol == CHARCON) {
+      value = charcon_value (text, length);
+   }
+   tokens.symbol.push_back (symbol);
+   tokens.loc.push_back (text - scan_base);
+   tokens.length.push_back (length);
+   tokens.value.push_back (value);
+   return tokens.symbol.size() - 1;
+}
+
+// record that the line starting at next_line is linenr of filenr
+void tokbuf_newline (const char* next_line, int filenr, int linenr) {
+   line_entry entry = {srcloc (next_line - scan_base), filenr, linenr};
+   lines.push_back (entry);
+}
+
+// record a "# linenr "filename"" marker for the .tok dump
+void tokbuf_marker (int linenr, int filenr) {
+   tok_marker marker = {tokens.symbol.size(), linenr, filenr};
+   markers.push_back (marker);
+}
+
+static bool line_before (srcloc loc, const line_entry& entry) {
+   return loc < entry.start;
+}
+
+// decode loc into file number, line number and column
+void tokbuf_decode (srcloc loc, size_t* filenr, size_t* linenr,
+                    size_t* offset) {
+   if (loc == NO_SRCLOC) {
+      *filenr = *linenr = *offset = 0;
+      return;
+   }
+   vector<line_entry>::const_iterator itor =
+         upper_bound (lines.begin(), lines.end(), loc, line_before);
+   --itor;
+   *filenr = itor->filenr;
+   *linenr = itor->linenr;
+   *offset = loc - itor->start;
+}
+
+// create the ast node for token index, only called for kept tokens
+ast* tokbuf_node (int index) {
+   // the lexeme is interned straight from the scanned text
+   stringid lexeme = intern_stringset (scan_base + tokens.loc[index],
+                                       tokens.length[index]);
+   return new ast (tokens.symbol[index], tokens.loc[index], lexeme);
+}
+
+// the parsed value of an INTCON or CHARCON token
+int32_t tokbuf_value (int index) {
+   return tokens.value[index];
+}
+
+// number of tokens in the buffer
+size_t tokbuf_size (void) {
+   return tokens.symbol.size();
+}
+
+static void dump_marker (FILE* pipe, const tok_marker& marker) {
+   fprintf (pipe, ";# %d \"%s\"\n", marker.linenr,
+            scanner_filename (marker.filenr)->c_str());
+}
+
+// write every token to the .tok file
+void tokbuf_dump (FILE* pipe) {
+   size_t next_marker = 0;
+   for (size_t i = 0; i < tokens.symbol.size(); ++i) {
+      while (next_marker < markers.size() && markers[next_marker].token <= i)
+         dump_marker (pipe, markers[next_marker++]);
+      size_t filenr, linenr, offset;
+      tokbuf_decode (tokens.loc[i], &filenr, &linenr, &offset);
+      int symbol = tokens.symbol[i];
+      fprintf (pipe, "%4lu %3lu.%.3lu  %3d  %-16s  (%.*s)\n", filenr, linenr,
+               offset, symbol, get_yytname (symbol), int (tokens.length[i]),
+               scan_base + tokens.loc[i]);
+   }
+   while (next_marker < markers.size())
+      dump_marker (pipe, markers[next_marker++]);
+}
@@ -0,0 +1,51 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* columnar token buffer filled by the scanner */
+
+#ifndef __TOKBUF_H__
+#define __TOKBUF_H__
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+
+class ast;
+
+// a source location is the byte offset of a token in the scanned buffer,
+// decoded into file, line and column through the line table
+typedef uint32_t srcloc;
+
+// location of nodes that have none, decodes as file 0, line 0, column 0
+const srcloc NO_SRCLOC = UINT32_MAX;
+
+// start a new token buffer over the scanned text beginning at base
+void tokbuf_reset (const char* base);
+
+// append the token [text, text + length) and return its index.
+// INTCON and CHARCON values are parsed here.
+int tokbuf_push (int symbol, const char* text, size_t length);
+
+// record that the line starting at next_line is linenr of filenr
+void tokbuf_newline (const char* next_line, int filenr, int linenr);
+
+// record a "# linenr "filename"" marker for the .tok dump
+void tokbuf_marker (int linenr, int filenr);
+
+// create the ast node for token index, only called for kept tokens
+ast* tokbuf_node (int index);
+
+// the parsed value of an INTCON or CHARCON token
+int32_t tokbuf_value (int index);
+
+// number of tokens in the buffer
+size_t tokbuf_size (void);
+
+// decode loc into file number, line number and column
+void tokbuf_decode (srcloc loc, size_t* filenr, size_t* linenr,
+                    size_t* offset);
+
+// write every token to the .tok file
+void tokbuf_dump (FILE* pipe);
+
+#endif // __TOKBUF_H__
@@ -0,0 +1,155 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+// Types are hash-consed: a type is built only once and is afterwards
+// named by its index in the table.  Struct and basic types are found by
+// the interned id of their name, arrays through a link from their
+// element, and function signatures by their spelling.  A record keeps
+// the parts of its type, so signatures are never parsed back out of
+// strings.  Function bodies are checked on several threads, so new
+// types are added under a lock.
+
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "typetable.h"
+
+using namespace std;
+
+struct type_record {
+   type_kind kind;
+   typeref element;            // arrays: element type
+   typeref array;              // element[] once it exists, else TYPE_UNDEF
+   typeref result;             // functions: result type
+   vector<typeref> params;     // functions: parameter types
+   string name;                // spelling in oc
+};
+
+// Records live in pages that never move, so a record can be read
+// without a lock by any thread that was handed its id.  Ids are only
+// handed out under the lock, after the record is complete.
+static const size_t PAGE_BITS = 10;
+static const size_t PAGE_SIZE = size_t (1) << PAGE_BITS;
+static const size_t MAX_PAGES = 4096;
+
+static type_record* pages[MAX_PAGES];
+static size_t type_total = 0;
+static unordered_map<stringid, typeref> named_types;
+static unordered_map<string, typeref> function_types;
+static shared_mutex types_lock;
+static once_flag types_once;
+
+static type_record& record (typeref type) {
+   return pages[type >> PAGE_BITS][type & (PAGE_SIZE - 1)];
+}
+
+// append a type, the caller holds the lock
+static typeref add_type (type_kind kind, const string& name) {
+   if (type_total % PAGE_SIZE == 0) {
+      pages[type_total / PAGE_SIZE] = new type_record[PAGE_SIZE];
+   }
+   type_record& added = record (type_total);
+   added.kind = kind;
+   added.element = added.array = added.result = TYPE_UNDEF;
+   added.name = name;
+   return type_total++;
+}
+
+// create the predefined types
+static void init_types (void) {
+   static const char* basic[] = {
+      "undef", "void", "bool", "char", "int", "string", "null",
+   };
+   for (size_t i = 0; i < sizeof basic / sizeof basic[0]; ++i) {
+      typeref type = add_type (TYPE_KIND_BASIC, basic[i]);
+      named_types[intern_stringset (basic[i])] = type;
+   }
+}
+
+// return the basic or struct type spelled name in a basetype
+typeref type_named (stringid name) {
+   call_once (types_once, init_types);
+   {
+      shared_lock<shared_mutex> reading (types_lock);
+      unordered_map<stringid, typeref>::iterator found =
+            named_types.find (name);
+      if (found != named_types.end()) return found->second;
+   }
+   unique_lock<shared_mutex> writing (types_lock);
+   unordered_map<stringid, typeref>::iterator found = named_types.find (name);
+   if (found != named_types.end()) return found->second;
+   typeref type = add_type (TYPE_KIND_STRUCT, stringset_cstr (name));
+   named_types[name] = type;
+   return type;
+}
+
+typeref type_named (const char* name) {
+   return type_named (intern_stringset (name));
+}
+
+// return element[]
+typeref type_array (typeref element) {
+   call_once (types_once, init_types);
+   unique_lock<shared_mutex> writing (types_lock);
+   if (record (element).array != TYPE_UNDEF) return record (element).array;
+   typeref type = add_type (TYPE_KIND_ARRAY, record (element).name + "[]");
+   record (type).element = element;
+   record (element).array = type;
+   return type;
+}
+
+// return result(params...)
+typeref type_function (typeref result, const vector<typeref>& params) {
+   call_once (types_once, init_types);
+   string name = record (result).name + "(";
+   for (size_t i = 0; i < params.size(); ++i) {
+      if (i > 0) name.append (",");
+      name.append (record (params[i]).name);
+   }
+   name.append (")");
+   unique_lock<shared_mutex> writing (types_lock);
+   unordered_map<string, typeref>::iterator found = function_types.find (name);
+   if (found != function_types.end()) return found->second;
+   typeref type = add_type (TYPE_KIND_FUNCTION, name);
+   record (type).result = result;
+   record (type).params = params;
+   function_types[name] = type;
+   return type;
+}
+
+type_kind type_getkind (typeref type) {
+   call_once (types_once, init_types);
+   return record (type).kind;
+}
+
+// return the element of an array type or TYPE_UNDEF
+typeref type_element (typeref type) {
+   call_once (types_once, init_types);
+   return record (type).element;
+}
+
+// return the result of a function type or TYPE_UNDEF
+typeref type_result (typeref type) {
+   call_once (types_once, init_types);
+   return record (type).result;
+}
+
+// return the parameters of a function type, empty for other types
+const vector<typeref>& type_params (typeref type) {
+   call_once (types_once, init_types);
+   return record (type).params;
+}
+
+// return the type as spelled in oc
+const string& type_name (typeref type) {
+   call_once (types_once, init_types);
+   return record (type).name;
+}
+
+// number of types in the table
+size_t type_count (void) {
+   call_once (types_once, init_types);
+   shared_lock<shared_mutex> reading (types_lock);
+   return type_total;
+}
@@ -0,0 +1,59 @@
+// $Id$
+// Reid Anetsberger ~ ranetsbe@ucsc.edu
+
+/* hash-consed table of oc types */
+
+#ifndef __TYPETABLE_H__
+#define __TYPETABLE_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "stringset.h"
+
+// every distinct type has exactly one id, so two types are equal
+// exactly when their ids are equal
+typedef uint32_t typeref;
+
+enum type_kind {
+   TYPE_KIND_BASIC,      // the predefined types below
+   TYPE_KIND_ARRAY,      // element[]
+   TYPE_KIND_STRUCT,     // struct named by an identifier
+   TYPE_KIND_FUNCTION,   // result(param,param...)
+};
+
+// predefined types, in the order the table creates them
+enum : typeref {
+   TYPE_UNDEF, TYPE_VOID, TYPE_BOOL, TYPE_CHAR, TYPE_INT, TYPE_STRING,
+   TYPE_NULL,
+};
+
+// return the basic or struct type spelled name in a basetype
+typeref type_named (stringid name);
+typeref type_named (const char* name);
+
+// return element[]
+typeref type_array (typeref element);
+
+// return result(params...)
+typeref type_function (typeref result, const std::vector<typeref>& params);
+
+type_kind type_getkind (typeref type);
+
+// return the element of an array type or TYPE_UNDEF
+typeref type_element (typeref type);
+
+// return the result of a function type or TYPE_UNDEF
+typeref type_result (typeref type);
+
+// return the parameters of a function type, empty for other types
+const std::vector<typeref>& type_params (typeref type);
+
+// return the type as spelled in oc, e.g. "int[]" or "void(int,string)"
+const std::string& type_name (typeref type);
+
+// number of types in the table
+size_t type_count (void);
+
+#endif // __TYPETABLE_H__